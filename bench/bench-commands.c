@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "fake-npn.h"
+#include "gbp-stats.h"
+
+/* times pushing fire-and-forget commands on an instance lane and running
+ * them. Setting have_audio queues one AUDIO command per call, which is cheap
+ * to run before the pipeline is built. */
+
+#define DEFAULT_COMMANDS 100000
+/* pushed before waiting for the lane to drain, below the ring size so that
+ * no command is dropped */
+#define ROUND_SIZE 32
+
+static gint
+get_queue_depth (NPObject *object, NPIdentifier depth)
+{
+  NPVariant result;
+
+  if (!object->_class->getProperty (object, depth, &result))
+    g_error ("getting playbackQueueDepth failed");
+
+  return NPVARIANT_TO_INT32 (result);
+}
+
+int
+main (int argc, char **argv)
+{
+  NPP_t instance;
+  NPObject *object;
+  NPIdentifier have_audio, depth;
+  NPVariant value;
+  GstClockTime start, elapsed;
+  gint allocations, commands;
+  guint n_commands = DEFAULT_COMMANDS;
+  guint i;
+  char *plugin_argn[] = {"x-gbp-uri", "width", "height", "x-gbp-preload"};
+  char *plugin_argv[] = {"file:///dev/null", "320", "240", "none"};
+
+  if (argc > 1)
+    n_commands = MAX (atoi (argv[1]), 1);
+
+  if (!fake_npn_init ())
+    g_error ("NP_Initialize failed");
+
+  object = fake_npn_new_instance (&instance, G_N_ELEMENTS (plugin_argn),
+      plugin_argn, plugin_argv);
+  if (object == NULL)
+    g_error ("NPP_New failed");
+
+  have_audio = fake_npn_get_identifier ("have_audio");
+  depth = fake_npn_get_identifier ("playbackQueueDepth");
+
+  allocations = gbp_stats_get (GBP_STAT_PLAYBACK_COMMAND_ALLOCATIONS);
+  commands = gbp_stats_get (GBP_STAT_PLAYBACK_COMMANDS);
+
+  start = gst_util_get_timestamp ();
+  for (i = 0; i < n_commands; ++i) {
+    BOOLEAN_TO_NPVARIANT (i % 2, value);
+    if (!object->_class->setProperty (object, have_audio, &value))
+      g_error ("setting have_audio failed");
+
+    if ((i + 1) % ROUND_SIZE == 0 || i + 1 == n_commands) {
+      while (get_queue_depth (object, depth) > 0)
+        g_thread_yield ();
+    }
+  }
+  elapsed = gst_util_get_timestamp () - start;
+
+  allocations = gbp_stats_get (GBP_STAT_PLAYBACK_COMMAND_ALLOCATIONS) -
+      allocations;
+  commands = gbp_stats_get (GBP_STAT_PLAYBACK_COMMANDS) - commands;
+
+  g_print ("%u commands\n", n_commands);
+  g_print ("%-28s %8.1f ns/op\n", "push and run",
+      (gdouble) elapsed / n_commands);
+  g_print ("%-28s %d\n", "commands created", commands);
+  g_print ("%-28s %d (%.4f per command)\n", "slab allocations",
+      allocations, (gdouble) allocations / n_commands);
+
+  fake_npn_destroy_instance (&instance, object);
+  fake_npn_shutdown ();
+
+  return 0;
+}
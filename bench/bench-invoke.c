@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "fake-npn.h"
+
+/* times the dispatch of javascript calls on the plugin object, the methods
+ * and properties are cheap so that the lookup dominates */
+
+#define DEFAULT_ITERATIONS 1000000
+
+static void
+report (const char *name, GstClockTime elapsed, guint iterations)
+{
+  g_print ("%-28s %8.1f ns/op\n", name, (gdouble) elapsed / iterations);
+}
+
+static void
+bench_invoke (NPObject *object, const char *name, guint iterations)
+{
+  NPIdentifier identifier = fake_npn_get_identifier (name);
+  NPVariant args[1];
+  NPVariant result;
+  GstClockTime start;
+  char *label;
+  guint i;
+
+  start = gst_util_get_timestamp ();
+  for (i = 0; i < iterations; ++i) {
+    if (!object->_class->invoke (object, identifier, args, 0, &result))
+      g_error ("invoking %s failed", name);
+    NPN_ReleaseVariantValue (&result);
+  }
+
+  label = g_strdup_printf ("invoke %s ()", name);
+  report (label, gst_util_get_timestamp () - start, iterations);
+  g_free (label);
+}
+
+static void
+bench_get_property (NPObject *object, const char *name, guint iterations)
+{
+  NPIdentifier identifier = fake_npn_get_identifier (name);
+  NPVariant result;
+  GstClockTime start;
+  char *label;
+  guint i;
+
+  start = gst_util_get_timestamp ();
+  for (i = 0; i < iterations; ++i) {
+    if (!object->_class->getProperty (object, identifier, &result))
+      g_error ("getting %s failed", name);
+    NPN_ReleaseVariantValue (&result);
+  }
+
+  label = g_strdup_printf ("get %s", name);
+  report (label, gst_util_get_timestamp () - start, iterations);
+  g_free (label);
+}
+
+/* name is the first or last entry of its table, or unknown */
+static void
+bench_has (NPObject *object, const char *name, gboolean method,
+    guint iterations)
+{
+  NPIdentifier identifier = fake_npn_get_identifier (name);
+  GstClockTime start;
+  char *label;
+  guint i;
+
+  start = gst_util_get_timestamp ();
+  for (i = 0; i < iterations; ++i) {
+    if (method)
+      object->_class->hasMethod (object, identifier);
+    else
+      object->_class->hasProperty (object, identifier);
+  }
+
+  label = g_strdup_printf ("%s %s", method ? "hasMethod" : "hasProperty",
+      name);
+  report (label, gst_util_get_timestamp () - start, iterations);
+  g_free (label);
+}
+
+int
+main (int argc, char **argv)
+{
+  NPP_t instance;
+  NPObject *object;
+  guint iterations = DEFAULT_ITERATIONS;
+  char *plugin_argn[] = {"x-gbp-uri", "width", "height", "x-gbp-preload"};
+  char *plugin_argv[] = {"file:///dev/null", "320", "240", "none"};
+
+  if (argc > 1)
+    iterations = MAX (atoi (argv[1]), 1);
+
+  if (!fake_npn_init ())
+    g_error ("NP_Initialize failed");
+
+  object = fake_npn_new_instance (&instance, G_N_ELEMENTS (plugin_argn),
+      plugin_argn, plugin_argv);
+  if (object == NULL)
+    g_error ("NPP_New failed");
+
+  g_print ("%u iterations\n", iterations);
+
+  bench_has (object, "start", TRUE, iterations);
+  bench_has (object, "exec", TRUE, iterations);
+  bench_has (object, "missing", TRUE, iterations);
+  bench_has (object, "state", FALSE, iterations);
+  bench_has (object, "hidden", FALSE, iterations);
+  bench_has (object, "missing", FALSE, iterations);
+
+  bench_invoke (object, "get_duration", iterations);
+  bench_invoke (object, "get_position", iterations);
+
+  bench_get_property (object, "state", iterations);
+  bench_get_property (object, "volume", iterations);
+  bench_get_property (object, "playbackQueueDepth", iterations);
+
+  fake_npn_destroy_instance (&instance, object);
+  fake_npn_shutdown ();
+
+  return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include "gbp-abr.h"
+
+/* checks the bitrate controller against the default policy: 20% up
+ * hysteresis, 0.8 safety margin, low and high buffer levels of 20 and 80 */
+
+/* 8000 kbps */
+#define FAST_LINK 1000000
+#define MID_BUFFER 50
+
+static GbpAbr *
+new_abr (void)
+{
+  const GbpAbrPolicy *policy;
+
+  policy = gbp_abr_policy_lookup ("default");
+  g_assert (policy != NULL);
+
+  return gbp_abr_new (policy);
+}
+
+static void
+check_first_sample (void)
+{
+  GbpAbr *abr = new_abr ();
+
+  g_assert (gbp_abr_get_connection_speed (abr) == 0);
+  g_assert (!gbp_abr_add_sample (abr, 0, MID_BUFFER));
+  g_assert (gbp_abr_get_connection_speed (abr) == 0);
+
+  g_assert (gbp_abr_add_sample (abr, FAST_LINK, MID_BUFFER));
+  g_assert (gbp_abr_get_connection_speed (abr) == 6400);
+
+  gbp_abr_reset (abr);
+  g_assert (gbp_abr_get_connection_speed (abr) == 0);
+
+  gbp_abr_free (abr);
+}
+
+static void
+check_hysteresis (void)
+{
+  GbpAbr *abr = new_abr ();
+  guint speed;
+
+  g_assert (gbp_abr_add_sample (abr, FAST_LINK, MID_BUFFER));
+
+  /* averages to 8120 kbps, 6496 is less than 20% up */
+  g_assert (!gbp_abr_add_sample (abr, 1050000, MID_BUFFER));
+  g_assert (gbp_abr_get_connection_speed (abr) == 6400);
+
+  /* averages to 10484 kbps, 8387 is enough to switch up */
+  g_assert (gbp_abr_add_sample (abr, 2000000, MID_BUFFER));
+  speed = gbp_abr_get_connection_speed (abr);
+  g_assert (speed > 6400 * 1.2);
+
+  /* going down doesn't wait */
+  g_assert (gbp_abr_add_sample (abr, 500000, MID_BUFFER));
+  g_assert (gbp_abr_get_connection_speed (abr) < speed);
+
+  gbp_abr_free (abr);
+}
+
+static void
+check_buffer_level (void)
+{
+  GbpAbr *abr = new_abr ();
+
+  /* a low buffer halves the margin */
+  g_assert (gbp_abr_add_sample (abr, FAST_LINK, 10));
+  g_assert (gbp_abr_get_connection_speed (abr) == 3200);
+
+  /* a full one drops it */
+  gbp_abr_reset (abr);
+  g_assert (gbp_abr_add_sample (abr, FAST_LINK, 90));
+  g_assert (gbp_abr_get_connection_speed (abr) == 8000);
+
+  /* an unknown one keeps it */
+  gbp_abr_reset (abr);
+  g_assert (gbp_abr_add_sample (abr, FAST_LINK, -1));
+  g_assert (gbp_abr_get_connection_speed (abr) == 6400);
+
+  gbp_abr_free (abr);
+}
+
+static void
+check_window (void)
+{
+  GbpAbr *abr = new_abr ();
+
+  /* 320x240 at 30fps and 0.15 bits per pixel */
+  gbp_abr_set_window (abr, 320, 240);
+  g_assert (gbp_abr_add_sample (abr, FAST_LINK, 90));
+  g_assert (gbp_abr_get_connection_speed (abr) == 345);
+
+  /* the policy minimum still applies */
+  gbp_abr_reset (abr);
+  g_assert (gbp_abr_add_sample (abr, 1000, 90));
+  g_assert (gbp_abr_get_connection_speed (abr) == 128);
+
+  gbp_abr_free (abr);
+}
+
+int
+main (int argc, char **argv)
+{
+  check_first_sample ();
+  check_hysteresis ();
+  check_buffer_level ();
+  check_window ();
+
+  return 0;
+}
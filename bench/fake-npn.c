@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <string.h>
+
+#include "fake-npn.h"
+
+typedef struct _AsyncCall
+{
+  void (*func) (void *);
+  void *user_data;
+} AsyncCall;
+
+static NPNetscapeFuncs browser_funcs;
+static NPPluginFuncs plugin_funcs;
+/* AsyncCall scheduled with NPN_PluginThreadAsyncCall from any thread */
+static GAsyncQueue *async_calls;
+/* string identifiers are interned strings, int identifiers point into
+ * int_identifiers */
+static GHashTable *string_identifiers;
+static GHashTable *int_identifiers;
+
+static const char *
+fake_user_agent (NPP instance)
+{
+  return "fake-npn";
+}
+
+static void *
+fake_mem_alloc (uint32_t size)
+{
+  return g_malloc (size);
+}
+
+static void
+fake_mem_free (void *ptr)
+{
+  g_free (ptr);
+}
+
+static uint32_t
+fake_mem_flush (uint32_t size)
+{
+  return 0;
+}
+
+static NPError
+fake_get_url (NPP instance, const char *url, const char *target)
+{
+  return NPERR_GENERIC_ERROR;
+}
+
+static NPError
+fake_get_url_notify (NPP instance, const char *url, const char *target,
+    void *notify_data)
+{
+  return NPERR_GENERIC_ERROR;
+}
+
+static NPError
+fake_get_value (NPP instance, NPNVariable variable, void *value)
+{
+  return NPERR_GENERIC_ERROR;
+}
+
+static NPError
+fake_set_value (NPP instance, NPPVariable variable, void *value)
+{
+  return NPERR_NO_ERROR;
+}
+
+static NPIdentifier
+fake_get_string_identifier (const NPUTF8 *name)
+{
+  const char *identifier = g_intern_string (name);
+
+  g_hash_table_insert (string_identifiers, (gpointer) identifier,
+      (gpointer) identifier);
+
+  return (NPIdentifier) identifier;
+}
+
+static void
+fake_get_string_identifiers (const NPUTF8 **names, int32_t count,
+    NPIdentifier *identifiers)
+{
+  int32_t i;
+
+  for (i = 0; i < count; ++i)
+    identifiers[i] = fake_get_string_identifier (names[i]);
+}
+
+static NPIdentifier
+fake_get_int_identifier (int32_t intid)
+{
+  gint *identifier;
+
+  identifier = g_hash_table_lookup (int_identifiers, GINT_TO_POINTER (intid));
+  if (identifier == NULL) {
+    identifier = g_new (gint, 1);
+    *identifier = intid;
+    g_hash_table_insert (int_identifiers, GINT_TO_POINTER (intid), identifier);
+  }
+
+  return (NPIdentifier) identifier;
+}
+
+static bool
+fake_identifier_is_string (NPIdentifier identifier)
+{
+  return g_hash_table_lookup (string_identifiers, identifier) != NULL;
+}
+
+static NPUTF8 *
+fake_utf8_from_identifier (NPIdentifier identifier)
+{
+  if (!fake_identifier_is_string (identifier))
+    return NULL;
+
+  return g_strdup ((const char *) identifier);
+}
+
+static int32_t
+fake_int_from_identifier (NPIdentifier identifier)
+{
+  if (fake_identifier_is_string (identifier))
+    return G_MININT32;
+
+  return *((gint *) identifier);
+}
+
+static NPObject *
+fake_create_object (NPP npp, NPClass *klass)
+{
+  NPObject *object;
+
+  if (klass->allocate != NULL)
+    object = klass->allocate (npp, klass);
+  else
+    object = g_new (NPObject, 1);
+
+  object->_class = klass;
+  object->referenceCount = 1;
+
+  return object;
+}
+
+static NPObject *
+fake_retain_object (NPObject *object)
+{
+  g_atomic_int_inc ((gint *) &object->referenceCount);
+
+  return object;
+}
+
+static void
+fake_release_object (NPObject *object)
+{
+  if (!g_atomic_int_dec_and_test ((gint *) &object->referenceCount))
+    return;
+
+  if (object->_class->deallocate != NULL)
+    object->_class->deallocate (object);
+  else
+    g_free (object);
+}
+
+/* there's no javascript, calls on browser objects fail */
+static bool
+fake_invoke (NPP npp, NPObject *object, NPIdentifier name,
+    const NPVariant *args, uint32_t count, NPVariant *result)
+{
+  return FALSE;
+}
+
+static bool
+fake_invoke_default (NPP npp, NPObject *object, const NPVariant *args,
+    uint32_t count, NPVariant *result)
+{
+  return FALSE;
+}
+
+static bool
+fake_get_property (NPP npp, NPObject *object, NPIdentifier name,
+    NPVariant *result)
+{
+  return FALSE;
+}
+
+static bool
+fake_set_property (NPP npp, NPObject *object, NPIdentifier name,
+    const NPVariant *value)
+{
+  return FALSE;
+}
+
+static void
+fake_release_variant_value (NPVariant *variant)
+{
+  if (NPVARIANT_IS_STRING (*variant))
+    g_free ((char *) NPVARIANT_TO_STRING (*variant).UTF8Characters);
+  else if (NPVARIANT_IS_OBJECT (*variant))
+    fake_release_object (NPVARIANT_TO_OBJECT (*variant));
+
+  VOID_TO_NPVARIANT (*variant);
+}
+
+static void
+fake_set_exception (NPObject *object, const NPUTF8 *message)
+{
+}
+
+static void
+fake_plugin_thread_async_call (NPP instance, void (*func) (void *),
+    void *user_data)
+{
+  AsyncCall *call = g_new (AsyncCall, 1);
+
+  call->func = func;
+  call->user_data = user_data;
+  g_async_queue_push (async_calls, call);
+}
+
+gboolean
+fake_npn_init ()
+{
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+
+  async_calls = g_async_queue_new ();
+  string_identifiers = g_hash_table_new (NULL, NULL);
+  int_identifiers = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  browser_funcs.size = sizeof (NPNetscapeFuncs);
+  browser_funcs.version = (NP_VERSION_MAJOR << 8) + NP_VERSION_MINOR;
+  browser_funcs.uagent = fake_user_agent;
+  browser_funcs.memalloc = fake_mem_alloc;
+  browser_funcs.memfree = fake_mem_free;
+  browser_funcs.memflush = fake_mem_flush;
+  browser_funcs.geturl = fake_get_url;
+  browser_funcs.geturlnotify = fake_get_url_notify;
+  browser_funcs.getvalue = fake_get_value;
+  browser_funcs.setvalue = fake_set_value;
+  browser_funcs.getstringidentifier = fake_get_string_identifier;
+  browser_funcs.getstringidentifiers = fake_get_string_identifiers;
+  browser_funcs.getintidentifier = fake_get_int_identifier;
+  browser_funcs.identifierisstring = fake_identifier_is_string;
+  browser_funcs.utf8fromidentifier = fake_utf8_from_identifier;
+  browser_funcs.intfromidentifier = fake_int_from_identifier;
+  browser_funcs.createobject = fake_create_object;
+  browser_funcs.retainobject = fake_retain_object;
+  browser_funcs.releaseobject = fake_release_object;
+  browser_funcs.invoke = fake_invoke;
+  browser_funcs.invokeDefault = fake_invoke_default;
+  browser_funcs.getproperty = fake_get_property;
+  browser_funcs.setproperty = fake_set_property;
+  browser_funcs.releasevariantvalue = fake_release_variant_value;
+  browser_funcs.setexception = fake_set_exception;
+  browser_funcs.pluginthreadasynccall = fake_plugin_thread_async_call;
+
+  plugin_funcs.size = sizeof (NPPluginFuncs);
+
+  return NP_Initialize (&browser_funcs, &plugin_funcs) == NPERR_NO_ERROR;
+}
+
+void
+fake_npn_shutdown ()
+{
+  fake_npn_run_async_calls ();
+  NP_Shutdown ();
+
+  g_async_queue_unref (async_calls);
+  async_calls = NULL;
+  g_hash_table_destroy (string_identifiers);
+  string_identifiers = NULL;
+  g_hash_table_destroy (int_identifiers);
+  int_identifiers = NULL;
+}
+
+/* returns the scriptable object of the new instance, NULL on failure */
+NPObject *
+fake_npn_new_instance (NPP instance, int16_t argc, char *argn[],
+    char *argv[])
+{
+  NPObject *object = NULL;
+
+  memset (instance, 0, sizeof (NPP_t));
+  if (plugin_funcs.newp ("application/x-gbp", instance, NP_EMBED,
+        argc, argn, argv, NULL) != NPERR_NO_ERROR)
+    return NULL;
+
+  if (plugin_funcs.getvalue (instance, NPPVpluginScriptableNPObject,
+        &object) != NPERR_NO_ERROR) {
+    plugin_funcs.destroy (instance, NULL);
+    return NULL;
+  }
+
+  return object;
+}
+
+void
+fake_npn_destroy_instance (NPP instance, NPObject *object)
+{
+  fake_release_object (object);
+  plugin_funcs.destroy (instance, NULL);
+}
+
+NPIdentifier
+fake_npn_get_identifier (const char *name)
+{
+  return fake_get_string_identifier (name);
+}
+
+/* the browser drops the calls of destroyed instances, the plugin checks for
+ * them itself */
+void
+fake_npn_run_async_calls ()
+{
+  AsyncCall *call;
+
+  while ((call = (AsyncCall *) g_async_queue_try_pop (async_calls)) != NULL) {
+    call->func (call->user_data);
+    g_free (call);
+  }
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef FAKE_NPN_H
+#define FAKE_NPN_H
+
+#include "gbp-npapi.h"
+
+G_BEGIN_DECLS
+
+/* a browser just good enough to drive the plugin from main (). The thread
+ * calling fake_npn_init () plays the browser thread. */
+gboolean fake_npn_init ();
+void fake_npn_shutdown ();
+NPObject *fake_npn_new_instance (NPP instance, int16_t argc, char *argn[],
+    char *argv[]);
+void fake_npn_destroy_instance (NPP instance, NPObject *object);
+NPIdentifier fake_npn_get_identifier (const char *name);
+void fake_npn_run_async_calls ();
+
+G_END_DECLS
+
+#endif /* FAKE_NPN_H */
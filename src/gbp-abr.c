@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <string.h>
+#include "gbp-abr.h"
+
+/* picks a connection speed for adaptive streams from the download rate and
+ * buffer level reported by the pipeline */
+struct _GbpAbr
+{
+  const GbpAbrPolicy *policy;
+  /* moving average of the measured throughput, in kbps */
+  gdouble throughput;
+  /* upper bound from the window size, 0 if unknown */
+  guint window_kbps;
+  guint connection_speed;
+};
+
+static const GbpAbrPolicy policies[] = {
+  {"conservative", 0.1, 0.7, 0.3, 30, 90, 0.10, 128, 0},
+  {"default", 0.3, 0.8, 0.2, 20, 80, 0.15, 128, 0},
+  {"aggressive", 0.5, 0.95, 0.1, 10, 60, 0.25, 128, 0},
+  {NULL}
+};
+
+const GbpAbrPolicy *
+gbp_abr_policy_lookup (const char *name)
+{
+  int i;
+
+  g_return_val_if_fail (name != NULL, NULL);
+
+  for (i = 0; policies[i].name != NULL; ++i) {
+    if (!strcmp (policies[i].name, name))
+      return &policies[i];
+  }
+
+  return NULL;
+}
+
+GbpAbr *
+gbp_abr_new (const GbpAbrPolicy *policy)
+{
+  GbpAbr *abr;
+
+  g_return_val_if_fail (policy != NULL, NULL);
+
+  abr = g_new0 (GbpAbr, 1);
+  abr->policy = policy;
+
+  return abr;
+}
+
+void
+gbp_abr_free (GbpAbr *abr)
+{
+  g_return_if_fail (abr != NULL);
+
+  g_free (abr);
+}
+
+const GbpAbrPolicy *
+gbp_abr_get_policy (GbpAbr *abr)
+{
+  g_return_val_if_fail (abr != NULL, NULL);
+
+  return abr->policy;
+}
+
+/* forget the measurements, eg when the uri changes */
+void
+gbp_abr_reset (GbpAbr *abr)
+{
+  g_return_if_fail (abr != NULL);
+
+  abr->throughput = 0;
+  abr->connection_speed = 0;
+}
+
+void
+gbp_abr_set_window (GbpAbr *abr, guint width, guint height)
+{
+  g_return_if_fail (abr != NULL);
+
+  abr->window_kbps = (guint) (width * height * 30 *
+      abr->policy->bits_per_pixel / 1000);
+}
+
+/* returns TRUE if the connection speed changed */
+gboolean
+gbp_abr_add_sample (GbpAbr *abr, gint bytes_per_second, gint buffer_percent)
+{
+  const GbpAbrPolicy *policy;
+  gdouble kbps, target;
+
+  g_return_val_if_fail (abr != NULL, FALSE);
+
+  if (bytes_per_second <= 0)
+    return FALSE;
+
+  policy = abr->policy;
+  kbps = bytes_per_second * 8 / 1000.0;
+  if (abr->throughput == 0)
+    abr->throughput = kbps;
+  else
+    abr->throughput += policy->smoothing * (kbps - abr->throughput);
+
+  target = abr->throughput;
+  if (buffer_percent >= 0 && buffer_percent < policy->low_buffer_percent)
+    target *= policy->safety / 2;
+  else if (buffer_percent < 0 || buffer_percent < policy->high_buffer_percent)
+    target *= policy->safety;
+
+  if (abr->window_kbps != 0 && target > abr->window_kbps)
+    target = abr->window_kbps;
+  if (policy->max_kbps != 0 && target > policy->max_kbps)
+    target = policy->max_kbps;
+  if (target < policy->min_kbps)
+    target = policy->min_kbps;
+
+  /* go down right away but only go up for a real improvement */
+  if (abr->connection_speed != 0 && target > abr->connection_speed &&
+      target < abr->connection_speed * (1 + policy->up_hysteresis))
+    return FALSE;
+
+  if ((guint) target == abr->connection_speed)
+    return FALSE;
+
+  abr->connection_speed = (guint) target;
+  return TRUE;
+}
+
+/* in kbps, 0 until the first measurement */
+guint
+gbp_abr_get_connection_speed (GbpAbr *abr)
+{
+  g_return_val_if_fail (abr != NULL, 0);
+
+  return abr->connection_speed;
+}
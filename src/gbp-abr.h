@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GBP_ABR_H
+#define GBP_ABR_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* tuning knobs of the bitrate controller */
+typedef struct
+{
+  const char *name;
+  /* weight of a new throughput sample in the moving average */
+  gdouble smoothing;
+  /* fraction of the measured throughput we're willing to use */
+  gdouble safety;
+  /* relative increase needed before switching up */
+  gdouble up_hysteresis;
+  /* below this buffer level the target is halved, above the high level the
+   * safety margin is dropped */
+  gint low_buffer_percent;
+  gint high_buffer_percent;
+  /* bits per pixel per frame at 30fps, used to bound the bitrate by the
+   * window size */
+  gdouble bits_per_pixel;
+  guint min_kbps;
+  guint max_kbps;
+} GbpAbrPolicy;
+
+typedef struct _GbpAbr GbpAbr;
+
+const GbpAbrPolicy *gbp_abr_policy_lookup (const char *name);
+
+GbpAbr *gbp_abr_new (const GbpAbrPolicy *policy);
+void gbp_abr_free (GbpAbr *abr);
+const GbpAbrPolicy *gbp_abr_get_policy (GbpAbr *abr);
+void gbp_abr_reset (GbpAbr *abr);
+void gbp_abr_set_window (GbpAbr *abr, guint width, guint height);
+gboolean gbp_abr_add_sample (GbpAbr *abr, gint bytes_per_second,
+    gint buffer_percent);
+guint gbp_abr_get_connection_speed (GbpAbr *abr);
+
+G_END_DECLS
+
+#endif /* GBP_ABR_H */
@@ -0,0 +1,553 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include "gbp-cache.h"
+#include "gbp-stats.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gbp_player_debug);
+#define GST_CAT_DEFAULT gbp_player_debug
+
+#define DEFAULT_MAX_SIZE (G_GUINT64_CONSTANT (512) * 1024 * 1024)
+#define DATA_SUFFIX ".data"
+#define PART_SUFFIX ".part"
+
+/* The cache keeps one file per media, named after a hash of the uri and
+ * validator plus a random tag. Entries are written to a .part file while the
+ * media is being downloaded and renamed to .data once all of it has been
+ * written. Committed entries are kept in LRU order and evicted when the cache
+ * grows past max_size. Readers hold a reference on the entry, evicted entries
+ * are unlinked when the last reader goes away. The tag keeps that from
+ * removing the file of a newer entry for the same key. */
+struct _GbpCache
+{
+  GMutex *lock;
+  char *directory;
+  guint64 max_size;
+  guint64 size;
+  /* key -> entry, both committed entries and entries being written */
+  GHashTable *entries;
+  /* committed entries, most recently used first */
+  GQueue lru;
+};
+
+typedef struct
+{
+  guint64 start;
+  guint64 end;
+} GbpCacheRange;
+
+struct _GbpCacheEntry
+{
+  volatile gint refcount;
+  GbpCache *cache;
+  char *key;
+  char *path;
+  char *uri;
+  guint64 size;
+  gboolean committed;
+  gboolean evicted;
+  GList lru_link;
+
+  /* only used while writing */
+  char *part_path;
+  FILE *file;
+  guint64 position;
+  GSList *ranges;
+  gboolean failed;
+};
+
+static GbpCacheEntry *
+gbp_cache_entry_new (GbpCache *cache, const char *key, const char *path)
+{
+  GbpCacheEntry *entry = g_new0 (GbpCacheEntry, 1);
+
+  entry->refcount = 1;
+  entry->cache = cache;
+  entry->key = g_strdup (key);
+  entry->path = g_strdup (path);
+  entry->uri = g_filename_to_uri (entry->path, NULL, NULL);
+
+  entry->lru_link.data = entry;
+
+  return entry;
+}
+
+static char *
+make_key (const char *uri, const char *validator)
+{
+  char *str;
+  char *key;
+
+  str = g_strconcat (uri, "\n", validator ? validator : "", NULL);
+  key = g_compute_checksum_for_string (G_CHECKSUM_SHA1, str, -1);
+  g_free (str);
+
+  return key;
+}
+
+static void
+evict_unlocked (GbpCache *cache)
+{
+  GList *link;
+  GbpCacheEntry *entry;
+
+  while (cache->size > cache->max_size) {
+    link = g_queue_peek_tail_link (&cache->lru);
+    if (link == NULL)
+      break;
+
+    entry = (GbpCacheEntry *) link->data;
+    g_queue_unlink (&cache->lru, link);
+    g_hash_table_remove (cache->entries, entry->key);
+    cache->size -= entry->size;
+
+    GST_INFO ("evicting %s, %" G_GUINT64_FORMAT " bytes",
+        entry->path, entry->size);
+
+    /* the file is unlinked once readers are done with it */
+    entry->evicted = TRUE;
+    gbp_cache_entry_unref (entry);
+  }
+}
+
+static gint
+compare_mtime (gconstpointer a, gconstpointer b)
+{
+  const GbpCacheEntry *entry1 = (const GbpCacheEntry *) a;
+  const GbpCacheEntry *entry2 = (const GbpCacheEntry *) b;
+  struct stat st1, st2;
+
+  if (g_stat (entry1->path, &st1) || g_stat (entry2->path, &st2))
+    return 0;
+
+  /* most recent first */
+  if (st1.st_mtime > st2.st_mtime)
+    return -1;
+  else if (st1.st_mtime < st2.st_mtime)
+    return 1;
+
+  return 0;
+}
+
+static void
+scan_directory (GbpCache *cache)
+{
+  GDir *dir;
+  const char *name;
+  char *path;
+  char *key;
+  GbpCacheEntry *entry;
+  GList *entries = NULL, *walk;
+  struct stat st;
+
+  dir = g_dir_open (cache->directory, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    path = g_build_filename (cache->directory, name, NULL);
+
+    if (g_str_has_suffix (name, PART_SUFFIX)) {
+      /* left over by a session that didn't finish writing */
+      g_unlink (path);
+    } else if (g_str_has_suffix (name, DATA_SUFFIX) &&
+        g_stat (path, &st) == 0) {
+      /* <key>-<tag>.data */
+      key = g_strndup (name, strcspn (name, "-."));
+      entry = gbp_cache_entry_new (cache, key, path);
+      entry->size = st.st_size;
+      entry->committed = TRUE;
+      entries = g_list_prepend (entries, entry);
+      g_free (key);
+    }
+
+    g_free (path);
+  }
+
+  g_dir_close (dir);
+
+  /* the mtime of committed entries is bumped on every hit, so it gives back
+   * the LRU order of the previous sessions */
+  entries = g_list_sort (entries, compare_mtime);
+  for (walk = entries; walk != NULL; walk = walk->next) {
+    entry = (GbpCacheEntry *) walk->data;
+
+    if (g_hash_table_lookup (cache->entries, entry->key) != NULL) {
+      /* older copy left by a session that exited with a reader of an
+       * evicted entry */
+      entry->evicted = TRUE;
+      gbp_cache_entry_unref (entry);
+      continue;
+    }
+
+    g_hash_table_insert (cache->entries, entry->key, entry);
+    g_queue_push_tail_link (&cache->lru, &entry->lru_link);
+    cache->size += entry->size;
+  }
+  g_list_free (entries);
+
+  evict_unlocked (cache);
+}
+
+GbpCache *
+gbp_cache_new (const char *directory, guint64 max_size)
+{
+  GbpCache *cache;
+
+  g_return_val_if_fail (directory != NULL, NULL);
+
+  if (g_mkdir_with_parents (directory, 0700)) {
+    GST_WARNING ("couldn't create cache directory %s", directory);
+    return NULL;
+  }
+
+  cache = g_new0 (GbpCache, 1);
+  cache->lock = g_mutex_new ();
+  cache->directory = g_strdup (directory);
+  cache->max_size = max_size;
+  cache->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&cache->lru);
+
+  scan_directory (cache);
+
+  GST_INFO ("cache %s, %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT
+      " bytes used", directory, cache->size, max_size);
+
+  return cache;
+}
+
+/* all the entries must have been released by the caller */
+void
+gbp_cache_free (GbpCache *cache)
+{
+  GList *link;
+
+  g_return_if_fail (cache != NULL);
+
+  while ((link = g_queue_pop_head_link (&cache->lru)) != NULL)
+    gbp_cache_entry_unref ((GbpCacheEntry *) link->data);
+
+  g_hash_table_destroy (cache->entries);
+  g_mutex_free (cache->lock);
+  g_free (cache->directory);
+  g_free (cache);
+}
+
+GbpCache *
+gbp_cache_get_default ()
+{
+  static GStaticMutex lock = G_STATIC_MUTEX_INIT;
+  static GbpCache *cache;
+  char *directory;
+
+  g_static_mutex_lock (&lock);
+  if (cache == NULL) {
+    directory = g_build_filename (g_get_user_cache_dir (),
+        "gst-browser-plugin", NULL);
+    cache = gbp_cache_new (directory, DEFAULT_MAX_SIZE);
+    g_free (directory);
+  }
+  g_static_mutex_unlock (&lock);
+
+  return cache;
+}
+
+/* returns a reference to the committed entry for uri and validator or NULL */
+GbpCacheEntry *
+gbp_cache_lookup (GbpCache *cache, const char *uri, const char *validator)
+{
+  GbpCacheEntry *entry;
+  char *key;
+
+  g_return_val_if_fail (cache != NULL, NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+
+  key = make_key (uri, validator);
+
+  g_mutex_lock (cache->lock);
+  entry = (GbpCacheEntry *) g_hash_table_lookup (cache->entries, key);
+  if (entry != NULL && entry->committed) {
+    gbp_cache_entry_ref (entry);
+    g_queue_unlink (&cache->lru, &entry->lru_link);
+    g_queue_push_head_link (&cache->lru, &entry->lru_link);
+  } else {
+    entry = NULL;
+  }
+  g_mutex_unlock (cache->lock);
+
+  g_free (key);
+
+  if (entry != NULL) {
+    /* persist the LRU order for the next sessions */
+    g_utime (entry->path, NULL);
+    GST_DEBUG ("cache hit for %s", uri);
+    gbp_stats_inc (GBP_STAT_MEDIA_CACHE_HITS);
+  } else {
+    gbp_stats_inc (GBP_STAT_MEDIA_CACHE_MISSES);
+  }
+
+  return entry;
+}
+
+/* returns a new entry to write uri to, or NULL if uri is already cached or
+ * being written by someone else */
+GbpCacheEntry *
+gbp_cache_create_entry (GbpCache *cache, const char *uri,
+    const char *validator)
+{
+  GbpCacheEntry *entry = NULL;
+  char *key;
+  char *filename;
+  char *path;
+
+  g_return_val_if_fail (cache != NULL, NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+
+  key = make_key (uri, validator);
+
+  g_mutex_lock (cache->lock);
+  if (g_hash_table_lookup (cache->entries, key) == NULL) {
+    filename = g_strdup_printf ("%s-%08x%08x" DATA_SUFFIX, key,
+        g_random_int (), g_random_int ());
+    path = g_build_filename (cache->directory, filename, NULL);
+    entry = gbp_cache_entry_new (cache, key, path);
+    g_free (filename);
+    g_free (path);
+
+    entry->part_path = g_strconcat (entry->path, PART_SUFFIX, NULL);
+
+    entry->file = g_fopen (entry->part_path, "wb");
+    if (entry->file != NULL) {
+      /* writers aren't owned by the table, they remove themselves when
+       * released */
+      g_hash_table_insert (cache->entries, entry->key, entry);
+    } else {
+      GST_WARNING ("couldn't open %s", entry->part_path);
+      gbp_cache_entry_unref (entry);
+      entry = NULL;
+    }
+  }
+  g_mutex_unlock (cache->lock);
+
+  g_free (key);
+
+  if (entry != NULL)
+    GST_DEBUG ("caching %s to %s", uri, entry->part_path);
+
+  return entry;
+}
+
+GbpCacheEntry *
+gbp_cache_entry_ref (GbpCacheEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  g_atomic_int_inc (&entry->refcount);
+
+  return entry;
+}
+
+void
+gbp_cache_entry_unref (GbpCacheEntry *entry)
+{
+  GbpCache *cache;
+  GSList *walk;
+
+  g_return_if_fail (entry != NULL);
+
+  if (!g_atomic_int_dec_and_test (&entry->refcount))
+    return;
+
+  cache = entry->cache;
+
+  if (!entry->committed) {
+    /* abort the write */
+    g_mutex_lock (cache->lock);
+    if (g_hash_table_lookup (cache->entries, entry->key) == entry)
+      g_hash_table_remove (cache->entries, entry->key);
+    g_mutex_unlock (cache->lock);
+
+    if (entry->file != NULL)
+      fclose (entry->file);
+    if (entry->part_path != NULL)
+      g_unlink (entry->part_path);
+  } else if (entry->evicted) {
+    g_unlink (entry->path);
+  }
+
+  for (walk = entry->ranges; walk != NULL; walk = walk->next)
+    g_free (walk->data);
+  g_slist_free (entry->ranges);
+
+  g_free (entry->part_path);
+  g_free (entry->key);
+  g_free (entry->path);
+  g_free (entry->uri);
+  g_free (entry);
+}
+
+const char *
+gbp_cache_entry_get_uri (GbpCacheEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  return entry->uri;
+}
+
+static void
+add_range (GbpCacheEntry *entry, guint64 start, guint64 end)
+{
+  GSList *walk, *next;
+  GbpCacheRange *range, *next_range;
+
+  for (walk = entry->ranges; walk != NULL; walk = walk->next) {
+    range = (GbpCacheRange *) walk->data;
+    if (start <= range->end)
+      break;
+  }
+
+  if (walk == NULL || end < range->start) {
+    /* doesn't touch any existing range */
+    range = g_new (GbpCacheRange, 1);
+    range->start = start;
+    range->end = end;
+    entry->ranges = g_slist_insert_before (entry->ranges, walk, range);
+    return;
+  }
+
+  range->start = MIN (range->start, start);
+  range->end = MAX (range->end, end);
+
+  /* merge the ranges the grown range now touches */
+  while ((next = walk->next) != NULL) {
+    next_range = (GbpCacheRange *) next->data;
+    if (next_range->start > range->end)
+      break;
+
+    range->end = MAX (range->end, next_range->end);
+    g_free (next_range);
+    entry->ranges = g_slist_delete_link (entry->ranges, next);
+  }
+}
+
+/* offset can be -1 to write after the last write */
+gboolean
+gbp_cache_entry_write (GbpCacheEntry *entry, guint64 offset,
+    const guint8 *data, guint size)
+{
+  g_return_val_if_fail (entry != NULL, FALSE);
+
+  if (entry->committed || entry->failed)
+    return FALSE;
+
+  if (offset == (guint64) -1)
+    offset = entry->position;
+
+  if (offset + size > entry->cache->max_size) {
+    GST_INFO ("%s doesn't fit in the cache", entry->part_path);
+    entry->failed = TRUE;
+    return FALSE;
+  }
+
+  if (fseek (entry->file, offset, SEEK_SET) ||
+      fwrite (data, 1, size, entry->file) != size) {
+    GST_WARNING ("couldn't write to %s", entry->part_path);
+    entry->failed = TRUE;
+    return FALSE;
+  }
+
+  add_range (entry, offset, offset + size);
+  entry->position = offset + size;
+
+  return TRUE;
+}
+
+void
+gbp_cache_entry_seek (GbpCacheEntry *entry, guint64 offset)
+{
+  g_return_if_fail (entry != NULL);
+
+  entry->position = offset;
+}
+
+/* makes the entry available to lookups if all of it has been written.
+ * expected_size is the length of the media or -1 if it isn't known */
+gboolean
+gbp_cache_entry_commit (GbpCacheEntry *entry, guint64 expected_size)
+{
+  GbpCache *cache;
+  GbpCacheRange *range;
+
+  g_return_val_if_fail (entry != NULL, FALSE);
+
+  if (entry->committed || entry->failed || entry->ranges == NULL)
+    return FALSE;
+
+  range = (GbpCacheRange *) entry->ranges->data;
+  if (entry->ranges->next != NULL || range->start != 0) {
+    GST_INFO ("%s has holes, not committing", entry->part_path);
+    return FALSE;
+  }
+
+  if (expected_size != (guint64) -1 && range->end != expected_size) {
+    GST_INFO ("%s has %" G_GUINT64_FORMAT " bytes, expected %"
+        G_GUINT64_FORMAT ", not committing", entry->part_path, range->end,
+        expected_size);
+    return FALSE;
+  }
+
+  if (fclose (entry->file)) {
+    GST_WARNING ("couldn't write to %s", entry->part_path);
+    entry->file = NULL;
+    entry->failed = TRUE;
+    return FALSE;
+  }
+  entry->file = NULL;
+
+  if (g_rename (entry->part_path, entry->path)) {
+    GST_WARNING ("couldn't rename %s", entry->part_path);
+    entry->failed = TRUE;
+    return FALSE;
+  }
+
+  cache = entry->cache;
+
+  g_mutex_lock (cache->lock);
+  entry->size = range->end;
+  entry->committed = TRUE;
+  /* ref owned by the table from now on */
+  gbp_cache_entry_ref (entry);
+  g_queue_push_head_link (&cache->lru, &entry->lru_link);
+  cache->size += entry->size;
+  evict_unlocked (cache);
+  g_mutex_unlock (cache->lock);
+
+  GST_INFO ("committed %s, %" G_GUINT64_FORMAT " bytes",
+      entry->path, entry->size);
+
+  return TRUE;
+}
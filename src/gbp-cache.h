@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GBP_CACHE_H
+#define GBP_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GbpCache GbpCache;
+typedef struct _GbpCacheEntry GbpCacheEntry;
+
+GbpCache *gbp_cache_new (const char *directory, guint64 max_size);
+void gbp_cache_free (GbpCache *cache);
+GbpCache *gbp_cache_get_default ();
+GbpCacheEntry *gbp_cache_lookup (GbpCache *cache,
+    const char *uri, const char *validator);
+GbpCacheEntry *gbp_cache_create_entry (GbpCache *cache,
+    const char *uri, const char *validator);
+
+GbpCacheEntry *gbp_cache_entry_ref (GbpCacheEntry *entry);
+void gbp_cache_entry_unref (GbpCacheEntry *entry);
+const char *gbp_cache_entry_get_uri (GbpCacheEntry *entry);
+gboolean gbp_cache_entry_write (GbpCacheEntry *entry, guint64 offset,
+    const guint8 *data, guint size);
+void gbp_cache_entry_seek (GbpCacheEntry *entry, guint64 offset);
+gboolean gbp_cache_entry_commit (GbpCacheEntry *entry,
+    guint64 expected_size);
+
+G_END_DECLS
+
+#endif /* GBP_CACHE_H */
@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#ifdef XP_WIN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include <gst/gst.h>
+#include "gbp-executor.h"
+#include "gbp-stats.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gbp_player_debug);
+#define GST_CAT_DEFAULT gbp_player_debug
+
+#define EXECUTOR_MIN_THREADS 2
+#define EXECUTOR_MAX_THREADS 16
+
+typedef struct _Worker Worker;
+
+struct _GbpExecutorTask
+{
+  volatile gint refcount;
+  GbpExecutorFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+  /* the class the task should run in, only ever raised while queued */
+  volatile gint priority;
+  /* the worker and class queue holding the task, changed with the worker
+   * lock held. worker is NULL while the task isn't queued. */
+  Worker * volatile worker;
+  gint queue;
+  GList link;
+  GstClockTime queued;
+};
+
+/* Each worker has a queue per class. Tasks submitted from the browser thread
+ * are spread round robin, tasks requeued by a worker stay on its queues, and
+ * workers that run out of work in a class steal from the others before
+ * looking at the next class. */
+struct _Worker
+{
+  guint index;
+  GThread *thread;
+  GMutex *lock;
+  GQueue tasks[GBP_EXECUTOR_PRIORITIES];
+};
+
+static Worker *workers;
+static guint n_workers;
+static volatile gint next_worker;
+/* queued tasks per class, idle workers sleep while they're all 0 */
+static volatile gint pending[GBP_EXECUTOR_PRIORITIES];
+static volatile gint pending_total;
+static volatile gint sleeping;
+static GMutex *lock;
+static GCond *cond;
+static gboolean shutting_down;
+static GStaticPrivate current_worker = G_STATIC_PRIVATE_INIT;
+
+static gpointer worker_func (gpointer data);
+
+static guint
+get_n_processors ()
+{
+#ifdef XP_WIN
+  SYSTEM_INFO info;
+
+  GetSystemInfo (&info);
+  return info.dwNumberOfProcessors;
+#else
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? n : 1;
+#endif
+}
+
+/* n_threads 0 means one per core */
+void
+gbp_executor_init (guint n_threads)
+{
+  guint i, j;
+
+  g_return_if_fail (workers == NULL);
+
+  if (n_threads == 0)
+    n_threads = get_n_processors ();
+  n_workers = CLAMP (n_threads, EXECUTOR_MIN_THREADS, EXECUTOR_MAX_THREADS);
+
+  lock = g_mutex_new ();
+  cond = g_cond_new ();
+  shutting_down = FALSE;
+  for (i = 0; i < GBP_EXECUTOR_PRIORITIES; ++i)
+    pending[i] = 0;
+  pending_total = 0;
+  sleeping = 0;
+
+  GST_INFO ("starting %d playback workers", n_workers);
+  gbp_stats_set (GBP_STAT_PLAYBACK_WORKERS, n_workers);
+  gbp_stats_set (GBP_STAT_PLAYBACK_ACTIVE_WORKERS, 0);
+  gbp_stats_set (GBP_STAT_PLAYBACK_IDLE_WORKERS, n_workers);
+
+  workers = g_new0 (Worker, n_workers);
+  for (i = 0; i < n_workers; ++i) {
+    workers[i].index = i;
+    workers[i].lock = g_mutex_new ();
+    for (j = 0; j < GBP_EXECUTOR_PRIORITIES; ++j)
+      g_queue_init (&workers[i].tasks[j]);
+  }
+
+  for (i = 0; i < n_workers; ++i)
+    workers[i].thread = g_thread_create (worker_func, &workers[i], TRUE, NULL);
+}
+
+/* runs what's left and joins the workers */
+void
+gbp_executor_shutdown ()
+{
+  guint i;
+
+  g_return_if_fail (workers != NULL);
+
+  g_mutex_lock (lock);
+  shutting_down = TRUE;
+  g_cond_broadcast (cond);
+  g_mutex_unlock (lock);
+
+  for (i = 0; i < n_workers; ++i)
+    g_thread_join (workers[i].thread);
+
+  for (i = 0; i < n_workers; ++i)
+    g_mutex_free (workers[i].lock);
+  g_free (workers);
+  workers = NULL;
+
+  g_cond_free (cond);
+  g_mutex_free (lock);
+
+  gbp_stats_set (GBP_STAT_PLAYBACK_WORKERS, 0);
+  gbp_stats_set (GBP_STAT_PLAYBACK_IDLE_WORKERS, 0);
+}
+
+GbpExecutorTask *
+gbp_executor_task_new (GbpExecutorFunc func, gpointer user_data,
+    GDestroyNotify notify)
+{
+  GbpExecutorTask *task;
+
+  g_return_val_if_fail (func != NULL, NULL);
+
+  task = g_slice_new0 (GbpExecutorTask);
+  task->refcount = 1;
+  task->func = func;
+  task->user_data = user_data;
+  task->notify = notify;
+  task->priority = GBP_EXECUTOR_PRIORITY_BACKGROUND;
+  task->link.data = task;
+
+  return task;
+}
+
+GbpExecutorTask *
+gbp_executor_task_ref (GbpExecutorTask *task)
+{
+  g_return_val_if_fail (task != NULL, NULL);
+
+  g_atomic_int_inc (&task->refcount);
+
+  return task;
+}
+
+void
+gbp_executor_task_unref (GbpExecutorTask *task)
+{
+  g_return_if_fail (task != NULL);
+
+  if (!g_atomic_int_dec_and_test (&task->refcount))
+    return;
+
+  if (task->notify)
+    task->notify (task->user_data);
+  g_slice_free (GbpExecutorTask, task);
+}
+
+static void
+wake_worker ()
+{
+  if (g_atomic_int_get (&sleeping) == 0)
+    return;
+
+  g_mutex_lock (lock);
+  g_cond_signal (cond);
+  g_mutex_unlock (lock);
+}
+
+static void
+queue_task (GbpExecutorTask *task)
+{
+  Worker *worker;
+  gint priority;
+
+  task->queued = gst_util_get_timestamp ();
+
+  worker = (Worker *) g_static_private_get (&current_worker);
+  if (worker == NULL)
+    worker = &workers[(guint) g_atomic_int_exchange_and_add (&next_worker, 1)
+        % n_workers];
+
+  g_mutex_lock (worker->lock);
+  task->queue = g_atomic_int_get (&task->priority);
+  g_queue_push_tail_link (&worker->tasks[task->queue], &task->link);
+  g_atomic_pointer_set (&task->worker, worker);
+  /* a raise between reading priority and publishing worker saw the task as
+   * not queued and left it to us. Raises from now on wait for the lock. */
+  priority = g_atomic_int_get (&task->priority);
+  if (priority < task->queue) {
+    g_queue_unlink (&worker->tasks[task->queue], &task->link);
+    task->queue = priority;
+    g_queue_push_tail_link (&worker->tasks[task->queue], &task->link);
+  }
+  g_atomic_int_inc (&pending[task->queue]);
+  g_atomic_int_inc (&pending_total);
+  g_mutex_unlock (worker->lock);
+
+  wake_worker ();
+}
+
+/* queues a task that isn't queued nor running */
+void
+gbp_executor_submit (GbpExecutorTask *task, GbpExecutorPriority priority)
+{
+  g_return_if_fail (workers != NULL);
+  g_return_if_fail (task != NULL);
+  g_return_if_fail (priority < GBP_EXECUTOR_PRIORITIES);
+
+  g_atomic_int_set (&task->priority, priority);
+  queue_task (gbp_executor_task_ref (task));
+}
+
+/* moves a queued task to a more urgent class. A running task is requeued in
+ * the new class if it asks to run again. */
+void
+gbp_executor_raise (GbpExecutorTask *task, GbpExecutorPriority priority)
+{
+  Worker *worker;
+  gint current;
+
+  g_return_if_fail (task != NULL);
+  g_return_if_fail (priority < GBP_EXECUTOR_PRIORITIES);
+
+  do {
+    current = g_atomic_int_get (&task->priority);
+    if ((gint) priority >= current)
+      return;
+  } while (!g_atomic_int_compare_and_exchange (&task->priority,
+        current, priority));
+
+  while ((worker = g_atomic_pointer_get (&task->worker)) != NULL) {
+    g_mutex_lock (worker->lock);
+    if (task->worker != worker) {
+      /* popped or stolen meanwhile */
+      g_mutex_unlock (worker->lock);
+      continue;
+    }
+
+    if (task->queue > (gint) priority) {
+      GST_DEBUG ("raising task %p from class %d to %d", task, task->queue,
+          priority);
+      g_queue_unlink (&worker->tasks[task->queue], &task->link);
+      g_atomic_int_add (&pending[task->queue], -1);
+      task->queue = priority;
+      g_queue_push_tail_link (&worker->tasks[task->queue], &task->link);
+      g_atomic_int_inc (&pending[task->queue]);
+    }
+    g_mutex_unlock (worker->lock);
+    break;
+  }
+}
+
+static GbpExecutorTask *
+pop_task (Worker *worker, gint priority)
+{
+  GbpExecutorTask *task = NULL;
+  GList *link;
+
+  g_mutex_lock (worker->lock);
+  link = g_queue_pop_head_link (&worker->tasks[priority]);
+  if (link != NULL) {
+    task = (GbpExecutorTask *) link->data;
+    g_atomic_pointer_set (&task->worker, NULL);
+    g_atomic_int_add (&pending[priority], -1);
+  }
+  g_mutex_unlock (worker->lock);
+
+  return task;
+}
+
+static GbpExecutorTask *
+next_task (Worker *self)
+{
+  GbpExecutorTask *task = NULL;
+  gint priority;
+  guint i;
+
+  for (priority = 0; priority < GBP_EXECUTOR_PRIORITIES; ++priority) {
+    if (g_atomic_int_get (&pending[priority]) == 0)
+      continue;
+
+    for (i = 0; task == NULL && i < n_workers; ++i)
+      task = pop_task (&workers[(self->index + i) % n_workers], priority);
+
+    if (task != NULL) {
+      g_atomic_int_add (&pending_total, -1);
+      break;
+    }
+  }
+
+  return task;
+}
+
+static gboolean
+run_task (GbpExecutorTask *task)
+{
+  GstClockTime wait;
+  gboolean again;
+
+  wait = gst_util_get_timestamp () - task->queued;
+  gbp_stats_update_max (GBP_STAT_PLAYBACK_MAX_WAIT,
+      MIN (wait / GST_USECOND, G_MAXINT));
+
+  gbp_stats_add (GBP_STAT_PLAYBACK_IDLE_WORKERS, -1);
+  gbp_stats_inc (GBP_STAT_PLAYBACK_ACTIVE_WORKERS);
+  again = task->func (task->user_data);
+  gbp_stats_add (GBP_STAT_PLAYBACK_ACTIVE_WORKERS, -1);
+  gbp_stats_inc (GBP_STAT_PLAYBACK_IDLE_WORKERS);
+
+  return again;
+}
+
+static gpointer
+worker_func (gpointer data)
+{
+  Worker *self = (Worker *) data;
+  GbpExecutorTask *task;
+
+  g_static_private_set (&current_worker, self, NULL);
+
+  while (TRUE) {
+    task = next_task (self);
+    if (task != NULL) {
+      if (run_task (task))
+        queue_task (task);
+      else
+        gbp_executor_task_unref (task);
+
+      continue;
+    }
+
+    g_mutex_lock (lock);
+    g_atomic_int_inc (&sleeping);
+    while (!shutting_down && g_atomic_int_get (&pending_total) == 0)
+      g_cond_wait (cond, lock);
+    g_atomic_int_add (&sleeping, -1);
+
+    if (shutting_down && g_atomic_int_get (&pending_total) == 0) {
+      g_mutex_unlock (lock);
+      break;
+    }
+    g_mutex_unlock (lock);
+  }
+
+  return NULL;
+}
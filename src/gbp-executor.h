@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GBP_EXECUTOR_H
+#define GBP_EXECUTOR_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* workers run all the queued tasks of a class before looking at the next */
+typedef enum {
+  GBP_EXECUTOR_PRIORITY_TEARDOWN,
+  GBP_EXECUTOR_PRIORITY_SEEK,
+  GBP_EXECUTOR_PRIORITY_PLAYBACK,
+  GBP_EXECUTOR_PRIORITY_BACKGROUND,
+  GBP_EXECUTOR_PRIORITIES
+} GbpExecutorPriority;
+
+/* runs a slice of work and returns TRUE if it wants to run again. Tasks are
+ * requeued at the back of their class so that long lanes don't starve the
+ * others. */
+typedef gboolean (*GbpExecutorFunc) (gpointer user_data);
+
+typedef struct _GbpExecutorTask GbpExecutorTask;
+
+void gbp_executor_init (guint n_threads);
+void gbp_executor_shutdown ();
+
+GbpExecutorTask *gbp_executor_task_new (GbpExecutorFunc func,
+    gpointer user_data, GDestroyNotify notify);
+GbpExecutorTask *gbp_executor_task_ref (GbpExecutorTask *task);
+void gbp_executor_task_unref (GbpExecutorTask *task);
+
+void gbp_executor_submit (GbpExecutorTask *task, GbpExecutorPriority priority);
+void gbp_executor_raise (GbpExecutorTask *task, GbpExecutorPriority priority);
+
+G_END_DECLS
+
+#endif /* GBP_EXECUTOR_H */
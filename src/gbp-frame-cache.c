@@ -0,0 +1,548 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include "gbp-frame-cache.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gbp_player_debug);
+#define GST_CAT_DEFAULT gbp_player_debug
+
+G_DEFINE_TYPE (GbpFrameCache, gbp_frame_cache, GST_TYPE_ELEMENT);
+
+#define DEFAULT_MAX_FRAMES 32
+#define DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+
+enum {
+  PROP_0,
+  PROP_MAX_FRAMES,
+  PROP_MAX_BYTES
+};
+
+/* Frames are handed to the video sink from a task on the source pad so that
+ * the sink can be flushed and fed an older frame while upstream stays
+ * blocked in our chain function. */
+struct _GbpFrameCachePrivate
+{
+  GstPad *sinkpad;
+  GstPad *srcpad;
+  GMutex *lock;
+  GCond *cond;
+  guint max_frames;
+  guint max_bytes;
+  /* the last frames pushed downstream, oldest first */
+  GQueue *ring;
+  guint ring_bytes;
+  /* buffers and serialized events waiting for the task */
+  GQueue *queue;
+  guint queued_buffers;
+  /* ring index of the frame on screen while replaying, -1 when live */
+  gint replay;
+  GstBuffer *replay_buffer;
+  GstEvent *segment;
+  gboolean need_segment;
+  gboolean flush_pending;
+  gboolean pushing;
+  gboolean flushing;
+  GstFlowReturn srcresult;
+};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static void gbp_frame_cache_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gbp_frame_cache_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
+static GstFlowReturn gbp_frame_cache_chain (GstPad *pad, GstBuffer *buffer);
+static gboolean gbp_frame_cache_sink_event (GstPad *pad, GstEvent *event);
+static gboolean gbp_frame_cache_src_event (GstPad *pad, GstEvent *event);
+static gboolean gbp_frame_cache_sink_activate_push (GstPad *pad,
+    gboolean active);
+static void gbp_frame_cache_loop (GbpFrameCache *cache);
+
+static void
+gbp_frame_cache_finalize (GObject *object)
+{
+  GbpFrameCache *cache = GBP_FRAME_CACHE (object);
+
+  g_queue_free (cache->priv->ring);
+  g_queue_free (cache->priv->queue);
+  if (cache->priv->segment != NULL)
+    gst_event_unref (cache->priv->segment);
+  g_cond_free (cache->priv->cond);
+  g_mutex_free (cache->priv->lock);
+
+  G_OBJECT_CLASS (gbp_frame_cache_parent_class)->finalize (object);
+}
+
+static void
+gbp_frame_cache_class_init (GbpFrameCacheClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gobject_class->get_property = gbp_frame_cache_get_property;
+  gobject_class->set_property = gbp_frame_cache_set_property;
+  gobject_class->finalize = gbp_frame_cache_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAMES,
+      g_param_spec_uint ("max-frames", "Max frames",
+          "Maximum number of frames kept for stepping back",
+          1, G_MAXUINT, DEFAULT_MAX_FRAMES, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_BYTES,
+      g_param_spec_uint ("max-bytes", "Max bytes",
+          "Maximum size of the frames kept for stepping back",
+          0, G_MAXUINT, DEFAULT_MAX_BYTES, G_PARAM_READWRITE));
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_template));
+  gst_element_class_set_details_simple (element_class, "Frame cache",
+      "Generic", "Keeps recent video frames for stepping back",
+      "Alessandro Decina <alessandro.d@gmail.com>");
+
+  g_type_class_add_private (klass, sizeof (GbpFrameCachePrivate));
+}
+
+static void
+gbp_frame_cache_init (GbpFrameCache *cache)
+{
+  GbpFrameCachePrivate *priv;
+
+  cache->priv = priv = G_TYPE_INSTANCE_GET_PRIVATE (cache,
+      GBP_TYPE_FRAME_CACHE, GbpFrameCachePrivate);
+  priv->lock = g_mutex_new ();
+  priv->cond = g_cond_new ();
+  priv->max_frames = DEFAULT_MAX_FRAMES;
+  priv->max_bytes = DEFAULT_MAX_BYTES;
+  priv->ring = g_queue_new ();
+  priv->queue = g_queue_new ();
+  priv->replay = -1;
+  priv->flushing = TRUE;
+
+  priv->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (priv->sinkpad, gbp_frame_cache_chain);
+  gst_pad_set_event_function (priv->sinkpad, gbp_frame_cache_sink_event);
+  gst_pad_set_activatepush_function (priv->sinkpad,
+      gbp_frame_cache_sink_activate_push);
+  gst_pad_set_getcaps_function (priv->sinkpad, gst_pad_proxy_getcaps);
+  gst_element_add_pad (GST_ELEMENT (cache), priv->sinkpad);
+
+  priv->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_set_event_function (priv->srcpad, gbp_frame_cache_src_event);
+  gst_pad_set_getcaps_function (priv->srcpad, gst_pad_proxy_getcaps);
+  gst_element_add_pad (GST_ELEMENT (cache), priv->srcpad);
+}
+
+static void
+gbp_frame_cache_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GbpFrameCache *cache = GBP_FRAME_CACHE (object);
+
+  switch (prop_id)
+  {
+    case PROP_MAX_FRAMES:
+      g_value_set_uint (value, cache->priv->max_frames);
+      break;
+    case PROP_MAX_BYTES:
+      g_value_set_uint (value, cache->priv->max_bytes);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+static void
+gbp_frame_cache_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GbpFrameCache *cache = GBP_FRAME_CACHE (object);
+
+  g_mutex_lock (cache->priv->lock);
+  switch (prop_id)
+  {
+    case PROP_MAX_FRAMES:
+      cache->priv->max_frames = g_value_get_uint (value);
+      break;
+    case PROP_MAX_BYTES:
+      cache->priv->max_bytes = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+  g_mutex_unlock (cache->priv->lock);
+}
+
+GstElement *
+gbp_frame_cache_new ()
+{
+  return GST_ELEMENT (g_object_new (GBP_TYPE_FRAME_CACHE, NULL));
+}
+
+/* the functions below expect the lock to be held */
+
+static void
+ring_clear (GbpFrameCache *cache)
+{
+  GstBuffer *buffer;
+
+  while ((buffer = (GstBuffer *) g_queue_pop_head (cache->priv->ring)))
+    gst_buffer_unref (buffer);
+
+  cache->priv->ring_bytes = 0;
+  cache->priv->replay = -1;
+  gst_buffer_replace (&cache->priv->replay_buffer, NULL);
+}
+
+static void
+ring_push (GbpFrameCache *cache, GstBuffer *buffer)
+{
+  GbpFrameCachePrivate *priv = cache->priv;
+
+  g_queue_push_tail (priv->ring, gst_buffer_ref (buffer));
+  priv->ring_bytes += GST_BUFFER_SIZE (buffer);
+
+  /* always keep the frame on screen */
+  while (priv->ring->length > 1 && (priv->ring->length > priv->max_frames ||
+        priv->ring_bytes > priv->max_bytes)) {
+    buffer = (GstBuffer *) g_queue_pop_head (priv->ring);
+    priv->ring_bytes -= GST_BUFFER_SIZE (buffer);
+    gst_buffer_unref (buffer);
+  }
+}
+
+static void
+queue_clear (GbpFrameCache *cache)
+{
+  GstMiniObject *object;
+
+  while ((object = (GstMiniObject *) g_queue_pop_head (cache->priv->queue)))
+    gst_mini_object_unref (object);
+
+  cache->priv->queued_buffers = 0;
+}
+
+static void
+set_replay (GbpFrameCache *cache, gint index)
+{
+  GbpFrameCachePrivate *priv = cache->priv;
+
+  /* showing the newest frame again means we're back to live */
+  priv->replay = index == (gint) priv->ring->length - 1 ? -1 : index;
+  gst_buffer_replace (&priv->replay_buffer,
+      (GstBuffer *) g_queue_peek_nth (priv->ring, index));
+  /* the sink forgets the segment when flushed */
+  priv->need_segment = TRUE;
+  priv->flush_pending = TRUE;
+}
+
+/* called without the lock after set_replay () */
+static void
+flush_downstream (GbpFrameCache *cache)
+{
+  GbpFrameCachePrivate *priv = cache->priv;
+
+  /* unblock the sink if it's prerolled and wait for the task to notice */
+  gst_pad_push_event (priv->srcpad, gst_event_new_flush_start ());
+
+  g_mutex_lock (priv->lock);
+  while (priv->pushing)
+    g_cond_wait (priv->cond, priv->lock);
+  g_mutex_unlock (priv->lock);
+
+  gst_pad_push_event (priv->srcpad, gst_event_new_flush_stop ());
+
+  g_mutex_lock (priv->lock);
+  priv->flush_pending = FALSE;
+  g_cond_broadcast (priv->cond);
+  g_mutex_unlock (priv->lock);
+}
+
+gboolean
+gbp_frame_cache_step_back (GbpFrameCache *cache, guint frames)
+{
+  GbpFrameCachePrivate *priv;
+  gint current;
+
+  g_return_val_if_fail (cache != NULL, FALSE);
+
+  priv = cache->priv;
+
+  g_mutex_lock (priv->lock);
+  current = priv->replay != -1 ? priv->replay : (gint) priv->ring->length - 1;
+  if (priv->flushing || current < (gint) frames) {
+    GST_DEBUG_OBJECT (cache, "can't step back %u frames, %d cached",
+        frames, MAX (current, 0));
+    g_mutex_unlock (priv->lock);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (cache, "replaying frame %d of %u", current - frames,
+      priv->ring->length);
+  set_replay (cache, current - frames);
+  g_mutex_unlock (priv->lock);
+
+  flush_downstream (cache);
+
+  return TRUE;
+}
+
+/* returns how many of frames are left to be stepped by the sink */
+guint
+gbp_frame_cache_step_forward (GbpFrameCache *cache, guint frames)
+{
+  GbpFrameCachePrivate *priv;
+  guint served;
+
+  g_return_val_if_fail (cache != NULL, frames);
+
+  priv = cache->priv;
+
+  g_mutex_lock (priv->lock);
+  if (priv->flushing || priv->replay == -1) {
+    g_mutex_unlock (priv->lock);
+    return frames;
+  }
+
+  served = MIN (frames, priv->ring->length - 1 - priv->replay);
+  set_replay (cache, priv->replay + served);
+  g_mutex_unlock (priv->lock);
+
+  flush_downstream (cache);
+
+  return frames - served;
+}
+
+GstClockTime
+gbp_frame_cache_get_frame_duration (GbpFrameCache *cache)
+{
+  GstBuffer *last, *previous;
+  GstClockTime duration = GST_CLOCK_TIME_NONE;
+
+  g_return_val_if_fail (cache != NULL, GST_CLOCK_TIME_NONE);
+
+  g_mutex_lock (cache->priv->lock);
+  last = (GstBuffer *) g_queue_peek_tail (cache->priv->ring);
+  previous = (GstBuffer *) g_queue_peek_nth (cache->priv->ring,
+      cache->priv->ring->length - 2);
+
+  if (last != NULL && GST_BUFFER_DURATION_IS_VALID (last))
+    duration = GST_BUFFER_DURATION (last);
+  else if (previous != NULL && GST_BUFFER_TIMESTAMP_IS_VALID (previous) &&
+      GST_BUFFER_TIMESTAMP_IS_VALID (last) &&
+      GST_BUFFER_TIMESTAMP (last) > GST_BUFFER_TIMESTAMP (previous))
+    duration = GST_BUFFER_TIMESTAMP (last) - GST_BUFFER_TIMESTAMP (previous);
+  g_mutex_unlock (cache->priv->lock);
+
+  return duration;
+}
+
+static GstFlowReturn
+gbp_frame_cache_chain (GstPad *pad, GstBuffer *buffer)
+{
+  GbpFrameCache *cache = GBP_FRAME_CACHE (GST_PAD_PARENT (pad));
+  GbpFrameCachePrivate *priv = cache->priv;
+  GstFlowReturn ret;
+
+  g_mutex_lock (priv->lock);
+  /* keep a single frame in flight and hold upstream while replaying */
+  while (!priv->flushing && priv->srcresult == GST_FLOW_OK &&
+      (priv->queued_buffers > 0 || priv->replay != -1))
+    g_cond_wait (priv->cond, priv->lock);
+
+  ret = priv->flushing ? GST_FLOW_WRONG_STATE : priv->srcresult;
+  if (ret == GST_FLOW_OK) {
+    g_queue_push_tail (priv->queue, buffer);
+    priv->queued_buffers++;
+    g_cond_broadcast (priv->cond);
+  } else {
+    gst_buffer_unref (buffer);
+  }
+  g_mutex_unlock (priv->lock);
+
+  return ret;
+}
+
+static gboolean
+gbp_frame_cache_sink_event (GstPad *pad, GstEvent *event)
+{
+  GbpFrameCache *cache = GBP_FRAME_CACHE (GST_PAD_PARENT (pad));
+  GbpFrameCachePrivate *priv = cache->priv;
+  gboolean res = TRUE;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      res = gst_pad_push_event (priv->srcpad, event);
+
+      g_mutex_lock (priv->lock);
+      priv->flushing = TRUE;
+      queue_clear (cache);
+      ring_clear (cache);
+      g_cond_broadcast (priv->cond);
+      g_mutex_unlock (priv->lock);
+
+      gst_pad_pause_task (priv->srcpad);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      res = gst_pad_push_event (priv->srcpad, event);
+
+      g_mutex_lock (priv->lock);
+      priv->flushing = FALSE;
+      priv->srcresult = GST_FLOW_OK;
+      priv->need_segment = FALSE;
+      g_mutex_unlock (priv->lock);
+
+      gst_pad_start_task (priv->srcpad,
+          (GstTaskFunction) gbp_frame_cache_loop, cache);
+      break;
+    default:
+      if (!GST_EVENT_IS_SERIALIZED (event)) {
+        res = gst_pad_push_event (priv->srcpad, event);
+        break;
+      }
+
+      /* keep serialized events in order with the buffers */
+      g_mutex_lock (priv->lock);
+      if (priv->flushing) {
+        gst_event_unref (event);
+        res = FALSE;
+      } else {
+        g_queue_push_tail (priv->queue, event);
+        g_cond_broadcast (priv->cond);
+      }
+      g_mutex_unlock (priv->lock);
+      break;
+  }
+
+  return res;
+}
+
+static gboolean
+gbp_frame_cache_src_event (GstPad *pad, GstEvent *event)
+{
+  GbpFrameCache *cache = GBP_FRAME_CACHE (GST_PAD_PARENT (pad));
+
+  return gst_pad_push_event (cache->priv->sinkpad, event);
+}
+
+static gboolean
+gbp_frame_cache_sink_activate_push (GstPad *pad, gboolean active)
+{
+  GbpFrameCache *cache = GBP_FRAME_CACHE (GST_PAD_PARENT (pad));
+  GbpFrameCachePrivate *priv = cache->priv;
+
+  g_mutex_lock (priv->lock);
+  priv->flushing = !active;
+  priv->srcresult = GST_FLOW_OK;
+  priv->need_segment = FALSE;
+  queue_clear (cache);
+  ring_clear (cache);
+  if (!active && priv->segment != NULL) {
+    gst_event_unref (priv->segment);
+    priv->segment = NULL;
+  }
+  g_cond_broadcast (priv->cond);
+  g_mutex_unlock (priv->lock);
+
+  if (active)
+    return gst_pad_start_task (priv->srcpad,
+        (GstTaskFunction) gbp_frame_cache_loop, cache);
+
+  return gst_pad_stop_task (priv->srcpad);
+}
+
+static void
+gbp_frame_cache_loop (GbpFrameCache *cache)
+{
+  GbpFrameCachePrivate *priv = cache->priv;
+  GstMiniObject *object;
+  GstEvent *segment = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  g_mutex_lock (priv->lock);
+  while (!priv->flushing && (priv->flush_pending ||
+        (priv->replay_buffer == NULL &&
+         (priv->replay != -1 || g_queue_is_empty (priv->queue)))))
+    g_cond_wait (priv->cond, priv->lock);
+
+  if (priv->flushing) {
+    g_mutex_unlock (priv->lock);
+    gst_pad_pause_task (priv->srcpad);
+    return;
+  }
+
+  if (priv->replay_buffer != NULL) {
+    object = GST_MINI_OBJECT (priv->replay_buffer);
+    priv->replay_buffer = NULL;
+    if (priv->need_segment && priv->segment != NULL)
+      segment = gst_event_ref (priv->segment);
+    priv->need_segment = FALSE;
+  } else {
+    object = (GstMiniObject *) g_queue_pop_head (priv->queue);
+    if (GST_IS_BUFFER (object)) {
+      priv->queued_buffers--;
+      ring_push (cache, GST_BUFFER (object));
+    } else if (GST_EVENT_TYPE (object) == GST_EVENT_NEWSEGMENT) {
+      /* frames from different segments can't be replayed together */
+      ring_clear (cache);
+      gst_event_replace (&priv->segment, GST_EVENT (object));
+    }
+  }
+  priv->pushing = TRUE;
+  g_cond_broadcast (priv->cond);
+  g_mutex_unlock (priv->lock);
+
+  if (segment != NULL)
+    gst_pad_push_event (priv->srcpad, segment);
+
+  if (GST_IS_BUFFER (object))
+    ret = gst_pad_push (priv->srcpad, GST_BUFFER (object));
+  else
+    gst_pad_push_event (priv->srcpad, GST_EVENT (object));
+
+  g_mutex_lock (priv->lock);
+  priv->pushing = FALSE;
+  /* WRONG_STATE comes from our own flushes, upstream ones set ->flushing */
+  if (ret != GST_FLOW_OK && ret != GST_FLOW_WRONG_STATE)
+    priv->srcresult = ret;
+  g_cond_broadcast (priv->cond);
+  g_mutex_unlock (priv->lock);
+
+  if (ret != GST_FLOW_OK && ret != GST_FLOW_WRONG_STATE) {
+    GST_INFO_OBJECT (cache, "pausing task, reason %s",
+        gst_flow_get_name (ret));
+    gst_pad_pause_task (priv->srcpad);
+
+    if ((GST_FLOW_IS_FATAL (ret) && ret != GST_FLOW_UNEXPECTED) ||
+        ret == GST_FLOW_NOT_LINKED) {
+      GST_ELEMENT_ERROR (cache, STREAM, FAILED, (NULL),
+          ("streaming task paused, reason %s", gst_flow_get_name (ret)));
+      gst_pad_push_event (priv->srcpad, gst_event_new_eos ());
+    }
+  }
+}
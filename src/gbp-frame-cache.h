@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/gst.h>
+
+#ifndef GBP_FRAME_CACHE_H
+#define GBP_FRAME_CACHE_H
+
+G_BEGIN_DECLS
+
+#define GBP_TYPE_FRAME_CACHE \
+  (gbp_frame_cache_get_type())
+#define GBP_FRAME_CACHE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GBP_TYPE_FRAME_CACHE,GbpFrameCache))
+#define GBP_FRAME_CACHE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GBP_TYPE_FRAME_CACHE,GbpFrameCacheClass))
+#define GBP_IS_FRAME_CACHE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GBP_TYPE_FRAME_CACHE))
+#define GBP_IS_FRAME_CACHE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GBP_TYPE_FRAME_CACHE))
+
+typedef struct _GbpFrameCache GbpFrameCache;
+typedef struct _GbpFrameCachePrivate GbpFrameCachePrivate;
+typedef struct _GbpFrameCacheClass GbpFrameCacheClass;
+
+/* sits in front of the video sink and keeps the last decoded frames around
+ * so that they can be shown again without seeking */
+struct _GbpFrameCache {
+  GstElement element;
+
+  GbpFrameCachePrivate *priv;
+};
+
+struct _GbpFrameCacheClass {
+  GstElementClass element_class;
+};
+
+GType gbp_frame_cache_get_type(void);
+GstElement *gbp_frame_cache_new ();
+gboolean gbp_frame_cache_step_back (GbpFrameCache *cache, guint frames);
+guint gbp_frame_cache_step_forward (GbpFrameCache *cache, guint frames);
+GstClockTime gbp_frame_cache_get_frame_duration (GbpFrameCache *cache);
+
+G_END_DECLS
+
+#endif /* GBP_FRAME_CACHE_H */
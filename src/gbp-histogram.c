@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include "gbp-histogram.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gbp_player_debug);
+#define GST_CAT_DEFAULT gbp_player_debug
+
+void
+gbp_histogram_add (GbpHistogram *histogram, GstClockTime value)
+{
+  guint64 usecs;
+  guint bucket = 0;
+  gint current;
+
+  g_return_if_fail (histogram != NULL);
+  g_return_if_fail (GST_CLOCK_TIME_IS_VALID (value));
+
+  usecs = value / GST_USECOND;
+  while (usecs > 0 && bucket < GBP_HISTOGRAM_BUCKETS - 1) {
+    usecs >>= 1;
+    bucket += 1;
+  }
+
+  g_atomic_int_inc (&histogram->buckets[bucket]);
+  g_atomic_int_inc (&histogram->count);
+
+  usecs = MIN (value / GST_USECOND, G_MAXINT);
+  do {
+    current = g_atomic_int_get (&histogram->max);
+    if ((gint) usecs <= current)
+      break;
+  } while (!g_atomic_int_compare_and_exchange (&histogram->max,
+        current, usecs));
+}
+
+gint
+gbp_histogram_get_count (GbpHistogram *histogram)
+{
+  g_return_val_if_fail (histogram != NULL, 0);
+
+  return g_atomic_int_get (&histogram->count);
+}
+
+gint
+gbp_histogram_get_max (GbpHistogram *histogram)
+{
+  g_return_val_if_fail (histogram != NULL, 0);
+
+  return g_atomic_int_get (&histogram->max);
+}
+
+gint
+gbp_histogram_get_bucket (GbpHistogram *histogram, guint bucket)
+{
+  g_return_val_if_fail (histogram != NULL, 0);
+  g_return_val_if_fail (bucket < GBP_HISTOGRAM_BUCKETS, 0);
+
+  return g_atomic_int_get (&histogram->buckets[bucket]);
+}
+
+/* upper bound of bucket in microseconds */
+guint64
+gbp_histogram_get_bucket_limit (guint bucket)
+{
+  g_return_val_if_fail (bucket < GBP_HISTOGRAM_BUCKETS, 0);
+
+  return G_GUINT64_CONSTANT (1) << bucket;
+}
+
+/* returns the upper bound of the bucket holding percentile, 0 < percentile
+ * <= 1, in microseconds */
+guint64
+gbp_histogram_get_percentile (GbpHistogram *histogram, gdouble percentile)
+{
+  gint count, seen = 0;
+  guint i;
+
+  g_return_val_if_fail (histogram != NULL, 0);
+
+  count = gbp_histogram_get_count (histogram);
+  if (count == 0)
+    return 0;
+
+  for (i = 0; i < GBP_HISTOGRAM_BUCKETS - 1; ++i) {
+    seen += gbp_histogram_get_bucket (histogram, i);
+    if (seen >= count * percentile)
+      break;
+  }
+
+  return gbp_histogram_get_bucket_limit (i);
+}
+
+void
+gbp_histogram_dump (GbpHistogram *histogram, const char *name)
+{
+  GString *buckets;
+  gint count;
+  guint i;
+
+  g_return_if_fail (histogram != NULL);
+
+  count = gbp_histogram_get_count (histogram);
+  if (count == 0)
+    return;
+
+  buckets = g_string_new (NULL);
+  for (i = 0; i < GBP_HISTOGRAM_BUCKETS; ++i) {
+    count = gbp_histogram_get_bucket (histogram, i);
+    if (count != 0)
+      g_string_append_printf (buckets, " <%" G_GUINT64_FORMAT "us:%d",
+          gbp_histogram_get_bucket_limit (i), count);
+  }
+
+  GST_INFO ("%s count %d p50 %" G_GUINT64_FORMAT "us p99 %"
+      G_GUINT64_FORMAT "us max %dus%s", name,
+      gbp_histogram_get_count (histogram),
+      gbp_histogram_get_percentile (histogram, 0.5),
+      gbp_histogram_get_percentile (histogram, 0.99),
+      gbp_histogram_get_max (histogram), buckets->str);
+
+  g_string_free (buckets, TRUE);
+}
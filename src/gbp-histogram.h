@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GBP_HISTOGRAM_H
+#define GBP_HISTOGRAM_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* bucket 0 counts values under a microsecond, bucket n values from 2^(n-1)
+ * to 2^n microseconds, the last bucket everything above */
+#define GBP_HISTOGRAM_BUCKETS 26
+
+/* lock free log2 histogram of durations */
+typedef struct
+{
+  volatile gint buckets[GBP_HISTOGRAM_BUCKETS];
+  volatile gint count;
+  /* in microseconds */
+  volatile gint max;
+} GbpHistogram;
+
+void gbp_histogram_add (GbpHistogram *histogram, GstClockTime value);
+gint gbp_histogram_get_count (GbpHistogram *histogram);
+gint gbp_histogram_get_max (GbpHistogram *histogram);
+gint gbp_histogram_get_bucket (GbpHistogram *histogram, guint bucket);
+guint64 gbp_histogram_get_bucket_limit (guint bucket);
+guint64 gbp_histogram_get_percentile (GbpHistogram *histogram,
+    gdouble percentile);
+void gbp_histogram_dump (GbpHistogram *histogram, const char *name);
+
+G_END_DECLS
+
+#endif /* GBP_HISTOGRAM_H */
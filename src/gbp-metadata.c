@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include "gbp-metadata.h"
+#include "gbp-stats.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gbp_player_debug);
+#define GST_CAT_DEFAULT gbp_player_debug
+
+/* number of uris the metadata cache remembers */
+#define METADATA_CACHE_SIZE 256
+
+typedef struct
+{
+  const char *tag;
+  const char *field;
+} MetadataTag;
+
+static const MetadataTag metadata_tags[] = {
+  {GST_TAG_TITLE, "title"},
+  {GST_TAG_ARTIST, "artist"},
+  {GST_TAG_ALBUM, "album"},
+  {GST_TAG_CONTAINER_FORMAT, "container"},
+  {GST_TAG_VIDEO_CODEC, "videoCodec"},
+  {GST_TAG_AUDIO_CODEC, "audioCodec"},
+  {GST_TAG_BITRATE, "bitrate"},
+  {GST_TAG_NOMINAL_BITRATE, "nominalBitrate"},
+
+  /* sentinel */
+  {NULL, NULL}
+};
+
+static GStaticMutex metadata_cache_lock = G_STATIC_MUTEX_INIT;
+static GHashTable *metadata_cache;
+/* insertion order of the keys in metadata_cache, oldest first */
+static GQueue metadata_cache_keys = G_QUEUE_INIT;
+
+static void
+copy_caps_field (GstStructure *metadata, const GstCaps *caps,
+    const char *field, const char *name)
+{
+  GstStructure *structure;
+  gint value;
+
+  if (caps == NULL || gst_caps_get_size (caps) == 0)
+    return;
+
+  structure = gst_caps_get_structure (caps, 0);
+  if (gst_structure_get_int (structure, field, &value))
+    gst_structure_set (metadata, name, G_TYPE_INT, value, NULL);
+}
+
+/* collects what javascript gets from getMetadata () and probe (). Any of the
+ * arguments can be NULL or GST_CLOCK_TIME_NONE if unknown. */
+GstStructure *
+gbp_metadata_new (const GstTagList *tags, const GstCaps *video_caps,
+    const GstCaps *audio_caps, GstClockTime duration)
+{
+  GstStructure *metadata;
+  const GValue *value;
+  int i;
+
+  metadata = gst_structure_empty_new ("metadata");
+
+  if (duration != GST_CLOCK_TIME_NONE)
+    gst_structure_set (metadata, "duration", G_TYPE_INT,
+        (gint) (duration / GST_MSECOND), NULL);
+
+  for (i = 0; tags != NULL && metadata_tags[i].tag != NULL; ++i) {
+    value = gst_tag_list_get_value_index (tags, metadata_tags[i].tag, 0);
+    if (value != NULL)
+      gst_structure_set_value (metadata, metadata_tags[i].field, value);
+  }
+
+  copy_caps_field (metadata, video_caps, "width", "width");
+  copy_caps_field (metadata, video_caps, "height", "height");
+  copy_caps_field (metadata, audio_caps, "channels", "channels");
+  copy_caps_field (metadata, audio_caps, "rate", "rate");
+
+  return metadata;
+}
+
+/* returns a copy of the metadata last seen for uri, or NULL */
+GstStructure *
+gbp_metadata_cache_lookup (const char *uri)
+{
+  GstStructure *metadata = NULL;
+
+  g_return_val_if_fail (uri != NULL, NULL);
+
+  g_static_mutex_lock (&metadata_cache_lock);
+  if (metadata_cache != NULL)
+    metadata = (GstStructure *) g_hash_table_lookup (metadata_cache, uri);
+  if (metadata != NULL)
+    metadata = gst_structure_copy (metadata);
+  g_static_mutex_unlock (&metadata_cache_lock);
+
+  if (metadata != NULL) {
+    GST_DEBUG ("metadata cache hit for %s", uri);
+    gbp_stats_inc (GBP_STAT_METADATA_CACHE_HITS);
+  } else {
+    gbp_stats_inc (GBP_STAT_METADATA_CACHE_MISSES);
+  }
+
+  return metadata;
+}
+
+static gboolean
+merge_field (GQuark field_id, const GValue *value, gpointer user_data)
+{
+  gst_structure_id_set_value ((GstStructure *) user_data, field_id, value);
+
+  return TRUE;
+}
+
+/* merges metadata into what is cached for uri, so that an instance that only
+ * knows some of it doesn't throw away what others found out */
+void
+gbp_metadata_cache_insert (const char *uri, const GstStructure *metadata)
+{
+  GstStructure *merged;
+  char *key;
+
+  g_return_if_fail (uri != NULL);
+  g_return_if_fail (metadata != NULL);
+
+  g_static_mutex_lock (&metadata_cache_lock);
+  if (metadata_cache == NULL)
+    metadata_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) gst_structure_free);
+
+  merged = (GstStructure *) g_hash_table_lookup (metadata_cache, uri);
+  if (merged != NULL) {
+    merged = gst_structure_copy (merged);
+    gst_structure_foreach (metadata, merge_field, merged);
+  } else {
+    merged = gst_structure_copy (metadata);
+  }
+
+  if (g_hash_table_lookup (metadata_cache, uri) == NULL) {
+    if (g_queue_get_length (&metadata_cache_keys) == METADATA_CACHE_SIZE) {
+      key = (char *) g_queue_pop_head (&metadata_cache_keys);
+      g_hash_table_remove (metadata_cache, key);
+    }
+
+    key = g_strdup (uri);
+    g_queue_push_tail (&metadata_cache_keys, key);
+  } else {
+    /* replacing, the table already owns a key */
+    key = g_strdup (uri);
+  }
+
+  /* g_hash_table_replace would free the key the queue points to */
+  g_hash_table_insert (metadata_cache, key, merged);
+  g_static_mutex_unlock (&metadata_cache_lock);
+}
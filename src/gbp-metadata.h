@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GBP_METADATA_H
+#define GBP_METADATA_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+GstStructure *gbp_metadata_new (const GstTagList *tags,
+    const GstCaps *video_caps, const GstCaps *audio_caps,
+    GstClockTime duration);
+GstStructure *gbp_metadata_cache_lookup (const char *uri);
+void gbp_metadata_cache_insert (const char *uri,
+    const GstStructure *metadata);
+
+G_END_DECLS
+
+#endif /* GBP_METADATA_H */
@@ -22,12 +22,15 @@
 #include "config.h"
 
 #include "gbp-np-class.h"
+#include "gbp-stats.h"
+#include "gbp-probe.h"
+#include "gbp-executor.h"
+#include "gbp-histogram.h"
+#include "gbp-watchdog.h"
+#include <stdlib.h>
 #include <string.h>
 
 GbpNPClass gbp_np_class;
-#ifdef PLAYBACK_THREAD_POOL
-static GThreadPool *playback_thread_pool;
-#endif
 
 typedef struct
 {
@@ -49,26 +52,204 @@ typedef enum
   PLAYBACK_CMD_PAUSE,
   PLAYBACK_CMD_START,
   PLAYBACK_CMD_QUIT,
+  PLAYBACK_CMD_PRELOAD,
+  PLAYBACK_CMD_PRELOADED,
+  PLAYBACK_CMD_SEEK,
+  PLAYBACK_CMD_STEP,
+  PLAYBACK_CMD_VOLUME,
+  PLAYBACK_CMD_URI,
+  PLAYBACK_CMD_TRACK,
+  PLAYBACK_CMD_AUDIO,
+  PLAYBACK_CMD_RECOVER,
+  PLAYBACK_CMD_BATCH,
+  PLAYBACK_CMD_LAST
 } PlaybackCommandCode;
 
-static const char *playback_command_names[4] = {
+static const char *playback_command_names[PLAYBACK_CMD_LAST] = {
   "STOP",
   "PAUSE",
   "START",
   "QUIT",
+  "PRELOAD",
+  "PRELOADED",
+  "SEEK",
+  "STEP",
+  "VOLUME",
+  "URI",
+  "TRACK",
+  "AUDIO",
+  "RECOVER",
+  "BATCH",
 };
 
+/* the state a command's completion callback waits for. QUIT has none but
+ * still supersedes the pending callbacks. */
+static const char *playback_command_targets[PLAYBACK_CMD_LAST] = {
+  "STOPPED",
+  "PAUSED",
+  "PLAYING",
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+};
+
+/* the executor class a lane runs in while the command is pending. Teardown
+ * never waits behind playback, playback never waits behind preloading. */
+static const GbpExecutorPriority playback_command_priorities[PLAYBACK_CMD_LAST] = {
+  GBP_EXECUTOR_PRIORITY_TEARDOWN,
+  GBP_EXECUTOR_PRIORITY_PLAYBACK,
+  GBP_EXECUTOR_PRIORITY_PLAYBACK,
+  GBP_EXECUTOR_PRIORITY_TEARDOWN,
+  GBP_EXECUTOR_PRIORITY_BACKGROUND,
+  GBP_EXECUTOR_PRIORITY_BACKGROUND,
+  GBP_EXECUTOR_PRIORITY_SEEK,
+  GBP_EXECUTOR_PRIORITY_SEEK,
+  GBP_EXECUTOR_PRIORITY_PLAYBACK,
+  GBP_EXECUTOR_PRIORITY_PLAYBACK,
+  GBP_EXECUTOR_PRIORITY_PLAYBACK,
+  GBP_EXECUTOR_PRIORITY_PLAYBACK,
+  GBP_EXECUTOR_PRIORITY_PLAYBACK,
+  /* raised to the most urgent of its commands */
+  GBP_EXECUTOR_PRIORITY_PLAYBACK,
+};
+
+/* where a command spent its time, each recorded per command code */
+typedef enum
+{
+  PLAYBACK_LATENCY_QUEUE,
+  PLAYBACK_LATENCY_DISPATCH,
+  PLAYBACK_LATENCY_EXEC,
+  PLAYBACK_LATENCY_TOTAL,
+  PLAYBACK_LATENCIES
+} PlaybackLatency;
+
+static const char *playback_latency_names[PLAYBACK_LATENCIES] = {
+  "queue",
+  "dispatch",
+  "exec",
+  "total",
+};
+
+#define PLAYBACK_HISTOGRAMS (PLAYBACK_CMD_LAST * PLAYBACK_LATENCIES)
+#define PLAYBACK_HISTOGRAM(histograms, code, latency) \
+  (&(histograms)[(code) * PLAYBACK_LATENCIES + (latency)])
+
+/* a completion callback waiting for the player to reach target */
+typedef struct
+{
+  InvokeData *callback;
+  GstClockTime queued;
+  const char *target;
+} StateWaiter;
+
+/* the uris passed to a single probe () call. Owned by the NPPGbpData while
+ * results are pending, and by each uri being probed. */
+typedef struct
+{
+  volatile gint refcount;
+  GMutex *lock;
+  NPP instance;
+  NPObject *callback;
+  guint pending;
+  gboolean cancelled;
+} ProbeBatch;
+
 typedef struct
 {
+  ProbeBatch *batch;
+  GstStructure *result;
+} ProbeResult;
+
+/* queue slots, popped in this order before the other commands. A new uri
+ * is picked up by the next start, so it goes first. */
+enum
+{
+  PLAYBACK_SLOT_QUIT,
+  PLAYBACK_SLOT_URI,
+  PLAYBACK_SLOT_STATE,
+  PLAYBACK_SLOT_SEEK,
+  PLAYBACK_SLOT_VOLUME,
+  PLAYBACK_SLOTS
+};
+
+#define PLAYBACK_QUEUE_SIZE 64
+/* exec () batches can't be larger than the ring they replace */
+#define EXEC_MAX_OPERATIONS PLAYBACK_QUEUE_SIZE
+/* each probed uri runs its own pipeline */
+#define PROBE_MAX_URIS 64
+/* commands are allocated this many at a time and recycled through
+ * playback_command_pool */
+#define PLAYBACK_COMMAND_SLAB_SIZE 32
+/* commands an instance runs before yielding to the other instances */
+#define PLAYBACK_LANE_BATCH 8
+/* read from $XDG_CONFIG_HOME, the environment overrides it */
+#define PLAYBACK_CONFIG_FILE "gst-browser-plugin.conf"
+#define PLAYBACK_CONFIG_GROUP "playback"
+/* how long a state change may take before the watchdog reports it, in ms */
+#define PLAYBACK_STATE_TIMEOUT 10000
+#define PLAYBACK_TRACK_CURRENT G_MININT
+
+typedef struct _PlaybackCommand PlaybackCommand;
+
+struct _PlaybackCommand
+{
+  /* overwritten by GTrashStack while the command is in the pool */
   PlaybackCommandCode code;
   NPPGbpData *data;
   GbpPlayer *player;
   gboolean free_data;
+  /* only created for waited commands, kept when the command is recycled */
   GCond *cond;
   GMutex *lock;
   gboolean done;
   gboolean wait;
-} PlaybackCommand;
+  /* the commands this one superseded, completed along with it */
+  PlaybackCommand *merged;
+  /* queued on the ring to keep its place, see playback_barriers */
+  gboolean barrier;
+  /* optional js completion callback, called with (latency, state) or
+   * (latency, result) */
+  InvokeData *callback;
+  /* arguments, depending on code */
+  union {
+    struct {
+      GstClockTime position;
+      gdouble rate;
+    } seek;
+    gint frames;
+    gdouble volume;
+    char *uri;
+    /* index is PLAYBACK_TRACK_CURRENT to select the tracks asked for so far
+     * after a preroll */
+    struct {
+      GbpPlayerTrackType type;
+      gint index;
+    } track;
+    gboolean have_audio;
+    /* the state command to run again on the new pipeline, and the state
+     * change it was queued for */
+    struct {
+      PlaybackCommandCode code;
+      guint state_change;
+    } recover;
+    /* the commands of an exec () call, run in order */
+    GPtrArray *batch;
+  } args;
+  /* what the player returned, TRUE for commands that can't fail */
+  gboolean result;
+  /* when the command was pushed, popped, started and done */
+  GstClockTime queued;
+  GstClockTime dequeued;
+  GstClockTime started;
+};
 
 static bool gbp_np_class_method_start (NPObject *obj, NPIdentifier name,
     const NPVariant *args, uint32_t argCount, NPVariant *result);
@@ -82,12 +263,33 @@ static bool gbp_np_class_method_set_error_handler (NPObject *obj,
 static bool gbp_np_class_method_set_state_handler (NPObject *obj,
     NPIdentifier name, const NPVariant *args, uint32_t argCount,
     NPVariant *result);
+static bool gbp_np_class_method_set_time_update_handler (NPObject *obj,
+    NPIdentifier name, const NPVariant *args, uint32_t argCount,
+    NPVariant *result);
 static bool gbp_np_class_method_get_duration (NPObject *obj, NPIdentifier name,
     const NPVariant *args, uint32_t argCount, NPVariant *result);
 static bool gbp_np_class_method_get_position (NPObject *obj, NPIdentifier name,
     const NPVariant *args, uint32_t argCount, NPVariant *result);
 static bool gbp_np_class_method_seek (NPObject *obj, NPIdentifier name,
     const NPVariant *args, uint32_t argCount, NPVariant *result);
+static bool gbp_np_class_method_step_frames (NPObject *obj,
+    NPIdentifier name, const NPVariant *args, uint32_t argCount,
+    NPVariant *result);
+static bool gbp_np_class_method_get_metadata (NPObject *obj,
+    NPIdentifier name, const NPVariant *args, uint32_t argCount,
+    NPVariant *result);
+static bool gbp_np_class_method_get_stats (NPObject *obj,
+    NPIdentifier name, const NPVariant *args, uint32_t argCount,
+    NPVariant *result);
+static bool gbp_np_class_method_get_latencies (NPObject *obj,
+    NPIdentifier name, const NPVariant *args, uint32_t argCount,
+    NPVariant *result);
+static bool gbp_np_class_method_probe (NPObject *obj,
+    NPIdentifier name, const NPVariant *args, uint32_t argCount,
+    NPVariant *result);
+static bool gbp_np_class_method_exec (NPObject *obj,
+    NPIdentifier name, const NPVariant *args, uint32_t argCount,
+    NPVariant *result);
 
 static bool gbp_np_class_property_generic_get (NPObject *obj,
     NPIdentifier name, NPVariant *result);
@@ -109,30 +311,63 @@ static bool gbp_np_class_property_have_audio_get (NPObject *obj,
     NPIdentifier name, NPVariant *result);
 static bool gbp_np_class_property_have_audio_set (NPObject *obj,
     NPIdentifier name, const NPVariant *value);
+static bool gbp_np_class_property_preload_get (NPObject *obj,
+    NPIdentifier name, NPVariant *result);
+static bool gbp_np_class_property_preload_set (NPObject *obj,
+    NPIdentifier name, const NPVariant *value);
+static bool gbp_np_class_property_audio_tracks_get (NPObject *obj,
+    NPIdentifier name, NPVariant *result);
+static bool gbp_np_class_property_current_audio_track_get (NPObject *obj,
+    NPIdentifier name, NPVariant *result);
+static bool gbp_np_class_property_current_audio_track_set (NPObject *obj,
+    NPIdentifier name, const NPVariant *value);
+static bool gbp_np_class_property_text_tracks_get (NPObject *obj,
+    NPIdentifier name, NPVariant *result);
+static bool gbp_np_class_property_current_text_track_get (NPObject *obj,
+    NPIdentifier name, NPVariant *result);
+static bool gbp_np_class_property_current_text_track_set (NPObject *obj,
+    NPIdentifier name, const NPVariant *value);
+static bool gbp_np_class_property_playback_queue_depth_get (NPObject *obj,
+    NPIdentifier name, NPVariant *result);
+static bool gbp_np_class_property_time_update_interval_get (NPObject *obj,
+    NPIdentifier name, NPVariant *result);
+static bool gbp_np_class_property_time_update_interval_set (NPObject *obj,
+    NPIdentifier name, const NPVariant *value);
+static bool gbp_np_class_property_hidden_get (NPObject *obj,
+    NPIdentifier name, NPVariant *result);
+static bool gbp_np_class_property_hidden_set (NPObject *obj,
+    NPIdentifier name, const NPVariant *value);
 
 PlaybackCommand *playback_command_new (PlaybackCommandCode code,
-    NPPGbpData *data, gboolean free_data);
+    NPPGbpData *data, gboolean free_data, gboolean wait);
 void playback_command_free (PlaybackCommand *command);
 void playback_command_push (PlaybackCommandCode code,
     NPPGbpData *data, gboolean free_data, gboolean wait);
-#ifndef PLAYBACK_THREAD_POOL
-static gpointer playback_thread_func (gpointer data);
-#else
-static void playback_thread_pool_func (gpointer pool_data, gpointer push_data);
-#endif
-void gbp_np_class_start_playback_thread ();
-void gbp_np_class_stop_playback_thread ();
-static gint compare_commands(gconstpointer a, gconstpointer b, gpointer user_data);
-
-/* cached method ids, allocated by gbp_np_class_init and destroyed by
- * gbp_np_class_free */
-static NPIdentifier *method_identifiers;
-static guint methods_num;
-static NPIdentifier *property_identifiers;
-static guint properties_num;
-#ifndef PLAYBACK_THREAD_POOL
-static GAsyncQueue *joinable_threads;
-#endif
+void playback_command_push_full (PlaybackCommandCode code,
+    NPPGbpData *data, gboolean free_data, gboolean wait, InvokeData *callback);
+void playback_command_submit (PlaybackCommand *command);
+static gboolean run_playback_lane (gpointer data);
+static void playback_command_pool_free ();
+
+/* NPIdentifier to GbpNPClassMethod and GbpNPClassProperty, built by
+ * gbp_np_class_init and destroyed by gbp_np_class_free */
+static GHashTable *methods;
+static GHashTable *properties;
+/* 0 means one worker per core */
+static guint playback_threads;
+static guint playback_lane_batch = PLAYBACK_LANE_BATCH;
+
+/* 0 disables the watchdog */
+static guint playback_state_timeout = PLAYBACK_STATE_TIMEOUT;
+/* rebuild the pipeline after reporting a stuck state change */
+static guint playback_recover;
+
+/* the same histograms as NPPGbpData.latencies, for all the instances */
+static GbpHistogram playback_latencies[PLAYBACK_HISTOGRAMS];
+
+static GStaticMutex playback_command_pool_lock = G_STATIC_MUTEX_INIT;
+static GTrashStack *playback_command_pool;
+static GSList *playback_command_slabs;
 
 static GbpNPClassMethod gbp_np_class_methods[] = {
   {"start", gbp_np_class_method_start},
@@ -141,8 +376,15 @@ static GbpNPClassMethod gbp_np_class_methods[] = {
   {"get_duration", gbp_np_class_method_get_duration},
   {"get_position", gbp_np_class_method_get_position},
   {"seek", gbp_np_class_method_seek},
+  {"stepFrames", gbp_np_class_method_step_frames},
   {"setErrorHandler", gbp_np_class_method_set_error_handler},
   {"setStateHandler", gbp_np_class_method_set_state_handler},
+  {"setTimeUpdateHandler", gbp_np_class_method_set_time_update_handler},
+  {"getMetadata", gbp_np_class_method_get_metadata},
+  {"getStats", gbp_np_class_method_get_stats},
+  {"getLatencies", gbp_np_class_method_get_latencies},
+  {"probe", gbp_np_class_method_probe},
+  {"exec", gbp_np_class_method_exec},
 
   /* sentinel */
   {NULL, NULL}
@@ -153,6 +395,14 @@ static GbpNPClassProperty gbp_np_class_properties[] = {
   {"uri", gbp_np_class_property_uri_get, gbp_np_class_property_uri_set, NULL},
   {"volume", gbp_np_class_property_volume_get, gbp_np_class_property_volume_set, NULL},
   {"have_audio", gbp_np_class_property_have_audio_get, gbp_np_class_property_have_audio_set, NULL},
+  {"preload", gbp_np_class_property_preload_get, gbp_np_class_property_preload_set, NULL},
+  {"audioTracks", gbp_np_class_property_audio_tracks_get, NULL, NULL},
+  {"currentAudioTrack", gbp_np_class_property_current_audio_track_get, gbp_np_class_property_current_audio_track_set, NULL},
+  {"textTracks", gbp_np_class_property_text_tracks_get, NULL, NULL},
+  {"currentTextTrack", gbp_np_class_property_current_text_track_get, gbp_np_class_property_current_text_track_set, NULL},
+  {"playbackQueueDepth", gbp_np_class_property_playback_queue_depth_get, NULL, NULL},
+  {"timeUpdateInterval", gbp_np_class_property_time_update_interval_get, gbp_np_class_property_time_update_interval_set, NULL},
+  {"hidden", gbp_np_class_property_hidden_get, gbp_np_class_property_hidden_set, NULL},
   /* sentinel */
   {NULL, NULL}
 };
@@ -178,21 +428,13 @@ gbp_np_class_deallocate (NPObject *npobj)
 static bool
 gbp_np_class_has_method (NPObject *obj, NPIdentifier name)
 {
-  guint i;
-
-  for (i = 0; i < methods_num; ++i) {
-    if (name == method_identifiers[i])
-      return TRUE;
-  }
-
-  return FALSE;
+  return g_hash_table_lookup (methods, name) != NULL;
 }
 
 static bool
 gbp_np_class_invoke (NPObject *npobj, NPIdentifier name,
     const NPVariant *args, uint32_t argCount, NPVariant *result)
 {
-  guint i;
   GbpNPClassMethod *method;
 
   /* TODO: Find out why in Safari args == NULL */
@@ -203,17 +445,14 @@ gbp_np_class_invoke (NPObject *npobj, NPIdentifier name,
   g_return_val_if_fail (args != NULL, FALSE);
   g_return_val_if_fail (result != NULL, FALSE);
 
+  method = (GbpNPClassMethod *) g_hash_table_lookup (methods, name);
+  if (method != NULL) {
+    GbpNPObject *obj = (GbpNPObject *) npobj;
+    NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
 
-  for (i = 0; i < methods_num; ++i) {
-    if (name == method_identifiers[i]) {
-      GbpNPObject *obj = (GbpNPObject *) npobj;
-      NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
-
-      method = &gbp_np_class_methods[i];
-      GST_LOG_OBJECT (data->player,
-          "calling javascript method %s", method->name);
-      return method->method(npobj, name, args, argCount, result);
-    }
+    GST_LOG_OBJECT (data->player,
+        "calling javascript method %s", method->name);
+    return method->method(npobj, name, args, argCount, result);
   }
 
   NPN_SetException (npobj, "No method with this name exists.");
@@ -223,25 +462,17 @@ gbp_np_class_invoke (NPObject *npobj, NPIdentifier name,
 static bool
 gbp_np_class_has_property (NPObject *obj, NPIdentifier name)
 {
-  guint i;
-
-  for (i = 0; i < properties_num; ++i) {
-    if (name == property_identifiers[i])
-      return TRUE;
-  }
-
-  return FALSE;
+  return g_hash_table_lookup (properties, name) != NULL;
 }
 
 static bool
 gbp_np_class_get_property (NPObject *obj, NPIdentifier name, NPVariant *result)
 {
-  gint i;
+  GbpNPClassProperty *property;
 
-  for (i = 0; i < properties_num; ++i) {
-    if (name == property_identifiers[i])
-      return gbp_np_class_properties[i].get(obj, name, result);
-  }
+  property = (GbpNPClassProperty *) g_hash_table_lookup (properties, name);
+  if (property != NULL)
+    return property->get(obj, name, result);
 
   NPN_SetException (obj, "No property with this name exists.");
   return FALSE;
@@ -250,12 +481,11 @@ gbp_np_class_get_property (NPObject *obj, NPIdentifier name, NPVariant *result)
 static bool
 gbp_np_class_set_property (NPObject *obj, NPIdentifier name, const NPVariant *value)
 {
-  gint i;
+  GbpNPClassProperty *property;
 
-  for (i = 0; i < properties_num; ++i) {
-    if (name == property_identifiers[i])
-      return gbp_np_class_properties[i].set(obj, name, value);
-  }
+  property = (GbpNPClassProperty *) g_hash_table_lookup (properties, name);
+  if (property != NULL)
+    return property->set(obj, name, value);
 
   NPN_SetException (obj, "No property with this name exists.");
   return FALSE;
@@ -264,12 +494,11 @@ gbp_np_class_set_property (NPObject *obj, NPIdentifier name, const NPVariant *va
 static bool
 gbp_np_class_remove_property (NPObject *obj, NPIdentifier name)
 {
-  gint i;
+  GbpNPClassProperty *property;
 
-  for (i = 0; i < properties_num; ++i) {
-    if (name == property_identifiers[i])
-      return gbp_np_class_properties[i].remove(obj, name);
-  }
+  property = (GbpNPClassProperty *) g_hash_table_lookup (properties, name);
+  if (property != NULL)
+    return property->remove(obj, name);
 
   NPN_SetException (obj, "No property with this name exists.");
   return FALSE;
@@ -281,6 +510,24 @@ gbp_np_class_enumerate (NPObject *obj, NPIdentifier **value, uint32_t *count)
   return FALSE;
 }
 
+/* start (), pause () and stop () take an optional function, called once the
+ * player reaches the requested state or the request is superseded */
+static InvokeData *
+completion_callback_new (NPP instance, const NPVariant *args,
+    uint32_t argCount)
+{
+  InvokeData *callback;
+
+  if (argCount < 1 || !NPVARIANT_IS_OBJECT (args[0]))
+    return NULL;
+
+  callback = invoke_data_new (instance, NPVARIANT_TO_OBJECT (args[0]), 2);
+  VOID_TO_NPVARIANT (callback->args[0]);
+  VOID_TO_NPVARIANT (callback->args[1]);
+
+  return callback;
+}
+
 static bool
 gbp_np_class_method_start (NPObject *npobj, NPIdentifier name,
     const NPVariant *args, uint32_t argCount, NPVariant *result)
@@ -293,7 +540,8 @@ gbp_np_class_method_start (NPObject *npobj, NPIdentifier name,
   g_return_val_if_fail (result != NULL, FALSE);
 
   NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
-  playback_command_push (PLAYBACK_CMD_START, data, FALSE, FALSE);
+  playback_command_push_full (PLAYBACK_CMD_START, data, FALSE, FALSE,
+      completion_callback_new (obj->instance, args, argCount));
 
   VOID_TO_NPVARIANT (*result);
   return TRUE;
@@ -311,7 +559,8 @@ gbp_np_class_method_stop (NPObject *npobj, NPIdentifier name,
   g_return_val_if_fail (result != NULL, FALSE);
 
   NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
-  playback_command_push (PLAYBACK_CMD_STOP, data, FALSE, FALSE);
+  playback_command_push_full (PLAYBACK_CMD_STOP, data, FALSE, FALSE,
+      completion_callback_new (obj->instance, args, argCount));
 
   VOID_TO_NPVARIANT (*result);
   return TRUE;
@@ -329,7 +578,8 @@ gbp_np_class_method_pause (NPObject *npobj, NPIdentifier name,
   g_return_val_if_fail (result != NULL, FALSE);
 
   NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
-  playback_command_push (PLAYBACK_CMD_PAUSE, data, FALSE, FALSE);
+  playback_command_push_full (PLAYBACK_CMD_PAUSE, data, FALSE, FALSE,
+      completion_callback_new (obj->instance, args, argCount));
 
   VOID_TO_NPVARIANT (*result);
   return TRUE;
@@ -389,15 +639,20 @@ gbp_np_class_method_seek (NPObject *npobj, NPIdentifier name,
 {
   GstClockTime position;
   gdouble rate = 1.0;
-  gboolean res;
+  PlaybackCommand *command;
   GbpNPObject *obj = (GbpNPObject *) npobj;
+  uint32_t n_args = argCount;
 
   g_return_val_if_fail (obj != NULL, FALSE);
   g_return_val_if_fail (name != NULL, FALSE);
   g_return_val_if_fail (args != NULL, FALSE);
   g_return_val_if_fail (result != NULL, FALSE);
 
-  if (argCount < 1 || argCount > 2) {
+  /* the optional completion callback comes last */
+  if (n_args > 1 && NPVARIANT_IS_OBJECT (args[n_args - 1]))
+    n_args -= 1;
+
+  if (n_args < 1 || n_args > 2) {
     NPN_SetException (npobj, "invalid number of arguments");
 
     return FALSE;
@@ -411,7 +666,7 @@ gbp_np_class_method_seek (NPObject *npobj, NPIdentifier name,
     return FALSE;
   }
 
-  if (argCount == 2) {
+  if (n_args == 2) {
     if (args[1].type == NPVariantType_Double) {
       rate = args[1].value.doubleValue;
     } else if (args[1].type == NPVariantType_Int32) {
@@ -424,9 +679,57 @@ gbp_np_class_method_seek (NPObject *npobj, NPIdentifier name,
   }
 
   NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
-  res = gbp_player_seek (data->player, position, rate);
 
-  BOOLEAN_TO_NPVARIANT (res, *result);
+  /* runs on the instance's lane, a newer seek supersedes a pending one */
+  command = playback_command_new (PLAYBACK_CMD_SEEK, data, FALSE, FALSE);
+  command->args.seek.position = position;
+  command->args.seek.rate = rate;
+  command->callback = completion_callback_new (obj->instance,
+      args + n_args, argCount - n_args);
+  playback_command_submit (command);
+
+  BOOLEAN_TO_NPVARIANT (TRUE, *result);
+  return TRUE;
+}
+
+static bool
+gbp_np_class_method_step_frames (NPObject *npobj, NPIdentifier name,
+    const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+  gint frames;
+  PlaybackCommand *command;
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (name != NULL, FALSE);
+  g_return_val_if_fail (args != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  if (argCount < 1 || argCount > 2) {
+    NPN_SetException (npobj, "invalid number of arguments");
+
+    return FALSE;
+  }
+
+  if (args[0].type == NPVariantType_Int32) {
+    frames = args[0].value.intValue;
+  } else if (args[0].type == NPVariantType_Double) {
+    frames = (gint) args[0].value.doubleValue;
+  } else {
+    NPN_SetException (npobj, "frames must be an integer");
+
+    return FALSE;
+  }
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  command = playback_command_new (PLAYBACK_CMD_STEP, data, FALSE, FALSE);
+  command->args.frames = frames;
+  command->callback = completion_callback_new (obj->instance,
+      args + 1, argCount - 1);
+  playback_command_submit (command);
+
+  BOOLEAN_TO_NPVARIANT (TRUE, *result);
   return TRUE;
 }
 
@@ -474,200 +777,1257 @@ gbp_np_class_method_set_state_handler (NPObject *npobj, NPIdentifier name,
 }
 
 static bool
-gbp_np_class_property_generic_get (NPObject *obj,
-    NPIdentifier name, NPVariant *result)
-{
-  NPN_SetException (obj, "Can't get property value");
-  return FALSE;
-}
-
-static bool
-gbp_np_class_property_generic_set (NPObject *obj,
-    NPIdentifier name, const NPVariant *result)
-{
-  NPN_SetException (obj, "Can't set property value");
-  return FALSE;
-}
-
-static bool
-gbp_np_class_property_generic_remove (NPObject *obj,
-    NPIdentifier name)
-{
-  NPN_SetException (obj, "Can't remove property");
-  return FALSE;
-}
-
-static bool gbp_np_class_property_state_get (NPObject *npobj,
-    NPIdentifier name, NPVariant *result)
+gbp_np_class_method_set_time_update_handler (NPObject *npobj,
+    NPIdentifier name, const NPVariant *args, uint32_t argCount,
+    NPVariant *result)
 {
-  char *state_copy;
   GbpNPObject *obj = (GbpNPObject *) npobj;
 
   g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (name != NULL, FALSE);
+  g_return_val_if_fail (args != NULL, FALSE);
+  g_return_val_if_fail (argCount == 1, FALSE);
+  g_return_val_if_fail (args[0].type == NPVariantType_Object, FALSE);
   g_return_val_if_fail (result != NULL, FALSE);
 
   NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+  if (data->timeUpdateHandler != NULL)
+    NPN_ReleaseObject (data->timeUpdateHandler);
+  data->timeUpdateHandler = NPN_RetainObject(args[0].value.objectValue);
 
-  state_copy = (char *) NPN_MemAlloc (strlen (data->state) + 1);
-  strcpy (state_copy, data->state);
+  GST_DEBUG_OBJECT (data->player, "set time update handler %p",
+      data->timeUpdateHandler);
 
-  STRINGZ_TO_NPVARIANT (state_copy, *result);
+  VOID_TO_NPVARIANT (*result);
   return TRUE;
 }
 
-static bool gbp_np_class_property_uri_get (NPObject *npobj,
-    NPIdentifier name, NPVariant *result)
+/* returns a new javascript object created by calling the global function
+ * constructor, eg: Object or Array */
+static NPObject *
+create_js_object (NPP instance, const char *constructor)
 {
-  GbpNPObject *obj = (GbpNPObject *) npobj;
-  char *uri;
-  char *uri_copy;
-
-  g_return_val_if_fail (obj != NULL, FALSE);
-  g_return_val_if_fail (result != NULL, FALSE);
+  NPObject *window = NULL;
+  NPObject *object = NULL;
+  NPVariant result;
+
+  if (NPN_GetValue (instance, NPNVWindowNPObject, &window) != NPERR_NO_ERROR)
+    return NULL;
+
+  if (NPN_Invoke (instance, window, NPN_GetStringIdentifier (constructor),
+        NULL, 0, &result)) {
+    if (NPVARIANT_IS_OBJECT (result))
+      /* take the reference owned by result */
+      object = NPVARIANT_TO_OBJECT (result);
+    else
+      NPN_ReleaseVariantValue (&result);
+  }
 
-  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+  NPN_ReleaseObject (window);
 
-  g_object_get (data->player, "uri", &uri, NULL);
+  return object;
+}
 
-  uri_copy = (char *) NPN_MemAlloc (strlen (uri) + 1);
-  strcpy (uri_copy, uri);
+static gboolean
+set_js_property_from_value (GQuark field, const GValue *value,
+    gpointer user_data)
+{
+  gpointer *closure = (gpointer *) user_data;
+  NPP instance = (NPP) closure[0];
+  NPObject *object = (NPObject *) closure[1];
+  NPVariant variant;
+
+  if (G_VALUE_HOLDS_STRING (value))
+    /* NPN_SetProperty copies the string */
+    STRINGZ_TO_NPVARIANT (g_value_get_string (value), variant);
+  else if (G_VALUE_HOLDS_INT (value))
+    INT32_TO_NPVARIANT (g_value_get_int (value), variant);
+  else if (G_VALUE_HOLDS_UINT (value))
+    DOUBLE_TO_NPVARIANT (g_value_get_uint (value), variant);
+  else if (G_VALUE_HOLDS_DOUBLE (value))
+    DOUBLE_TO_NPVARIANT (g_value_get_double (value), variant);
+  else if (G_VALUE_HOLDS_BOOLEAN (value))
+    BOOLEAN_TO_NPVARIANT (g_value_get_boolean (value), variant);
+  else
+    return TRUE;
 
-  g_free (uri);
+  NPN_SetProperty (instance, object,
+      NPN_GetStringIdentifier (g_quark_to_string (field)), &variant);
 
-  STRINGZ_TO_NPVARIANT (uri_copy, *result);
   return TRUE;
 }
 
-static bool gbp_np_class_property_uri_set (NPObject *npobj,
-    NPIdentifier name, const NPVariant *value)
+/* returns a new javascript object with the fields of structure as properties */
+static NPObject *
+structure_to_js_object (NPP instance, const GstStructure *structure)
 {
-  GbpNPObject *obj = (GbpNPObject *) npobj;
-  const char *uri;
-
-  g_return_val_if_fail (obj != NULL, FALSE);
-  g_return_val_if_fail (value != NULL, FALSE);
-
-  uri = NPVARIANT_TO_STRING (*value).UTF8Characters;
+  NPObject *object;
+  gpointer closure[2];
 
-  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+  object = create_js_object (instance, "Object");
+  if (object == NULL)
+    return NULL;
 
-  GST_INFO_OBJECT (data->player, "setting uri %s", uri);
-  g_object_set (data->player, "uri", uri, NULL);
+  closure[0] = instance;
+  closure[1] = object;
+  gst_structure_foreach (structure, set_js_property_from_value, closure);
 
-  return TRUE;
+  return object;
 }
 
-static bool gbp_np_class_property_volume_get (NPObject *npobj,
-    NPIdentifier name, NPVariant *result)
+static bool
+gbp_np_class_method_get_metadata (NPObject *npobj, NPIdentifier name,
+    const NPVariant *args, uint32_t argCount, NPVariant *result)
 {
   GbpNPObject *obj = (GbpNPObject *) npobj;
-  gdouble volume;
+  GstStructure *metadata;
+  NPObject *object = NULL;
 
   g_return_val_if_fail (obj != NULL, FALSE);
   g_return_val_if_fail (result != NULL, FALSE);
 
   NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
 
-  g_object_get (data->player, "volume", &volume, NULL);
+  metadata = gbp_player_get_metadata (data->player);
+  if (metadata != NULL) {
+    object = structure_to_js_object (obj->instance, metadata);
+    gst_structure_free (metadata);
+  }
+
+  if (object != NULL)
+    OBJECT_TO_NPVARIANT (object, *result);
+  else
+    NULL_TO_NPVARIANT (*result);
 
-  DOUBLE_TO_NPVARIANT (volume, *result);
   return TRUE;
 }
 
-static bool gbp_np_class_property_volume_set (NPObject *npobj,
-    NPIdentifier name, const NPVariant *value)
+static bool
+gbp_np_class_method_get_stats (NPObject *npobj, NPIdentifier name,
+    const NPVariant *args, uint32_t argCount, NPVariant *result)
 {
   GbpNPObject *obj = (GbpNPObject *) npobj;
-  gdouble volume;
+  GstStructure *stats;
+  NPObject *object;
+  int i;
 
   g_return_val_if_fail (obj != NULL, FALSE);
-  g_return_val_if_fail (value != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
 
-  if (value->type == NPVariantType_Int32)
-    volume = NPVARIANT_TO_INT32 (*value);
-  else if (value->type == NPVariantType_Double)
-    volume = NPVARIANT_TO_DOUBLE (*value);
-  else {
-    NPN_SetException (npobj, "volume must be a number");
-    return FALSE;
-  }
+  stats = gst_structure_empty_new ("stats");
+  for (i = 0; i < GBP_STAT_LAST; ++i)
+    gst_structure_set (stats, gbp_stats_get_name (i),
+        G_TYPE_INT, gbp_stats_get (i), NULL);
 
-  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+  object = structure_to_js_object (obj->instance, stats);
+  gst_structure_free (stats);
 
-  g_object_set (data->player, "volume", volume, NULL);
+  if (object != NULL)
+    OBJECT_TO_NPVARIANT (object, *result);
+  else
+    NULL_TO_NPVARIANT (*result);
 
   return TRUE;
 }
 
-static bool gbp_np_class_property_have_audio_get (NPObject *npobj,
-    NPIdentifier name, NPVariant *result)
+static NPObject *
+histogram_to_js_object (NPP instance, GbpHistogram *histogram)
 {
-  GbpNPObject *obj = (GbpNPObject *) npobj;
-  gboolean have_audio;
-
-  g_return_val_if_fail (obj != NULL, FALSE);
-  g_return_val_if_fail (result != NULL, FALSE);
+  GstStructure *structure;
+  NPObject *object, *buckets;
+  NPVariant variant;
+  guint i;
 
-  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+  structure = gst_structure_new ("histogram",
+      "count", G_TYPE_INT, gbp_histogram_get_count (histogram),
+      "max", G_TYPE_INT, gbp_histogram_get_max (histogram),
+      "p50", G_TYPE_DOUBLE,
+      (gdouble) gbp_histogram_get_percentile (histogram, 0.5),
+      "p90", G_TYPE_DOUBLE,
+      (gdouble) gbp_histogram_get_percentile (histogram, 0.9),
+      "p99", G_TYPE_DOUBLE,
+      (gdouble) gbp_histogram_get_percentile (histogram, 0.99), NULL);
+  object = structure_to_js_object (instance, structure);
+  gst_structure_free (structure);
+  if (object == NULL)
+    return NULL;
+
+  /* buckets[n] counts the values under 2^n microseconds */
+  buckets = create_js_object (instance, "Array");
+  if (buckets != NULL) {
+    for (i = 0; i < GBP_HISTOGRAM_BUCKETS; ++i) {
+      INT32_TO_NPVARIANT (gbp_histogram_get_bucket (histogram, i), variant);
+      NPN_SetProperty (instance, buckets, NPN_GetIntIdentifier (i), &variant);
+    }
 
-  g_object_get (data->player, "have_audio", &have_audio, NULL);
+    OBJECT_TO_NPVARIANT (buckets, variant);
+    NPN_SetProperty (instance, object,
+        NPN_GetStringIdentifier ("buckets"), &variant);
+    NPN_ReleaseObject (buckets);
+  }
 
-  BOOLEAN_TO_NPVARIANT (have_audio, *result);
-  return TRUE;
+  return object;
 }
 
-static bool gbp_np_class_property_have_audio_set (NPObject *npobj,
-    NPIdentifier name, const NPVariant *value)
+/* getLatencies (global) returns the latencies of this instance, or of all
+ * of them if global is true, in microseconds by command and phase */
+static bool
+gbp_np_class_method_get_latencies (NPObject *npobj, NPIdentifier name,
+    const NPVariant *args, uint32_t argCount, NPVariant *result)
 {
   GbpNPObject *obj = (GbpNPObject *) npobj;
-  gboolean have_audio;
+  NPPGbpData *data;
+  GbpHistogram *histograms;
+  NPObject *object, *command_object, *histogram_object;
+  NPVariant variant;
+  gint code, latency;
 
   g_return_val_if_fail (obj != NULL, FALSE);
-  g_return_val_if_fail (value != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
 
-  if (value->type == NPVariantType_Bool) {
-    have_audio = NPVARIANT_TO_BOOLEAN (*value);
-  } else {
-    NPN_SetException (npobj, "have_audio must be a boolean");
-    return FALSE;
+  data = (NPPGbpData *) obj->instance->pdata;
+  if (argCount > 0 && NPVARIANT_IS_BOOLEAN (args[0]) &&
+      NPVARIANT_TO_BOOLEAN (args[0]))
+    histograms = playback_latencies;
+  else
+    histograms = data->latencies;
+
+  object = create_js_object (obj->instance, "Object");
+  if (object == NULL) {
+    NULL_TO_NPVARIANT (*result);
+    return TRUE;
   }
 
-  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
-  g_object_set (data->player, "have_audio", have_audio, NULL);
+  for (code = 0; code < PLAYBACK_CMD_LAST; ++code) {
+    if (gbp_histogram_get_count (PLAYBACK_HISTOGRAM (histograms,
+            code, PLAYBACK_LATENCY_TOTAL)) == 0)
+      continue;
+
+    command_object = create_js_object (obj->instance, "Object");
+    if (command_object == NULL)
+      continue;
+
+    for (latency = 0; latency < PLAYBACK_LATENCIES; ++latency) {
+      histogram_object = histogram_to_js_object (obj->instance,
+          PLAYBACK_HISTOGRAM (histograms, code, latency));
+      if (histogram_object == NULL)
+        continue;
+
+      OBJECT_TO_NPVARIANT (histogram_object, variant);
+      NPN_SetProperty (obj->instance, command_object,
+          NPN_GetStringIdentifier (playback_latency_names[latency]), &variant);
+      NPN_ReleaseObject (histogram_object);
+    }
+
+    OBJECT_TO_NPVARIANT (command_object, variant);
+    NPN_SetProperty (obj->instance, object,
+        NPN_GetStringIdentifier (playback_command_names[code]), &variant);
+    NPN_ReleaseObject (command_object);
+  }
 
+  OBJECT_TO_NPVARIANT (object, *result);
   return TRUE;
 }
 
-void
-gbp_np_class_init ()
+static ProbeBatch *
+probe_batch_ref (ProbeBatch *batch)
 {
-  int i;
-  const char **method_names, **property_names;
+  g_atomic_int_inc (&batch->refcount);
 
-  NPClass *klass = (NPClass *) &gbp_np_class;
+  return batch;
+}
 
-  /* only init once */
-  g_return_if_fail (klass->structVersion == 0);
+static void
+probe_batch_unref (ProbeBatch *batch)
+{
+  if (!g_atomic_int_dec_and_test (&batch->refcount))
+    return;
 
-  GST_DEBUG_CATEGORY_INIT (gbp_player_debug,
-      "gbp-player", 0, "GStreamer Browser Plugin");
+  g_mutex_free (batch->lock);
+  g_free (batch);
+}
 
-  klass->structVersion = NP_CLASS_STRUCT_VERSION;
-  klass->allocate = gbp_np_class_allocate;
-  klass->deallocate = gbp_np_class_deallocate;
-  klass->hasMethod = gbp_np_class_has_method;
-  klass->invoke = gbp_np_class_invoke;
-  klass->hasProperty = gbp_np_class_has_property;
-  klass->getProperty = gbp_np_class_get_property;
-  klass->setProperty = gbp_np_class_set_property;
-  klass->removeProperty = gbp_np_class_remove_property;
-  klass->enumerate = gbp_np_class_enumerate;
+/* called on the browser thread once a batch is done or cancelled */
+static void
+probe_batch_finish (ProbeBatch *batch)
+{
+  NPPGbpData *data = (NPPGbpData *) batch->instance->pdata;
+
+  data->probe_batches = g_slist_remove (data->probe_batches, batch);
+  NPN_ReleaseObject (batch->callback);
+  batch->callback = NULL;
+  probe_batch_unref (batch);
+}
+
+static void
+probe_result_cb (void *user_data)
+{
+  ProbeResult *probe_result = (ProbeResult *) user_data;
+  ProbeBatch *batch = probe_result->batch;
+  NPObject *object;
+  NPVariant arg;
+  NPVariant result;
+
+  if (!batch->cancelled) {
+    object = structure_to_js_object (batch->instance, probe_result->result);
+    if (object != NULL) {
+      OBJECT_TO_NPVARIANT (object, arg);
+      if (NPN_InvokeDefault (batch->instance, batch->callback,
+            &arg, 1, &result))
+        NPN_ReleaseVariantValue (&result);
+      NPN_ReleaseObject (object);
+    }
+
+    if (--batch->pending == 0)
+      probe_batch_finish (batch);
+  }
+
+  gst_structure_free (probe_result->result);
+  probe_batch_unref (batch);
+  g_free (probe_result);
+}
+
+/* called from the probe workers */
+static void
+probe_done_cb (const char *uri, GstStructure *result, gpointer user_data)
+{
+  ProbeBatch *batch = (ProbeBatch *) user_data;
+  ProbeResult *probe_result;
+
+  /* the lock makes sure the instance isn't destroyed between checking
+   * ->cancelled and scheduling the async call */
+  g_mutex_lock (batch->lock);
+  if (!batch->cancelled && result != NULL) {
+    probe_result = g_new (ProbeResult, 1);
+    probe_result->batch = probe_batch_ref (batch);
+    probe_result->result = result;
+    result = NULL;
+
+    NPN_PluginThreadAsyncCall (batch->instance, probe_result_cb,
+        probe_result);
+  }
+  g_mutex_unlock (batch->lock);
+
+  if (result != NULL)
+    gst_structure_free (result);
+
+  /* drop the ref owned by uri */
+  probe_batch_unref (batch);
+}
+
+/* reads array.length, a missing length counts as an empty array. Returns
+ * FALSE if it isn't a number between 0 and max. */
+static gboolean
+get_array_length (NPP instance, NPObject *array, gint max, gint *length)
+{
+  NPVariant value;
+  gdouble number;
+  gboolean res = TRUE;
+
+  *length = 0;
+  if (!NPN_GetProperty (instance, array,
+        NPN_GetStringIdentifier ("length"), &value))
+    return TRUE;
+
+  if (NPVARIANT_IS_INT32 (value)) {
+    number = NPVARIANT_TO_INT32 (value);
+  } else if (NPVARIANT_IS_DOUBLE (value)) {
+    number = NPVARIANT_TO_DOUBLE (value);
+  } else {
+    number = 0;
+    res = FALSE;
+  }
+  NPN_ReleaseVariantValue (&value);
+
+  /* checked before the cast, NaN fails both comparisons */
+  if (!(number >= 0 && number <= max))
+    res = FALSE;
+
+  if (res)
+    *length = (gint) number;
+
+  return res;
+}
+
+static bool
+gbp_np_class_method_probe (NPObject *npobj, NPIdentifier name,
+    const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  NPP instance;
+  NPPGbpData *data;
+  NPObject *array;
+  NPVariant value;
+  ProbeBatch *batch;
+  GPtrArray *uris;
+  char *message;
+  gint length = 0;
+  guint i;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  instance = obj->instance;
+  data = (NPPGbpData *) instance->pdata;
+
+  if (argCount != 2 || args[0].type != NPVariantType_Object ||
+      args[1].type != NPVariantType_Object) {
+    NPN_SetException (npobj, "usage: probe (uris, callback)");
+    return FALSE;
+  }
+
+  array = NPVARIANT_TO_OBJECT (args[0]);
+  if (!get_array_length (instance, array, PROBE_MAX_URIS, &length)) {
+    message = g_strdup_printf ("uris must be an array of at most %d",
+        PROBE_MAX_URIS);
+    NPN_SetException (npobj, message);
+    g_free (message);
+    return FALSE;
+  }
+
+  /* collect everything first so that a bad uri doesn't leave a half started
+   * batch behind */
+  uris = g_ptr_array_new ();
+  for (i = 0; i < (guint) length; ++i) {
+    if (!NPN_GetProperty (instance, array, NPN_GetIntIdentifier (i), &value))
+      break;
+
+    if (!NPVARIANT_IS_STRING (value)) {
+      NPN_ReleaseVariantValue (&value);
+      break;
+    }
+
+    g_ptr_array_add (uris,
+        g_strndup (NPVARIANT_TO_STRING (value).UTF8Characters,
+            NPVARIANT_TO_STRING (value).UTF8Length));
+    NPN_ReleaseVariantValue (&value);
+  }
+
+  if (uris->len != (guint) length) {
+    g_ptr_array_foreach (uris, (GFunc) g_free, NULL);
+    g_ptr_array_free (uris, TRUE);
+    NPN_SetException (npobj, "uris must be an array of strings");
+    return FALSE;
+  }
+
+  if (length > 0) {
+    batch = g_new0 (ProbeBatch, 1);
+    /* owned by data->probe_batches */
+    batch->refcount = 1;
+    batch->lock = g_mutex_new ();
+    batch->instance = instance;
+    batch->callback = NPN_RetainObject (NPVARIANT_TO_OBJECT (args[1]));
+    batch->pending = length;
+    data->probe_batches = g_slist_prepend (data->probe_batches, batch);
+
+    GST_INFO_OBJECT (data->player, "probing %d uris", length);
+
+    for (i = 0; i < uris->len; ++i)
+      gbp_probe_uri ((const char *) g_ptr_array_index (uris, i),
+          probe_done_cb, probe_batch_ref (batch));
+  }
+
+  g_ptr_array_foreach (uris, (GFunc) g_free, NULL);
+  g_ptr_array_free (uris, TRUE);
+
+  VOID_TO_NPVARIANT (*result);
+  return TRUE;
+}
+
+void
+gbp_np_class_cancel_object_probes (NPPGbpData *data)
+{
+  ProbeBatch *batch;
+
+  while (data->probe_batches != NULL) {
+    batch = (ProbeBatch *) data->probe_batches->data;
+
+    g_mutex_lock (batch->lock);
+    batch->cancelled = TRUE;
+    g_mutex_unlock (batch->lock);
+
+    probe_batch_finish (batch);
+  }
+}
+
+static gboolean
+variant_to_double (const NPVariant *value, gdouble *res)
+{
+  if (NPVARIANT_IS_INT32 (*value))
+    *res = NPVARIANT_TO_INT32 (*value);
+  else if (NPVARIANT_IS_DOUBLE (*value))
+    *res = NPVARIANT_TO_DOUBLE (*value);
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+/* reads a number field of an exec () operation, FALSE if it's missing or not
+ * a number */
+static gboolean
+get_operation_number (NPP instance, NPObject *operation, const char *field,
+    gdouble *res)
+{
+  NPVariant value;
+  gboolean ret;
+
+  if (!NPN_GetProperty (instance, operation,
+        NPN_GetStringIdentifier (field), &value))
+    return FALSE;
+
+  ret = variant_to_double (&value, res);
+  NPN_ReleaseVariantValue (&value);
+
+  return ret;
+}
+
+/* the string field of an exec () operation, NULL if it isn't a string */
+static char *
+get_operation_string (NPP instance, NPObject *operation, const char *field)
+{
+  NPVariant value;
+  char *res = NULL;
+
+  if (!NPN_GetProperty (instance, operation,
+        NPN_GetStringIdentifier (field), &value))
+    return NULL;
+
+  if (NPVARIANT_IS_STRING (value))
+    res = g_strndup (NPVARIANT_TO_STRING (value).UTF8Characters,
+        NPVARIANT_TO_STRING (value).UTF8Length);
+  NPN_ReleaseVariantValue (&value);
+
+  return res;
+}
+
+/* turns one {op: ...} object into a command, NULL and *error set if it isn't
+ * valid */
+static PlaybackCommand *
+parse_operation (NPP instance, NPObject *operation, const char **error)
+{
+  NPPGbpData *data = (NPPGbpData *) instance->pdata;
+  PlaybackCommand *command = NULL;
+  char *op, *str;
+  gdouble number;
+
+  op = get_operation_string (instance, operation, "op");
+  if (op == NULL) {
+    *error = "op must be a string";
+    return NULL;
+  }
+
+  if (!strcmp (op, "start")) {
+    command = playback_command_new (PLAYBACK_CMD_START, data, FALSE, FALSE);
+  } else if (!strcmp (op, "pause")) {
+    command = playback_command_new (PLAYBACK_CMD_PAUSE, data, FALSE, FALSE);
+  } else if (!strcmp (op, "stop")) {
+    command = playback_command_new (PLAYBACK_CMD_STOP, data, FALSE, FALSE);
+  } else if (!strcmp (op, "seek")) {
+    if (!get_operation_number (instance, operation, "pos", &number) ||
+        number < 0) {
+      *error = "seek needs a position";
+    } else {
+      command = playback_command_new (PLAYBACK_CMD_SEEK, data, FALSE, FALSE);
+      command->args.seek.position = (GstClockTime) number * GST_MSECOND;
+      if (!get_operation_number (instance, operation, "rate",
+            &command->args.seek.rate))
+        command->args.seek.rate = 1.0;
+    }
+  } else if (!strcmp (op, "step")) {
+    if (!get_operation_number (instance, operation, "frames", &number)) {
+      *error = "step needs a number of frames";
+    } else {
+      command = playback_command_new (PLAYBACK_CMD_STEP, data, FALSE, FALSE);
+      command->args.frames = (gint) number;
+    }
+  } else if (!strcmp (op, "volume")) {
+    if (!get_operation_number (instance, operation, "v", &number)) {
+      *error = "volume needs a value";
+    } else {
+      command = playback_command_new (PLAYBACK_CMD_VOLUME, data, FALSE, FALSE);
+      command->args.volume = number;
+    }
+  } else if (!strcmp (op, "uri")) {
+    str = get_operation_string (instance, operation, "uri");
+    if (str == NULL) {
+      *error = "uri must be a string";
+    } else {
+      command = playback_command_new (PLAYBACK_CMD_URI, data, FALSE, FALSE);
+      command->args.uri = str;
+    }
+  } else if (!strcmp (op, "audioTrack") || !strcmp (op, "textTrack")) {
+    GbpPlayerTrackType type = !strcmp (op, "textTrack") ?
+        GBP_PLAYER_TRACK_TEXT : GBP_PLAYER_TRACK_AUDIO;
+
+    /* audio can only be turned off with have_audio */
+    if (!get_operation_number (instance, operation, "index", &number) ||
+        number < (type == GBP_PLAYER_TRACK_TEXT ? -1 : 0)) {
+      *error = "invalid track";
+    } else {
+      command = playback_command_new (PLAYBACK_CMD_TRACK, data, FALSE, FALSE);
+      command->args.track.type = type;
+      command->args.track.index = (gint) number;
+    }
+  } else {
+    *error = "unknown op";
+  }
+
+  g_free (op);
+
+  return command;
+}
+
+/* exec (operations[, callback]) queues a list of {op: ...} objects as one
+ * command. Nothing is queued unless all of them are valid. The callback gets
+ * (latency, result) once they have all run. */
+static bool
+gbp_np_class_method_exec (NPObject *npobj, NPIdentifier name,
+    const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  NPP instance;
+  NPPGbpData *data;
+  NPObject *array;
+  NPVariant value;
+  PlaybackCommand *command, *batched;
+  GPtrArray *batch;
+  const char *error = NULL;
+  char *message;
+  gint length = 0;
+  guint i;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  instance = obj->instance;
+  data = (NPPGbpData *) instance->pdata;
+
+  if (argCount < 1 || argCount > 2 || args[0].type != NPVariantType_Object) {
+    NPN_SetException (npobj, "usage: exec (operations[, callback])");
+    return FALSE;
+  }
+
+  array = NPVARIANT_TO_OBJECT (args[0]);
+  if (!get_array_length (instance, array, EXEC_MAX_OPERATIONS, &length)) {
+    message = g_strdup_printf ("operations must be an array of at most %d",
+        EXEC_MAX_OPERATIONS);
+    NPN_SetException (npobj, message);
+    g_free (message);
+    return FALSE;
+  }
+
+  batch = g_ptr_array_sized_new (length);
+  for (i = 0; i < (guint) length; ++i) {
+    if (!NPN_GetProperty (instance, array, NPN_GetIntIdentifier (i), &value)) {
+      error = "missing operation";
+      break;
+    }
+
+    if (NPVARIANT_IS_OBJECT (value)) {
+      batched = parse_operation (instance, NPVARIANT_TO_OBJECT (value), &error);
+      if (batched != NULL)
+        g_ptr_array_add (batch, batched);
+    } else {
+      error = "operations must be objects";
+    }
+    NPN_ReleaseVariantValue (&value);
+
+    if (error != NULL)
+      break;
+  }
+
+  if (error != NULL) {
+    g_ptr_array_foreach (batch, (GFunc) playback_command_free, NULL);
+    g_ptr_array_free (batch, TRUE);
+    message = g_strdup_printf ("operation %d: %s", i, error);
+    NPN_SetException (npobj, message);
+    g_free (message);
+    return FALSE;
+  }
+
+  /* what the getters return now, like setting the properties does */
+  for (i = 0; i < batch->len; ++i) {
+    batched = (PlaybackCommand *) g_ptr_array_index (batch, i);
+    if (batched->code == PLAYBACK_CMD_URI) {
+      g_free (data->uri);
+      data->uri = g_strdup (batched->args.uri);
+    } else if (batched->code == PLAYBACK_CMD_VOLUME) {
+      data->volume = batched->args.volume;
+    }
+  }
+
+  GST_DEBUG_OBJECT (data->player, "queueing %d operations", batch->len);
+
+  command = playback_command_new (PLAYBACK_CMD_BATCH, data, FALSE, FALSE);
+  command->args.batch = batch;
+  command->callback = completion_callback_new (instance,
+      args + 1, argCount - 1);
+  playback_command_submit (command);
+
+  BOOLEAN_TO_NPVARIANT (TRUE, *result);
+  return TRUE;
+}
+
+static bool
+gbp_np_class_property_generic_get (NPObject *obj,
+    NPIdentifier name, NPVariant *result)
+{
+  NPN_SetException (obj, "Can't get property value");
+  return FALSE;
+}
+
+static bool
+gbp_np_class_property_generic_set (NPObject *obj,
+    NPIdentifier name, const NPVariant *result)
+{
+  NPN_SetException (obj, "Can't set property value");
+  return FALSE;
+}
+
+static bool
+gbp_np_class_property_generic_remove (NPObject *obj,
+    NPIdentifier name)
+{
+  NPN_SetException (obj, "Can't remove property");
+  return FALSE;
+}
+
+static bool gbp_np_class_property_state_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  char *state_copy;
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  state_copy = (char *) NPN_MemAlloc (strlen (data->state) + 1);
+  strcpy (state_copy, data->state);
+
+  STRINGZ_TO_NPVARIANT (state_copy, *result);
+  return TRUE;
+}
+
+static bool gbp_np_class_property_uri_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  const char *uri;
+  char *uri_copy;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  /* the player may not have seen the last one yet */
+  uri = data->uri;
+
+  uri_copy = (char *) NPN_MemAlloc (strlen (uri) + 1);
+  strcpy (uri_copy, uri);
+
+  STRINGZ_TO_NPVARIANT (uri_copy, *result);
+  return TRUE;
+}
+
+static bool gbp_np_class_property_uri_set (NPObject *npobj,
+    NPIdentifier name, const NPVariant *value)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  PlaybackCommand *command;
+  char *uri;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (!NPVARIANT_IS_STRING (*value)) {
+    NPN_SetException (npobj, "uri must be a string");
+    return FALSE;
+  }
+
+  /* NPStrings aren't NUL terminated */
+  uri = g_strndup (NPVARIANT_TO_STRING (*value).UTF8Characters,
+      NPVARIANT_TO_STRING (*value).UTF8Length);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  GST_INFO_OBJECT (data->player, "setting uri %s", uri);
+  g_free (data->uri);
+  data->uri = g_strdup (uri);
+
+  command = playback_command_new (PLAYBACK_CMD_URI, data, FALSE, FALSE);
+  command->args.uri = uri;
+  playback_command_submit (command);
+
+  return TRUE;
+}
+
+static bool gbp_np_class_property_volume_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  gdouble volume;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  volume = data->volume;
+
+  DOUBLE_TO_NPVARIANT (volume, *result);
+  return TRUE;
+}
+
+static bool gbp_np_class_property_volume_set (NPObject *npobj,
+    NPIdentifier name, const NPVariant *value)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  PlaybackCommand *command;
+  gdouble volume;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (value->type == NPVariantType_Int32)
+    volume = NPVARIANT_TO_INT32 (*value);
+  else if (value->type == NPVariantType_Double)
+    volume = NPVARIANT_TO_DOUBLE (*value);
+  else {
+    NPN_SetException (npobj, "volume must be a number");
+    return FALSE;
+  }
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  data->volume = volume;
+
+  command = playback_command_new (PLAYBACK_CMD_VOLUME, data, FALSE, FALSE);
+  command->args.volume = volume;
+  playback_command_submit (command);
+
+  return TRUE;
+}
+
+static bool gbp_np_class_property_have_audio_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  gboolean have_audio;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  have_audio = data->have_audio;
+
+  BOOLEAN_TO_NPVARIANT (have_audio, *result);
+  return TRUE;
+}
+
+static bool gbp_np_class_property_have_audio_set (NPObject *npobj,
+    NPIdentifier name, const NPVariant *value)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  PlaybackCommand *command;
+  gboolean have_audio;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (value->type == NPVariantType_Bool) {
+    have_audio = NPVARIANT_TO_BOOLEAN (*value);
+  } else {
+    NPN_SetException (npobj, "have_audio must be a boolean");
+    return FALSE;
+  }
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  data->have_audio = have_audio;
+
+  /* rebuilds the pipeline, which the lane may be starting */
+  command = playback_command_new (PLAYBACK_CMD_AUDIO, data, FALSE, FALSE);
+  command->args.have_audio = have_audio;
+  playback_command_submit (command);
+
+  return TRUE;
+}
+
+static bool gbp_np_class_property_preload_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  char *preload;
+  char *preload_copy;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  g_object_get (data->player, "preload", &preload, NULL);
+
+  preload_copy = (char *) NPN_MemAlloc (strlen (preload) + 1);
+  strcpy (preload_copy, preload);
+
+  g_free (preload);
+
+  STRINGZ_TO_NPVARIANT (preload_copy, *result);
+  return TRUE;
+}
+
+static bool gbp_np_class_property_preload_set (NPObject *npobj,
+    NPIdentifier name, const NPVariant *value)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  char *preload;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (value->type != NPVariantType_String) {
+    NPN_SetException (npobj, "preload must be a string");
+    return FALSE;
+  }
+
+  preload = g_strndup (NPVARIANT_TO_STRING (*value).UTF8Characters,
+      NPVARIANT_TO_STRING (*value).UTF8Length);
+  if (strcmp (preload, "none") && strcmp (preload, "metadata") &&
+      strcmp (preload, "auto")) {
+    g_free (preload);
+    NPN_SetException (npobj, "preload must be none, metadata or auto");
+    return FALSE;
+  }
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+  g_object_set (data->player, "preload", preload, NULL);
+  g_free (preload);
+
+  gbp_np_class_preload_object (data);
+
+  return TRUE;
+}
+
+static bool
+get_tracks_property (NPObject *npobj, GbpPlayerTrackType type,
+    NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  NPObject *array, *object;
+  NPVariant variant;
+  GList *tracks, *walk;
+  gint i;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  array = create_js_object (obj->instance, "Array");
+  if (array == NULL) {
+    NULL_TO_NPVARIANT (*result);
+    return TRUE;
+  }
+
+  tracks = gbp_player_get_tracks (data->player, type);
+  for (walk = tracks, i = 0; walk != NULL; walk = walk->next, ++i) {
+    object = structure_to_js_object (obj->instance,
+        (GstStructure *) walk->data);
+    gst_structure_free ((GstStructure *) walk->data);
+    if (object == NULL)
+      continue;
+
+    OBJECT_TO_NPVARIANT (object, variant);
+    NPN_SetProperty (obj->instance, array, NPN_GetIntIdentifier (i), &variant);
+    NPN_ReleaseObject (object);
+  }
+  g_list_free (tracks);
+
+  OBJECT_TO_NPVARIANT (array, *result);
+  return TRUE;
+}
+
+static bool
+get_current_track_property (NPObject *npobj, GbpPlayerTrackType type,
+    NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  INT32_TO_NPVARIANT (gbp_player_get_current_track (data->player, type),
+      *result);
+  return TRUE;
+}
+
+static bool
+set_current_track_property (NPObject *npobj, GbpPlayerTrackType type,
+    const NPVariant *value)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  PlaybackCommand *command;
+  gint track;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (value->type == NPVariantType_Int32) {
+    track = NPVARIANT_TO_INT32 (*value);
+  } else if (value->type == NPVariantType_Double) {
+    track = (gint) NPVARIANT_TO_DOUBLE (*value);
+  } else {
+    NPN_SetException (npobj, "track must be an integer");
+    return FALSE;
+  }
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  /* audio can only be turned off with have_audio */
+  if (track < (type == GBP_PLAYER_TRACK_TEXT ? -1 : 0)) {
+    NPN_SetException (npobj, "invalid track");
+    return FALSE;
+  }
+
+  command = playback_command_new (PLAYBACK_CMD_TRACK, data, FALSE, FALSE);
+  command->args.track.type = type;
+  command->args.track.index = track;
+  playback_command_submit (command);
+
+  return TRUE;
+}
+
+static bool gbp_np_class_property_audio_tracks_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  return get_tracks_property (npobj, GBP_PLAYER_TRACK_AUDIO, result);
+}
+
+static bool gbp_np_class_property_current_audio_track_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  return get_current_track_property (npobj, GBP_PLAYER_TRACK_AUDIO, result);
+}
+
+static bool gbp_np_class_property_current_audio_track_set (NPObject *npobj,
+    NPIdentifier name, const NPVariant *value)
+{
+  return set_current_track_property (npobj, GBP_PLAYER_TRACK_AUDIO, value);
+}
+
+static bool gbp_np_class_property_text_tracks_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  return get_tracks_property (npobj, GBP_PLAYER_TRACK_TEXT, result);
+}
+
+static bool gbp_np_class_property_current_text_track_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  return get_current_track_property (npobj, GBP_PLAYER_TRACK_TEXT, result);
+}
+
+static bool gbp_np_class_property_current_text_track_set (NPObject *npobj,
+    NPIdentifier name, const NPVariant *value)
+{
+  return set_current_track_property (npobj, GBP_PLAYER_TRACK_TEXT, value);
+}
+
+static bool gbp_np_class_property_playback_queue_depth_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  INT32_TO_NPVARIANT (gbp_playback_queue_get_length (data->playback_queue),
+      *result);
+  return TRUE;
+}
+
+static bool gbp_np_class_property_time_update_interval_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  guint64 interval;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  g_object_get (data->player, "time-update-interval", &interval, NULL);
+
+  INT32_TO_NPVARIANT (interval / GST_MSECOND, *result);
+  return TRUE;
+}
+
+/* in milliseconds, 0 stops the timeupdate events */
+static bool gbp_np_class_property_time_update_interval_set (NPObject *npobj,
+    NPIdentifier name, const NPVariant *value)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  gint interval;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (value->type == NPVariantType_Int32) {
+    interval = NPVARIANT_TO_INT32 (*value);
+  } else if (value->type == NPVariantType_Double) {
+    interval = (gint) NPVARIANT_TO_DOUBLE (*value);
+  } else {
+    NPN_SetException (npobj, "timeUpdateInterval must be a number");
+    return FALSE;
+  }
+
+  if (interval < 0) {
+    NPN_SetException (npobj, "timeUpdateInterval can't be negative");
+    return FALSE;
+  }
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  g_object_set (data->player, "time-update-interval",
+      (guint64) interval * GST_MSECOND, NULL);
+
+  return TRUE;
+}
+
+static bool gbp_np_class_property_hidden_get (NPObject *npobj,
+    NPIdentifier name, NPVariant *result)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+  gboolean visible;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (result != NULL, FALSE);
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  g_object_get (data->player, "visible", &visible, NULL);
+
+  BOOLEAN_TO_NPVARIANT (!visible, *result);
+  return TRUE;
+}
+
+/* set by the page, e.g. from visibilitychange, NPAPI doesn't tell us */
+static bool gbp_np_class_property_hidden_set (NPObject *npobj,
+    NPIdentifier name, const NPVariant *value)
+{
+  GbpNPObject *obj = (GbpNPObject *) npobj;
+
+  g_return_val_if_fail (obj != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (value->type != NPVariantType_Bool) {
+    NPN_SetException (npobj, "hidden must be a boolean");
+    return FALSE;
+  }
+
+  NPPGbpData *data = (NPPGbpData *) obj->instance->pdata;
+
+  g_object_set (data->player, "visible", !NPVARIANT_TO_BOOLEAN (*value),
+      NULL);
+
+  return TRUE;
+}
+
+static void
+load_playback_config_value (GKeyFile *key_file, const char *key,
+    const char *env, guint *value)
+{
+  const char *str;
+  GError *error = NULL;
+  gint file_value;
+
+  if (key_file != NULL) {
+    file_value = g_key_file_get_integer (key_file, PLAYBACK_CONFIG_GROUP, key,
+        &error);
+    if (error == NULL && file_value >= 0)
+      *value = file_value;
+    g_clear_error (&error);
+  }
+
+  str = g_getenv (env);
+  if (str != NULL && *str != '\0')
+    *value = strtoul (str, NULL, 10);
+}
+
+static void
+load_playback_config ()
+{
+  GKeyFile *key_file;
+  char *filename;
+
+  filename = g_build_filename (g_get_user_config_dir (),
+      PLAYBACK_CONFIG_FILE, NULL);
+  key_file = g_key_file_new ();
+  if (!g_key_file_load_from_file (key_file, filename, 0, NULL)) {
+    g_key_file_free (key_file);
+    key_file = NULL;
+  }
+  g_free (filename);
+
+  load_playback_config_value (key_file, "threads",
+      "GBP_PLAYBACK_THREADS", &playback_threads);
+  load_playback_config_value (key_file, "lane-batch",
+      "GBP_PLAYBACK_LANE_BATCH", &playback_lane_batch);
+  if (playback_lane_batch == 0)
+    playback_lane_batch = 1;
+  load_playback_config_value (key_file, "state-timeout",
+      "GBP_PLAYBACK_STATE_TIMEOUT", &playback_state_timeout);
+  load_playback_config_value (key_file, "recover",
+      "GBP_PLAYBACK_RECOVER", &playback_recover);
+
+  if (key_file != NULL)
+    g_key_file_free (key_file);
+
+  GST_INFO ("playback threads %d lane batch %d state timeout %d recover %d",
+      playback_threads, playback_lane_batch, playback_state_timeout,
+      playback_recover);
+}
+
+void
+gbp_np_class_init ()
+{
+  guint i, methods_num, properties_num;
+  const char **method_names, **property_names;
+  NPIdentifier *method_identifiers, *property_identifiers;
+
+  NPClass *klass = (NPClass *) &gbp_np_class;
+
+  /* only init once */
+  g_return_if_fail (klass->structVersion == 0);
+
+  GST_DEBUG_CATEGORY_INIT (gbp_player_debug,
+      "gbp-player", 0, "GStreamer Browser Plugin");
+
+  klass->structVersion = NP_CLASS_STRUCT_VERSION;
+  klass->allocate = gbp_np_class_allocate;
+  klass->deallocate = gbp_np_class_deallocate;
+  klass->hasMethod = gbp_np_class_has_method;
+  klass->invoke = gbp_np_class_invoke;
+  klass->hasProperty = gbp_np_class_has_property;
+  klass->getProperty = gbp_np_class_get_property;
+  klass->setProperty = gbp_np_class_set_property;
+  klass->removeProperty = gbp_np_class_remove_property;
+  klass->enumerate = gbp_np_class_enumerate;
 
   /* setup method identifiers */
   methods_num = \
       (sizeof (gbp_np_class_methods) / sizeof (GbpNPClassMethod)) - 1;
 
-  /* alloc method_identifiers */
   method_identifiers = \
       (NPIdentifier *) NPN_MemAlloc (sizeof (NPIdentifier) * methods_num);
 
@@ -679,7 +2039,6 @@ gbp_np_class_init ()
   properties_num = \
       (sizeof (gbp_np_class_properties) / sizeof (GbpNPClassProperty)) - 1;
 
-  /* alloc property_identifiers */
   property_identifiers = \
       (NPIdentifier *) NPN_MemAlloc (sizeof (NPIdentifier) * properties_num);
 
@@ -694,66 +2053,189 @@ gbp_np_class_init ()
       gbp_np_class_properties[i].remove = gbp_np_class_property_generic_remove;
   }
 
-  /* fill method_identifiers */
-  NPN_GetStringIdentifiers (method_names, methods_num, method_identifiers);
-  /* fill property identifiers */
-  NPN_GetStringIdentifiers (property_names, properties_num, property_identifiers);
+  NPN_GetStringIdentifiers (method_names, methods_num, method_identifiers);
+  NPN_GetStringIdentifiers (property_names, properties_num, property_identifiers);
+
+  /* identifiers are interned by the browser, compare them as pointers */
+  methods = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < methods_num; ++i)
+    g_hash_table_insert (methods, method_identifiers[i],
+        &gbp_np_class_methods[i]);
+
+  properties = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < properties_num; ++i)
+    g_hash_table_insert (properties, property_identifiers[i],
+        &gbp_np_class_properties[i]);
+
+  NPN_MemFree (method_names);
+  NPN_MemFree (property_names);
+  NPN_MemFree (method_identifiers);
+  NPN_MemFree (property_identifiers);
+
+  gbp_probe_init ();
+
+  load_playback_config ();
+  gbp_executor_init (playback_threads);
+  gbp_watchdog_init ();
+}
+
+static void
+playback_latencies_dump ()
+{
+  char *name;
+  gint code, latency;
+
+  for (code = 0; code < PLAYBACK_CMD_LAST; ++code) {
+    for (latency = 0; latency < PLAYBACK_LATENCIES; ++latency) {
+      name = g_strdup_printf ("%s %s latency", playback_command_names[code],
+          playback_latency_names[latency]);
+      gbp_histogram_dump (PLAYBACK_HISTOGRAM (playback_latencies,
+            code, latency), name);
+      g_free (name);
+    }
+  }
+}
+
+void
+gbp_np_class_free ()
+{
+  NPClass *klass = (NPClass *) &gbp_np_class;
+
+  g_return_if_fail (klass->structVersion != 0);
+
+  gbp_probe_shutdown ();
+
+  gbp_executor_shutdown ();
+  /* after the executor, lanes remove their watches */
+  gbp_watchdog_shutdown ();
+  playback_latencies_dump ();
+
+  g_hash_table_destroy (methods);
+  methods = NULL;
+  g_hash_table_destroy (properties);
+  properties = NULL;
+
+  /* all the workers are gone, so are the commands */
+  playback_command_pool_free ();
+
+  memset (&gbp_np_class, 0, sizeof (GbpNPClass));
+}
+
+GbpPlaybackQueue *
+gbp_np_class_new_playback_queue ()
+{
+  return gbp_playback_queue_new (PLAYBACK_SLOTS, PLAYBACK_QUEUE_SIZE);
+}
 
-  NPN_MemFree (method_names);
-  NPN_MemFree (property_names);
+/* the executor task running the commands in queue */
+GbpExecutorTask *
+gbp_np_class_new_playback_task (GbpPlaybackQueue *queue)
+{
+  return gbp_executor_task_new (run_playback_lane,
+      gbp_playback_queue_ref (queue), (GDestroyNotify) gbp_playback_queue_unref);
+}
+
+/* the player's state-timeout, GST_CLOCK_TIME_NONE if disabled */
+GstClockTime
+gbp_np_class_get_state_timeout ()
+{
+  if (playback_state_timeout == 0)
+    return GST_CLOCK_TIME_NONE;
 
-#ifdef PLAYBACK_THREAD_POOL
-  playback_thread_pool = g_thread_pool_new (playback_thread_pool_func, NULL,
-      PLAYBACK_THREAD_POOL_MAX_SIZE, TRUE, NULL);
-  g_thread_pool_set_max_idle_time (PLAYBACK_THREAD_POOL_MAX_IDLE_TIME);
-#else
-  joinable_threads = g_async_queue_new ();
-#endif
+  return playback_state_timeout * GST_MSECOND;
 }
 
-void
-gbp_np_class_free ()
+/* freed with g_free () */
+GbpHistogram *
+gbp_np_class_new_latency_histograms ()
 {
-  NPClass *klass = (NPClass *) &gbp_np_class;
+  return g_new0 (GbpHistogram, PLAYBACK_HISTOGRAMS);
+}
 
-  g_return_if_fail (klass->structVersion != 0);
+/* stops the player and frees data on the playback lane without waiting for
+ * it. The instance must not be used by anything queued after this. */
+void gbp_np_class_reap_object (NPPGbpData *data)
+{
+  playback_command_push (PLAYBACK_CMD_QUIT, data, TRUE, FALSE);
+}
 
-#ifdef PLAYBACK_THREAD_POOL
-  g_thread_pool_free (playback_thread_pool, FALSE, TRUE);
-  playback_thread_pool = NULL;
-#else
-  while (g_async_queue_length (joinable_threads)) {
-    GThread *thread = (GThread *) g_async_queue_pop (joinable_threads);
-    g_thread_join (thread);
-  }
+void gbp_np_class_preload_object (NPPGbpData *data)
+{
+  if (gbp_player_get_preload (data->player) != GBP_PLAYER_PRELOAD_NONE)
+    playback_command_push (PLAYBACK_CMD_PRELOAD, data, FALSE, FALSE);
+}
 
-  g_async_queue_unref (joinable_threads);
-  joinable_threads = NULL;
-#endif
+/* called from a streaming or clock thread once a preload can be finished */
+void gbp_np_class_finish_object_preload (NPPGbpData *data)
+{
+  playback_command_push (PLAYBACK_CMD_PRELOADED, data, FALSE, FALSE);
+}
 
-  NPN_MemFree (method_identifiers);
+/* called from a streaming thread once the pipeline has prerolled */
+void gbp_np_class_apply_object_tracks (NPPGbpData *data)
+{
+  PlaybackCommand *command;
 
-  memset (&gbp_np_class, 0, sizeof (GbpNPClass));
+  command = playback_command_new (PLAYBACK_CMD_TRACK, data, FALSE, FALSE);
+  command->args.track.index = PLAYBACK_TRACK_CURRENT;
+  playback_command_submit (command);
 }
 
-#ifndef PLAYBACK_THREAD_POOL
-void gbp_np_class_start_object_playback_thread(NPPGbpData *data)
+/* called with playback_command_pool_lock */
+static PlaybackCommand *
+playback_command_slab_alloc ()
 {
-  data->playback_thread = g_thread_create (playback_thread_func,
-      data->playback_queue, TRUE, NULL);
+  PlaybackCommand *slab;
+  int i;
+
+  slab = g_new0 (PlaybackCommand, PLAYBACK_COMMAND_SLAB_SIZE);
+  playback_command_slabs = g_slist_prepend (playback_command_slabs, slab);
+  gbp_stats_inc (GBP_STAT_PLAYBACK_COMMAND_ALLOCATIONS);
+
+  for (i = 1; i < PLAYBACK_COMMAND_SLAB_SIZE; ++i)
+    g_trash_stack_push (&playback_command_pool, &slab[i]);
+
+  return &slab[0];
 }
-#endif
 
-void gbp_np_class_stop_object_playback_thread(NPPGbpData *data)
+static void
+playback_command_pool_free ()
 {
-  playback_command_push (PLAYBACK_CMD_QUIT, data, FALSE, TRUE);
+  PlaybackCommand *slab;
+  GSList *walk;
+  int i;
+
+  for (walk = playback_command_slabs; walk != NULL; walk = walk->next) {
+    slab = (PlaybackCommand *) walk->data;
+    for (i = 0; i < PLAYBACK_COMMAND_SLAB_SIZE; ++i) {
+      if (slab[i].cond != NULL) {
+        g_cond_free (slab[i].cond);
+        g_mutex_free (slab[i].lock);
+      }
+    }
+
+    g_free (slab);
+  }
+
+  g_slist_free (playback_command_slabs);
+  playback_command_slabs = NULL;
+  playback_command_pool = NULL;
 }
 
 PlaybackCommand *
 playback_command_new (PlaybackCommandCode code,
-    NPPGbpData *data, gboolean free_data)
+    NPPGbpData *data, gboolean free_data, gboolean wait)
 {
-  PlaybackCommand *command = g_new0 (PlaybackCommand, 1);
+  PlaybackCommand *command;
+
+  g_static_mutex_lock (&playback_command_pool_lock);
+  command = (PlaybackCommand *) g_trash_stack_pop (&playback_command_pool);
+  if (command == NULL)
+    command = playback_command_slab_alloc ();
+  g_static_mutex_unlock (&playback_command_pool_lock);
+
+  gbp_stats_inc (GBP_STAT_PLAYBACK_COMMANDS);
+
   if (data)
     command->player = g_object_ref (data->player);
   else
@@ -761,10 +2243,20 @@ playback_command_new (PlaybackCommandCode code,
   command->code = code;
   command->data = data;
   command->free_data = free_data;
-  command->cond = g_cond_new ();
-  command->lock = g_mutex_new ();
   command->done = FALSE;
-  command->wait = FALSE;
+  command->wait = wait;
+  command->merged = NULL;
+  command->barrier = FALSE;
+  command->callback = NULL;
+  command->queued = gst_util_get_timestamp ();
+  command->dequeued = GST_CLOCK_TIME_NONE;
+  command->started = GST_CLOCK_TIME_NONE;
+
+  /* fire and forget commands never touch these */
+  if (wait && command->cond == NULL) {
+    command->cond = g_cond_new ();
+    command->lock = g_mutex_new ();
+  }
 
   return command;
 }
@@ -774,53 +2266,319 @@ playback_command_free (PlaybackCommand *command)
 {
   g_return_if_fail (command != NULL);
 
-  GST_INFO ("freeing command %p", command);
+  GST_DEBUG ("freeing command %p", command);
 
   if (command->player)
     g_object_unref (command->player);
+  command->player = NULL;
 
   if (command->free_data)
-    npp_gbp_data_free (command->data);
+    npp_gbp_data_unref (command->data);
   command->data = NULL;
 
-  g_cond_free (command->cond);
-  g_mutex_free (command->lock);
-  g_free (command);
+  if (command->code == PLAYBACK_CMD_URI)
+    g_free (command->args.uri);
+
+  /* never ran, dropped along with the batch */
+  if (command->code == PLAYBACK_CMD_BATCH && command->args.batch != NULL) {
+    g_ptr_array_foreach (command->args.batch,
+        (GFunc) playback_command_free, NULL);
+    g_ptr_array_free (command->args.batch, TRUE);
+    command->args.batch = NULL;
+  }
+
+  g_static_mutex_lock (&playback_command_pool_lock);
+  g_trash_stack_push (&playback_command_pool, command);
+  g_static_mutex_unlock (&playback_command_pool_lock);
+}
+
+/* schedules callback with the time since queued in microseconds and value.
+ * Once the instance is gone callback has been freed along with it. */
+static void
+playback_callback_post (NPPGbpData *data, InvokeData *callback,
+    GstClockTime queued, const NPVariant *value)
+{
+  GstClockTime latency;
+
+  if (!npp_gbp_data_lock (data))
+    return;
+
+  latency = gst_util_get_timestamp () - queued;
+  DOUBLE_TO_NPVARIANT ((double) (latency / GST_USECOND), callback->args[0]);
+  callback->args[1] = *value;
+
+  invoke_data_post (data, callback);
+  npp_gbp_data_unlock (data);
+}
+
+/* state is the static name of the state reached, NULL if the request was
+ * superseded */
+static void
+playback_callback_invoke (NPPGbpData *data, InvokeData *callback,
+    GstClockTime queued, const char *state)
+{
+  NPVariant value;
+
+  if (state != NULL) {
+    STRINGZ_TO_NPVARIANT (state, value);
+  } else {
+    NULL_TO_NPVARIANT (value);
+  }
+
+  playback_callback_post (data, callback, queued, &value);
+}
+
+static void
+playback_callback_invoke_result (NPPGbpData *data, InvokeData *callback,
+    GstClockTime queued, gboolean result)
+{
+  NPVariant value;
+
+  BOOLEAN_TO_NPVARIANT (result, value);
+  playback_callback_post (data, callback, queued, &value);
+}
+
+/* completes the waiters for target, or all of them if target is NULL */
+static void
+complete_state_waiters (NPPGbpData *data, const char *target,
+    const char *state)
+{
+  StateWaiter *waiter;
+  GSList *walk, *next;
+
+  g_mutex_lock (data->state_waiters_lock);
+  for (walk = data->state_waiters; walk != NULL; walk = next) {
+    next = walk->next;
+    waiter = (StateWaiter *) walk->data;
+    if (target != NULL && strcmp (waiter->target, target))
+      continue;
+
+    playback_callback_invoke (data, waiter->callback, waiter->queued, state);
+    g_free (waiter);
+    data->state_waiters = g_slist_delete_link (data->state_waiters, walk);
+  }
+  g_mutex_unlock (data->state_waiters_lock);
+}
+
+static void
+add_state_waiter (NPPGbpData *data, PlaybackCommand *command,
+    const char *target)
+{
+  StateWaiter *waiter;
+
+  waiter = g_new (StateWaiter, 1);
+  waiter->callback = command->callback;
+  waiter->queued = command->queued;
+  waiter->target = target;
+  command->callback = NULL;
+
+  g_mutex_lock (data->state_waiters_lock);
+  data->state_waiters = g_slist_append (data->state_waiters, waiter);
+  g_mutex_unlock (data->state_waiters_lock);
+}
+
+static const char *
+settled_state_name (GstState state)
+{
+  switch (state) {
+    case GST_STATE_PLAYING:
+      return "PLAYING";
+    case GST_STATE_PAUSED:
+      return "PAUSED";
+    default:
+      return "STOPPED";
+  }
+}
+
+/* called from on_state_cb */
+void
+gbp_np_class_object_state_changed (NPPGbpData *data, const char *state)
+{
+  complete_state_waiters (data, state, state);
+}
+
+/* called on the browser thread when the instance goes away, after
+ * invoke_data_cancel_all () freed the callbacks */
+void
+gbp_np_class_cancel_object_state_waiters (NPPGbpData *data)
+{
+  GSList *walk;
+
+  g_mutex_lock (data->state_waiters_lock);
+  for (walk = data->state_waiters; walk != NULL; walk = walk->next)
+    g_free (walk->data);
+  g_slist_free (data->state_waiters);
+  data->state_waiters = NULL;
+  g_mutex_unlock (data->state_waiters_lock);
+}
+
+/* completes command and the commands it superseded. Waited commands are
+ * freed by the waiter. */
+static void
+playback_command_done (PlaybackCommand *command)
+{
+  PlaybackCommand *merged;
+
+  while (command != NULL) {
+    merged = command->merged;
+    command->merged = NULL;
+
+    if (command->barrier) {
+      g_atomic_int_add (&command->data->playback_barriers, -1);
+      command->barrier = FALSE;
+    }
+
+    /* never ran, superseded or flushed */
+    if (command->callback != NULL) {
+      playback_callback_invoke (command->data, command->callback,
+          command->queued, NULL);
+      command->callback = NULL;
+    }
+
+    if (command->wait) {
+      g_mutex_lock (command->lock);
+      command->done = TRUE;
+      g_cond_signal (command->cond);
+      g_mutex_unlock (command->lock);
+    } else {
+      playback_command_free (command);
+    }
+
+    if (merged != NULL)
+      GST_DEBUG ("completing merged command %s",
+          playback_command_names[merged->code]);
+    command = merged;
+  }
 }
 
 void
 playback_command_push (PlaybackCommandCode code,
     NPPGbpData *data, gboolean free_data, gboolean wait)
 {
-  PlaybackCommand *command = NULL;
+  playback_command_push_full (code, data, free_data, wait, NULL);
+}
+
+void
+playback_command_push_full (PlaybackCommandCode code,
+    NPPGbpData *data, gboolean free_data, gboolean wait, InvokeData *callback)
+{
+  PlaybackCommand *command;
+
   g_return_if_fail (data != NULL);
 
-  g_async_queue_lock (data->playback_queue);
-  if (!data->exiting) {
-    command = playback_command_new (code, data, free_data); 
-    command->wait = wait;
-
-    /* ref the queue, unref it in do_playback_queue so that we avoid a race
-     * between destroying a plugin instance (which unrefs ->playback_queue), and
-     * threads still running in the thread pool
-     */
-    g_async_queue_ref (data->playback_queue);
-    g_async_queue_push_sorted_unlocked (data->playback_queue,
-        command, compare_commands, NULL);
-
-#ifdef PLAYBACK_THREAD_POOL
-    if (g_atomic_int_exchange_and_add (&data->pending_commands, 1) == 0) {
-      GST_INFO_OBJECT (data->player, "no pending commands, pushing worker");
-      g_thread_pool_push (playback_thread_pool, data, NULL);
-    }
-#endif
+  command = playback_command_new (code, data, free_data, wait);
+  command->callback = callback;
+  playback_command_submit (command);
+}
+
+/* hands the instance's lane to the executor after pushing a command, or
+ * raises it to priority if it's already scheduled */
+static void
+playback_lane_schedule (NPPGbpData *data, GbpExecutorPriority priority)
+{
+  if (gbp_playback_queue_schedule (data->playback_queue)) {
+    GST_INFO_OBJECT (data->player, "no pending commands, scheduling lane");
+    gbp_executor_submit (data->playback_task, priority);
   } else {
+    /* a lane keeps the most urgent class it was raised to until it drains */
+    gbp_executor_raise (data->playback_task, priority);
+  }
+}
+
+/* queues a command made with playback_command_new () and waits for it if it
+ * was asked to */
+void
+playback_command_submit (PlaybackCommand *command)
+{
+  PlaybackCommandCode code = command->code;
+  NPPGbpData *data = command->data;
+  GbpPlaybackQueue *queue;
+  GbpExecutorPriority priority = playback_command_priorities[code];
+  gboolean wait = command->wait;
+  gboolean merged = FALSE;
+  gint slot = -1;
+  guint i;
+
+  queue = data->playback_queue;
+  if (gbp_playback_queue_is_closed (queue)) {
     GST_INFO_OBJECT (data->player, "exiting, ignoring %s",
         playback_command_names[code]);
+    if (command->callback != NULL)
+      invoke_data_free (command->callback);
+    command->callback = NULL;
+    playback_command_free (command);
+    return;
+  }
+
+  switch (code) {
+    case PLAYBACK_CMD_QUIT:
+      /* the worker drops whatever is still queued once it sees QUIT */
+      gbp_playback_queue_close (queue);
+      slot = PLAYBACK_SLOT_QUIT;
+      break;
+    case PLAYBACK_CMD_STOP:
+    case PLAYBACK_CMD_PAUSE:
+    case PLAYBACK_CMD_START:
+      /* only the last state asked for matters */
+      slot = PLAYBACK_SLOT_STATE;
+      break;
+    case PLAYBACK_CMD_SEEK:
+      slot = PLAYBACK_SLOT_SEEK;
+      break;
+    case PLAYBACK_CMD_VOLUME:
+      slot = PLAYBACK_SLOT_VOLUME;
+      break;
+    case PLAYBACK_CMD_URI:
+      slot = PLAYBACK_SLOT_URI;
+      break;
+    case PLAYBACK_CMD_BATCH:
+      for (i = 0; i < command->args.batch->len; ++i) {
+        PlaybackCommand *batched = g_ptr_array_index (command->args.batch, i);
+        priority = MIN (priority, playback_command_priorities[batched->code]);
+      }
+      break;
+    default:
+      break;
+  }
+
+  /* the lane pops the slots before the ring, so while ring commands are
+   * pending slot commands queue up behind them in order instead. Only QUIT
+   * overtakes everything. */
+  if (slot == -1) {
+    command->barrier = TRUE;
+  } else if (code != PLAYBACK_CMD_QUIT &&
+      g_atomic_int_get (&data->playback_barriers) > 0) {
+    slot = -1;
+    command->barrier = TRUE;
+  }
+
+  if (command->barrier)
+    /* before the push, the lane may complete the command right away */
+    g_atomic_int_inc (&data->playback_barriers);
+
+  if (slot != -1) {
+    merged = gbp_playback_queue_replace (queue, slot, command,
+        (gpointer *) &command->merged);
+  } else if (!gbp_playback_queue_push (queue, command)) {
+    GST_WARNING_OBJECT (data->player, "queue full, dropping %s",
+        playback_command_names[code]);
+    command->wait = FALSE;
+    playback_command_done (command);
+    return;
+  }
+
+  gbp_stats_update_max (GBP_STAT_PLAYBACK_MAX_QUEUE_DEPTH,
+      gbp_playback_queue_get_length (queue));
+
+  if (merged) {
+    GST_DEBUG_OBJECT (data->player, "%s superseded a pending command",
+        playback_command_names[code]);
+    gbp_stats_inc (GBP_STAT_PLAYBACK_COMMANDS_MERGED);
   }
-  g_async_queue_unlock (data->playback_queue);
 
-  if (command && wait) {
+  playback_lane_schedule (data, priority);
+
+  if (wait) {
     GbpPlayer *player = data->player;
     GST_INFO_OBJECT (player, "waiting for command %s to complete",
         playback_command_names[code]);
@@ -834,20 +2592,171 @@ playback_command_push (PlaybackCommandCode code,
   }
 }
 
+static void
+playback_command_record (PlaybackCommand *command)
+{
+  GstClockTime latencies[PLAYBACK_LATENCIES];
+  GstClockTime done;
+  gint i;
+
+  done = gst_util_get_timestamp ();
+  latencies[PLAYBACK_LATENCY_QUEUE] = command->dequeued - command->queued;
+  latencies[PLAYBACK_LATENCY_DISPATCH] = command->started - command->dequeued;
+  latencies[PLAYBACK_LATENCY_EXEC] = done - command->started;
+  latencies[PLAYBACK_LATENCY_TOTAL] = done - command->queued;
+
+  for (i = 0; i < PLAYBACK_LATENCIES; ++i) {
+    gbp_histogram_add (PLAYBACK_HISTOGRAM (playback_latencies,
+          command->code, i), latencies[i]);
+    gbp_histogram_add (PLAYBACK_HISTOGRAM (command->data->latencies,
+          command->code, i), latencies[i]);
+  }
+}
+
+/* a state change the watchdog is waiting for */
+typedef struct
+{
+  NPPGbpData *data;
+  GbpPlayer *player;
+  PlaybackCommandCode code;
+  /* data->state_changes when the watch was armed */
+  guint state_change;
+  /* set for the watch of a recovery, which doesn't recover again */
+  gboolean recovering;
+} StateWatch;
+
+static void
+state_watch_free (StateWatch *watch)
+{
+  g_object_unref (watch->player);
+  g_free (watch);
+}
+
+/* runs on the watchdog thread. The instance is alive, QUIT removes the watch
+ * before the instance goes away. */
+static void
+state_watch_expired (gpointer user_data)
+{
+  StateWatch *watch = (StateWatch *) user_data;
+  const char *target = playback_command_targets[watch->code];
+  PlaybackCommand *command;
+  GstState state;
+
+  if (gbp_player_get_settled_state (watch->player, &state))
+    return;
+
+  gbp_stats_inc (GBP_STAT_PLAYBACK_STUCK_STATE_CHANGES);
+  gbp_player_report_state_timeout (watch->player, target);
+
+  if (!playback_recover || watch->recovering)
+    return;
+
+  command = playback_command_new (PLAYBACK_CMD_RECOVER, watch->data,
+      FALSE, FALSE);
+  command->args.recover.code = watch->code;
+  command->args.recover.state_change = watch->state_change;
+
+  /* a state change the page asked for since wins over replaying the stuck
+   * one. The lane also drops the recovery if it has moved on. */
+  if (g_atomic_int_get (&watch->data->playback_barriers) > 0 ||
+      !gbp_playback_queue_offer (watch->data->playback_queue,
+        PLAYBACK_SLOT_STATE, command)) {
+    GST_INFO_OBJECT (watch->player, "not recovering from stuck %s, "
+        "newer commands are pending", playback_command_names[watch->code]);
+    playback_command_free (command);
+    return;
+  }
+
+  GST_WARNING_OBJECT (watch->player, "recovering from stuck %s",
+      playback_command_names[watch->code]);
+  playback_lane_schedule (watch->data,
+      playback_command_priorities[PLAYBACK_CMD_RECOVER]);
+}
+
+/* replaces the instance's watch, only called on its lane */
+static void
+arm_state_watch (NPPGbpData *data, PlaybackCommandCode code,
+    gboolean recovering)
+{
+  StateWatch *watch;
+
+  gbp_watchdog_remove (data->state_watch);
+  data->state_watch = 0;
+
+  if (!recovering)
+    data->state_changes += 1;
+
+  if (playback_state_timeout == 0 || code == PLAYBACK_CMD_QUIT)
+    return;
+
+  watch = g_new (StateWatch, 1);
+  watch->data = data;
+  watch->player = g_object_ref (data->player);
+  watch->code = code;
+  watch->state_change = data->state_changes;
+  watch->recovering = recovering;
+  data->state_watch = gbp_watchdog_add (playback_state_timeout * GST_MSECOND,
+      state_watch_expired, watch, (GDestroyNotify) state_watch_free);
+}
+
+static gboolean do_playback_command (PlaybackCommand *command);
+
+/* runs the commands of an exec () call back to back. res is FALSE if any of
+ * them failed. */
+static gboolean
+do_playback_batch (PlaybackCommand *command, gboolean *res)
+{
+  GPtrArray *batch = command->args.batch;
+  PlaybackCommand *batched;
+  gboolean exit = FALSE;
+  guint i;
+
+  command->args.batch = NULL;
+
+  for (i = 0; i < batch->len; ++i) {
+    batched = (PlaybackCommand *) g_ptr_array_index (batch, i);
+    batched->dequeued = command->dequeued;
+    if (!exit) {
+      exit = do_playback_command (batched);
+      *res = *res && batched->result;
+    }
+    playback_command_free (batched);
+  }
+  g_ptr_array_free (batch, TRUE);
+
+  return exit;
+}
+
 static gboolean
 do_playback_command (PlaybackCommand *command)
 {
   GbpPlayer *player;
   gboolean exit = FALSE;  
+  const char *target = NULL;
+  GstState state;
+  gboolean res = TRUE;
 
   if (command->player)
     player = command->player;
   else
     player = NULL;
 
+  command->started = gst_util_get_timestamp ();
   GST_DEBUG_OBJECT (player, "pool worker %p processing command %s",
       g_thread_self(), playback_command_names[command->code]);
 
+  if (command->code <= PLAYBACK_CMD_QUIT) {
+    /* a new state change supersedes the ones still in progress */
+    complete_state_waiters (command->data, NULL, NULL);
+
+    target = playback_command_targets[command->code];
+    if (command->callback != NULL && target != NULL)
+      add_state_waiter (command->data, command, target);
+
+    /* armed before the change so that a blocking one is reported too */
+    arm_state_watch (command->data, command->code, FALSE);
+  }
+
   switch (command->code) {
     case PLAYBACK_CMD_STOP:
       gbp_player_stop (player);
@@ -866,112 +2775,133 @@ do_playback_command (PlaybackCommand *command)
       exit = TRUE;
       break;
 
-    default:
-      g_warn_if_reached ();
-  }
-  GST_DEBUG_OBJECT (player, "pool worker %p processed command %s",
-      g_thread_self(), playback_command_names[command->code]);
+    case PLAYBACK_CMD_PRELOAD:
+      gbp_player_preload (player);
+      break;
 
-  /* signal in case someone is waiting */
-  g_mutex_lock (command->lock);
-  command->done = TRUE;
-  g_cond_signal (command->cond);
-  g_mutex_unlock (command->lock);
+    case PLAYBACK_CMD_PRELOADED:
+      gbp_player_finish_preload (player);
+      break;
 
-  return exit;
-}
+    case PLAYBACK_CMD_SEEK:
+      res = gbp_player_seek (player, command->args.seek.position,
+          command->args.seek.rate);
+      break;
 
-static gboolean
-do_playback_queue (NPPGbpData *data, GAsyncQueue *queue)
-{
-  PlaybackCommand *command, *flushed_command;
-  gboolean exit = FALSE;
-  gboolean free_data = FALSE;
-  GTimeVal timeout;
-
-  while (exit == FALSE) {
-    g_get_current_time (&timeout);
-    g_time_val_add (&timeout, G_USEC_PER_SEC / 5);
-    command = g_async_queue_timed_pop (queue, &timeout);
-    if (command == NULL)
+    case PLAYBACK_CMD_STEP:
+      res = gbp_player_step_frames (player, command->args.frames);
       break;
 
-    free_data = !command->wait;
-    exit = do_playback_command (command);
+    case PLAYBACK_CMD_VOLUME:
+      g_object_set (player, "volume", command->args.volume, NULL);
+      break;
 
-    g_async_queue_lock (queue);
-    if (exit) {
-#ifdef PLAYBACK_THREAD_POOL
-      data->exiting = TRUE;
-#endif
-      while (g_async_queue_length_unlocked (queue)) {
-        flushed_command = g_async_queue_pop_unlocked (queue);
-        g_async_queue_unref (queue);
-        playback_command_free (flushed_command);
+    case PLAYBACK_CMD_URI:
+      g_object_set (player, "uri", command->args.uri, NULL);
+      break;
+
+    case PLAYBACK_CMD_TRACK:
+      if (command->args.track.index == PLAYBACK_TRACK_CURRENT)
+        gbp_player_apply_tracks (player);
+      else
+        res = gbp_player_set_current_track (player, command->args.track.type,
+            command->args.track.index);
+      break;
+
+    case PLAYBACK_CMD_AUDIO:
+      g_object_set (player, "have_audio", command->args.have_audio, NULL);
+      break;
+
+    case PLAYBACK_CMD_RECOVER:
+      if (command->args.recover.state_change != command->data->state_changes) {
+        GST_INFO_OBJECT (player, "state changed since, not recovering");
+        break;
       }
-    }
 
-#ifdef PLAYBACK_THREAD_POOL
-    if (g_atomic_int_dec_and_test (&data->pending_commands))
-      ;
-#endif
+      gbp_player_rebuild (player);
+      arm_state_watch (command->data, command->args.recover.code, TRUE);
+      switch (command->args.recover.code) {
+        case PLAYBACK_CMD_STOP:
+          gbp_player_stop (player);
+          break;
+        case PLAYBACK_CMD_PAUSE:
+          gbp_player_pause (player);
+          break;
+        default:
+          gbp_player_start (player);
+      }
+      /* the waiters of the stuck command are still pending */
+      target = playback_command_targets[command->args.recover.code];
+      break;
 
-    g_async_queue_unlock (queue);
-    /* we ref the queue for each queued command, see playback_command_push  */
-    g_async_queue_unref (queue);
-    if (free_data)
-      playback_command_free (command);
+    case PLAYBACK_CMD_BATCH:
+      exit = do_playback_batch (command, &res);
+      break;
+
+    default:
+      g_warn_if_reached ();
+  }
+
+  command->result = res;
+  if (command->callback != NULL && target == NULL) {
+    playback_callback_invoke_result (command->data, command->callback,
+        command->queued, res);
+    command->callback = NULL;
   }
+  GST_DEBUG_OBJECT (player, "pool worker %p processed command %s",
+      g_thread_self(), playback_command_names[command->code]);
+  playback_command_record (command);
+
+  /* no state change message comes if the player was already there */
+  if (target != NULL && gbp_player_get_settled_state (player, &state))
+    complete_state_waiters (command->data, settled_state_name (state),
+        settled_state_name (state));
 
   return exit;
 }
 
-#ifndef PLAYBACK_THREAD_POOL
-static gpointer
-playback_thread_func (gpointer data)
+/* runs a batch of commands of one instance. Returns TRUE to be requeued
+ * behind the other lanes, FALSE once the queue is empty or after QUIT. After
+ * QUIT the instance may be freed as soon as the command completes, so only
+ * the queue may be touched, the task owns a ref to it. */
+static gboolean
+run_playback_lane (gpointer data)
 {
-  GAsyncQueue *queue = (GAsyncQueue *) data;
-
-  /* loop over the queue forever */
-  do_playback_queue (NULL, queue);
+  GbpPlaybackQueue *queue = (GbpPlaybackQueue *) data;
+  PlaybackCommand *command, *flushed_command;
+  gboolean exit = FALSE;
+  guint processed = 0;
 
-  g_async_queue_push (joinable_threads, g_thread_self ());
+  gbp_stats_inc (GBP_STAT_PLAYBACK_WAKEUPS);
 
-  return NULL;
-}
-#else
-static void
-playback_thread_pool_func (gpointer push_data, gpointer pull_data)
-{
-  NPPGbpData *data = (NPPGbpData *) push_data;
-  GbpPlayer *player = NULL;
+  while (processed < playback_lane_batch) {
+    command = (PlaybackCommand *) gbp_playback_queue_pop (queue);
+    if (command == NULL) {
+      /* woken up for nothing, should stay at 0 on an idle page */
+      if (processed == 0)
+        gbp_stats_inc (GBP_STAT_PLAYBACK_IDLE_WAKEUPS);
 
-  if (data->player != NULL)
-    player = data->player;
+      if (gbp_playback_queue_unschedule (queue))
+        continue;
 
-  GST_DEBUG_OBJECT (player, "pool worker %p starting on player %p",
-      g_thread_self (), player);
+      return FALSE;
+    }
 
-  do_playback_queue (data, data->playback_queue);
+    processed += 1;
+    command->dequeued = gst_util_get_timestamp ();
+    exit = do_playback_command (command);
 
-  GST_DEBUG_OBJECT (player, "pool worker %p done on player %p",
-      g_thread_self (), player);
-}
-#endif
+    if (exit) {
+      while ((flushed_command = gbp_playback_queue_pop (queue)))
+        playback_command_done (flushed_command);
+    }
 
-static gint
-compare_commands(gconstpointer a, gconstpointer b, gpointer user_data)
-{
-  gint res;
-  PlaybackCommand *cmd1 = (PlaybackCommand *) a;
-  PlaybackCommand *cmd2 = (PlaybackCommand *) b;
+    playback_command_done (command);
 
-  if (cmd1->code == PLAYBACK_CMD_QUIT)
-    res = -1;
-  else if (cmd2->code == PLAYBACK_CMD_QUIT)
-    res = 1;
-  else
-    res = 0;
+    if (exit)
+      return FALSE;
+  }
 
-  return res;
+  /* give the other instances a chance, the lane stays scheduled */
+  return TRUE;
 }
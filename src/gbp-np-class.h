@@ -37,16 +37,23 @@ typedef struct _GbpNPObject
 {
   NPObject object;
   NPP instance;
-
-  GThread *playback_thread;
 } GbpNPObject;
 
 extern GbpNPClass gbp_np_class;
 
 void gbp_np_class_init ();
 void gbp_np_class_free ();
-void gbp_np_class_start_object_playback_thread(NPPGbpData *data);
-void gbp_np_class_stop_object_playback_thread(NPPGbpData *data);
+GbpPlaybackQueue *gbp_np_class_new_playback_queue ();
+GbpExecutorTask *gbp_np_class_new_playback_task (GbpPlaybackQueue *queue);
+GbpHistogram *gbp_np_class_new_latency_histograms ();
+GstClockTime gbp_np_class_get_state_timeout ();
+void gbp_np_class_reap_object (NPPGbpData *data);
+void gbp_np_class_preload_object (NPPGbpData *data);
+void gbp_np_class_finish_object_preload (NPPGbpData *data);
+void gbp_np_class_apply_object_tracks (NPPGbpData *data);
+void gbp_np_class_cancel_object_probes (NPPGbpData *data);
+void gbp_np_class_object_state_changed (NPPGbpData *data, const char *state);
+void gbp_np_class_cancel_object_state_waiters (NPPGbpData *data);
 
 G_END_DECLS
 
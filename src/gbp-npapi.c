@@ -24,6 +24,7 @@
 #include "gbp-npapi.h"
 #include "gbp-plugin.h"
 #include "gbp-np-class.h"
+#include "gbp-stats.h"
 #include <string.h>
 #ifdef XP_MACOSX
 #include <CoreFoundation/CoreFoundation.h>
@@ -35,24 +36,31 @@
 #include <libgen.h>
 #endif
 
-typedef struct _InvokeData {
-  NPP instance;
-  NPObject *object;
-  NPVariant *args;
-  int n_args;
-} InvokeData;
-
 typedef struct _StateClosure {
-  NPP instance;
+  NPPGbpData *data;
   const char *state;
 } StateClosure;
 
+typedef struct _RangeRequest {
+  NPP instance;
+  guint64 offset;
+  guint length;
+} RangeRequest;
+
 
-void invoke_data_free (InvokeData *invoke_data,
-    gboolean remove_from_pending_slist);
 void on_error_cb (GbpPlayer *player, GError *error, const char *debug,
     gpointer user_data);
 void on_state_cb (GbpPlayer *player, gpointer user_data);
+void on_time_update_cb (GbpPlayer *player, GstClockTime position,
+    gpointer user_data);
+void on_tracks_changed_cb (GbpPlayer *player, gpointer user_data);
+void on_preloaded_cb (GbpPlayer *player, gpointer user_data);
+void on_need_stream_cb (GbpPlayer *player, gpointer user_data);
+void on_need_range_cb (GbpPlayer *player, guint64 offset, guint length,
+    gpointer user_data);
+static void request_stream_cb (void *user_data);
+static StateClosure *state_closure_new (NPPGbpData *data, const char *state);
+static void state_closure_free (gpointer user_data, GClosure *closure);
 
 NPError NP_GetValue (NPP instance, NPPVariable variable, void *ret_value);
 NPError NP_SetValue (NPP instance, NPNVariable variable, void *ret_value);
@@ -64,8 +72,15 @@ void attach_nsview_to_window (NSView *clippingView, NPWindow *npwindow,
 
 NPNetscapeFuncs NPNFuncs;
 
-GStaticMutex pending_invoke_data_lock = G_STATIC_MUTEX_INIT;
-static GSList *pending_invoke_data;
+/* freed InvokeData, recycled by invoke_data_new () */
+static GStaticMutex invoke_data_pool_lock = G_STATIC_MUTEX_INIT;
+static GTrashStack *invoke_data_pool;
+
+/* instances between NPP_New and NPP_Destroy. Their data outlives them until
+ * the playback lane is done tearing the player down, so callbacks running on
+ * the browser thread check here before touching an instance. */
+static GStaticMutex live_instances_lock = G_STATIC_MUTEX_INIT;
+static GHashTable *live_instances;
 
 /* NPP vtable symbols */
 NPError
@@ -75,9 +90,14 @@ NPP_New (NPMIMEType plugin_type, NPP instance, uint16_t mode,
   GbpPlayer *player;
   NPPGbpData *pdata;
   char *uri = NULL;
+  gboolean stream_mode = FALSE;
+  gboolean cache = FALSE;
+  char *cache_validator = NULL;
+  char *preload = NULL;
+  char *abr = NULL;
+  guint time_update_interval = 0;
   guint width = 0, height = 0;
   int i;
-  StateClosure *state1, *state2, *state3, *state4;
 #ifdef XP_MACOSX
   NSRect r;
   NPError err;
@@ -93,6 +113,18 @@ NPP_New (NPMIMEType plugin_type, NPP instance, uint16_t mode,
       width = atoi (argv[i]);
     else if (!strcmp (argn[i], "height"))
       height = atoi (argv[i]);
+    else if (!strcmp (argn[i], "x-gbp-stream"))
+      stream_mode = !strcmp (argv[i], "true") || !strcmp (argv[i], "1");
+    else if (!strcmp (argn[i], "x-gbp-cache"))
+      cache = !strcmp (argv[i], "true") || !strcmp (argv[i], "1");
+    else if (!strcmp (argn[i], "x-gbp-cache-validator"))
+      cache_validator = argv[i];
+    else if (!strcmp (argn[i], "x-gbp-preload"))
+      preload = argv[i];
+    else if (!strcmp (argn[i], "x-gbp-abr"))
+      abr = argv[i];
+    else if (!strcmp (argn[i], "x-gbp-timeupdate"))
+      time_update_interval = atoi (argv[i]);
   }
 
   if (uri == NULL || width == 0 || height == 0)
@@ -103,54 +135,90 @@ NPP_New (NPMIMEType plugin_type, NPP instance, uint16_t mode,
     return NPERR_OUT_OF_MEMORY_ERROR;
 
   g_object_set (G_OBJECT (player), "width", width, "height", height,
-      "uri", uri, NULL);
-
-  pdata = (NPPGbpData *) NPN_MemAlloc (sizeof (NPPGbpData));
+      "uri", uri, "stream-mode", stream_mode, "cache", cache,
+      "cache-validator", cache_validator, NULL);
+  if (preload != NULL)
+    g_object_set (G_OBJECT (player), "preload", preload, NULL);
+  if (abr != NULL)
+    g_object_set (G_OBJECT (player), "abr", abr, NULL);
+  g_object_set (G_OBJECT (player), "state-timeout",
+      gbp_np_class_get_state_timeout (), NULL);
+  g_object_set (G_OBJECT (player), "time-update-interval",
+      (guint64) time_update_interval * GST_MSECOND, NULL);
+
+  /* the instance's ref is dropped by the playback lane, not necessarily on
+   * the browser thread */
+  pdata = g_new0 (NPPGbpData, 1);
+  pdata->refcount = 1;
+  pdata->instance = instance;
+  pdata->live_lock = g_mutex_new ();
+  pdata->live = TRUE;
   pdata->player = player;
   pdata->errorHandler = NULL;
   pdata->stateHandler = NULL;
+  pdata->timeUpdateHandler = NULL;
   pdata->state = g_strdup ("STOPPED");
-  pdata->playback_queue = g_async_queue_new ();
-#ifdef PLAYBACK_THREAD_POOL
-  pdata->pending_commands = 0;
-#endif
-  pdata->exiting = FALSE;
-
-#ifndef PLAYBACK_THREAD_POOL
-  gbp_np_class_start_object_playback_thread (pdata);
-#endif
+  pdata->uri = g_strdup (uri);
+  g_object_get (player, "volume", &pdata->volume,
+      "have_audio", &pdata->have_audio, NULL);
+  pdata->playback_queue = gbp_np_class_new_playback_queue ();
+  pdata->playback_task =
+      gbp_np_class_new_playback_task (pdata->playback_queue);
+  pdata->latencies = gbp_np_class_new_latency_histograms ();
+  pdata->state_watch = 0;
+  pdata->state_changes = 0;
+  pdata->playback_barriers = 0;
+  pdata->stream = NULL;
+  pdata->stream_seekable = FALSE;
+  pdata->stream_started = FALSE;
+  pdata->probe_batches = NULL;
+  pdata->state_waiters_lock = g_mutex_new ();
+  pdata->state_waiters = NULL;
+  pdata->events_lock = g_mutex_new ();
 
   pdata->user_agent = NPN_UserAgent(instance);
 
-  g_object_connect (G_OBJECT (player), "signal::error",
-      G_CALLBACK (on_error_cb), instance, NULL);
-
-  state1 = g_new (StateClosure, 1);
-  state2 = g_new (StateClosure, 1);
-  state3 = g_new (StateClosure, 1);
-  state4 = g_new (StateClosure, 1);
-
-  state1->instance = instance;
-  state2->instance = instance;
-  state3->instance = instance;
-  state4->instance = instance;
-
-  state1->state = "PLAYING";
-  state2->state = "PAUSED";
-  state3->state = "STOPPED";
-  state4->state = "EOS";
-
-  g_signal_connect_data (player, "playing",
-      G_CALLBACK(on_state_cb), state1, (GClosureNotify) g_free, 0);
-  g_signal_connect_data (player, "paused",
-      G_CALLBACK(on_state_cb), state2, (GClosureNotify) g_free, 0);
-  g_signal_connect_data (player, "stopped",
-      G_CALLBACK(on_state_cb), state3, (GClosureNotify) g_free, 0);
-  g_signal_connect_data (player, "eos",
-      G_CALLBACK(on_state_cb), state4, (GClosureNotify) g_free, 0);
+  /* each handler keeps data alive until it's disconnected and done */
+  g_signal_connect_data (player, "error", G_CALLBACK (on_error_cb),
+      npp_gbp_data_ref (pdata), (GClosureNotify) npp_gbp_data_unref, 0);
+  g_signal_connect_data (player, "need-stream", G_CALLBACK (on_need_stream_cb),
+      npp_gbp_data_ref (pdata), (GClosureNotify) npp_gbp_data_unref, 0);
+  g_signal_connect_data (player, "need-range", G_CALLBACK (on_need_range_cb),
+      npp_gbp_data_ref (pdata), (GClosureNotify) npp_gbp_data_unref, 0);
+  g_signal_connect_data (player, "timeupdate", G_CALLBACK (on_time_update_cb),
+      npp_gbp_data_ref (pdata), (GClosureNotify) npp_gbp_data_unref, 0);
+  g_signal_connect_data (player, "tracks-changed",
+      G_CALLBACK (on_tracks_changed_cb), npp_gbp_data_ref (pdata),
+      (GClosureNotify) npp_gbp_data_unref, 0);
+  g_signal_connect_data (player, "preloaded", G_CALLBACK (on_preloaded_cb),
+      npp_gbp_data_ref (pdata), (GClosureNotify) npp_gbp_data_unref, 0);
+
+  g_signal_connect_data (player, "playing", G_CALLBACK (on_state_cb),
+      state_closure_new (pdata, "PLAYING"), state_closure_free, 0);
+  g_signal_connect_data (player, "paused", G_CALLBACK (on_state_cb),
+      state_closure_new (pdata, "PAUSED"), state_closure_free, 0);
+  g_signal_connect_data (player, "stopped", G_CALLBACK (on_state_cb),
+      state_closure_new (pdata, "STOPPED"), state_closure_free, 0);
+  g_signal_connect_data (player, "eos", G_CALLBACK (on_state_cb),
+      state_closure_new (pdata, "EOS"), state_closure_free, 0);
 
   instance->pdata = pdata;
 
+  g_static_mutex_lock (&live_instances_lock);
+  if (live_instances == NULL)
+    live_instances = g_hash_table_new (NULL, NULL);
+  g_hash_table_insert (live_instances, instance, pdata);
+  g_static_mutex_unlock (&live_instances_lock);
+
+  /* open the stream right away so that we know whether it's seekable by the
+   * time the pipeline creates its source. No data flows until the source
+   * exists: NPP_WriteReady returns 0 and NP_SEEK streams wait for
+   * NPN_RequestRead. */
+  if (stream_mode)
+    request_stream_cb (instance);
+
+  gbp_np_class_preload_object (pdata);
+
 #ifdef XP_MACOSX
   NPBool supportsCoreGraphics = FALSE;
   NPBool supportsCoreAnimation = FALSE;
@@ -213,6 +281,18 @@ NPP_Destroy (NPP instance, NPSavedData **saved_data)
 
   NPPGbpData *data = (NPPGbpData *) instance->pdata;
 
+  g_static_mutex_lock (&live_instances_lock);
+  g_hash_table_remove (live_instances, instance);
+  g_static_mutex_unlock (&live_instances_lock);
+
+  /* waits for the signal handlers that are still using the instance, the
+   * ones that run after this don't touch it */
+  g_mutex_lock (data->live_lock);
+  data->live = FALSE;
+  /* callbacks of commands still queued on the lane */
+  invoke_data_cancel_all (data);
+  g_mutex_unlock (data->live_lock);
+
 #ifdef XP_MACOSX
   if (data->drawing_model == CORE_ANIMATION)
     [data->layer release];
@@ -226,11 +306,49 @@ NPP_Destroy (NPP instance, NPSavedData **saved_data)
   g_signal_handlers_disconnect_matched (data->player, G_SIGNAL_MATCH_FUNC,
       0 /* sigid */, 0 /* detail */, NULL /* closure */,
       G_CALLBACK (on_error_cb), NULL /* data */);
+  g_signal_handlers_disconnect_matched (data->player, G_SIGNAL_MATCH_FUNC,
+      0 /* sigid */, 0 /* detail */, NULL /* closure */,
+      G_CALLBACK (on_need_stream_cb), NULL /* data */);
+  g_signal_handlers_disconnect_matched (data->player, G_SIGNAL_MATCH_FUNC,
+      0 /* sigid */, 0 /* detail */, NULL /* closure */,
+      G_CALLBACK (on_need_range_cb), NULL /* data */);
+  g_signal_handlers_disconnect_matched (data->player, G_SIGNAL_MATCH_FUNC,
+      0 /* sigid */, 0 /* detail */, NULL /* closure */,
+      G_CALLBACK (on_time_update_cb), NULL /* data */);
+  g_signal_handlers_disconnect_matched (data->player, G_SIGNAL_MATCH_FUNC,
+      0 /* sigid */, 0 /* detail */, NULL /* closure */,
+      G_CALLBACK (on_tracks_changed_cb), NULL /* data */);
+  g_signal_handlers_disconnect_matched (data->player, G_SIGNAL_MATCH_FUNC,
+      0 /* sigid */, 0 /* detail */, NULL /* closure */,
+      G_CALLBACK (on_preloaded_cb), NULL /* data */);
+
+  if (data->stream != NULL) {
+    NPN_DestroyStream (instance, data->stream, NPRES_USER_BREAK);
+    data->stream = NULL;
+  }
+
+  gbp_np_class_cancel_object_probes (data);
+
+  /* js objects can only be released on this thread */
+  if (data->errorHandler != NULL)
+    NPN_ReleaseObject (data->errorHandler);
+  data->errorHandler = NULL;
+
+  if (data->stateHandler != NULL)
+    NPN_ReleaseObject (data->stateHandler);
+  data->stateHandler = NULL;
+
+  if (data->timeUpdateHandler != NULL)
+    NPN_ReleaseObject (data->timeUpdateHandler);
+  data->timeUpdateHandler = NULL;
+
+  gbp_np_class_cancel_object_state_waiters (data);
 
   GST_INFO_OBJECT (data->player, "destroying player");
 
-  gbp_np_class_stop_object_playback_thread (data);
-  npp_gbp_data_free (data);
+  /* the player goes to NULL and data is freed in the background */
+  gbp_np_class_reap_object (data);
+  instance->pdata = NULL;
 
   return NPERR_NO_ERROR;
 }
@@ -243,6 +361,10 @@ NPP_SetWindow (NPP instance, NPWindow *window)
 
   NPPGbpData *data = (NPPGbpData *) instance->pdata;
 
+  if (window->width != 0 && window->height != 0)
+    g_object_set (data->player, "width", (guint) window->width,
+        "height", (guint) window->height, NULL);
+
 #ifdef XP_MACOSX
   if (data->drawing_model != CORE_ANIMATION)
     attach_nsview_to_window (data->clippingView, window, data->user_agent,
@@ -330,25 +452,87 @@ NPError
 NPP_NewStream (NPP instance, NPMIMEType type,
     NPStream* stream, NPBool seekable, uint16_t* stype)
 {
-  return NPERR_GENERIC_ERROR;
+  gboolean stream_mode;
+  gboolean stream_seekable;
+
+  if (!instance)
+    return NPERR_INVALID_INSTANCE_ERROR;
+
+  NPPGbpData *data = (NPPGbpData *) instance->pdata;
+
+  g_object_get (data->player, "stream-mode", &stream_mode, NULL);
+  if (!stream_mode)
+    return NPERR_GENERIC_ERROR;
+
+  /* a new stream is requested every time the pipeline creates its source, so
+   * whatever we were reading before is stale */
+  if (data->stream != NULL && data->stream != stream)
+    NPN_DestroyStream (instance, data->stream, NPRES_USER_BREAK);
+
+  data->stream = stream;
+  g_object_set (data->player, "stream-size",
+      stream->end ? (gint64) stream->end : (gint64) -1,
+      "stream-seekable", seekable && stream->end != 0, NULL);
+
+  /* the player keeps a running sequential source sequential, go with what it
+   * settled on */
+  g_object_get (data->player, "stream-seekable", &stream_seekable, NULL);
+  data->stream_seekable = stream_seekable;
+  data->stream_started = FALSE;
+
+  GST_INFO_OBJECT (data->player, "new %s stream %s, %u bytes",
+      stream_seekable ? "seekable" : "sequential", stream->url, stream->end);
+
+  *stype = stream_seekable ? NP_SEEK : NP_NORMAL;
+
+  return NPERR_NO_ERROR;
 }
 
 NPError NPP_DestroyStream (NPP instance, NPStream* stream, NPReason reason)
 {
-  return NPERR_GENERIC_ERROR;
+  if (!instance)
+    return NPERR_INVALID_INSTANCE_ERROR;
+
+  NPPGbpData *data = (NPPGbpData *) instance->pdata;
+
+  if (stream != data->stream)
+    return NPERR_NO_ERROR;
+
+  GST_INFO_OBJECT (data->player, "stream %s destroyed, reason %d",
+      stream->url, reason);
+
+  if (reason == NPRES_DONE)
+    gbp_player_stream_end (data->player);
+  data->stream = NULL;
+
+  return NPERR_NO_ERROR;
 }
 
 int32_t
 NPP_WriteReady (NPP instance, NPStream* stream)
 {
-  return G_MAXINT32;
+  NPPGbpData *data = (NPPGbpData *) instance->pdata;
+
+  /* swallow anything we didn't ask for */
+  if (stream != data->stream)
+    return G_MAXINT32;
+
+  return gbp_player_stream_write_ready (data->player);
 }
 
 int32_t
 NPP_Write (NPP instance, NPStream* stream,
     int32_t offset, int32_t len, void* buffer)
 {
-  return len;
+  NPPGbpData *data = (NPPGbpData *) instance->pdata;
+
+  if (stream != data->stream)
+    return len;
+
+  data->stream_started = TRUE;
+
+  return gbp_player_stream_write (data->player, offset,
+      (const guint8 *) buffer, len);
 }
 
 void
@@ -527,18 +711,22 @@ NP_GetEntryPoints (NPPluginFuncs *plugin_vtable)
 NPError
 NP_Shutdown ()
 {
-  GSList *walk;
+  InvokeData *invoke_data;
 
   GST_INFO ("shutdown");
 
   gbp_np_class_free ();
 
-  g_static_mutex_lock (&pending_invoke_data_lock);
-  for (walk = pending_invoke_data; walk != NULL; walk = walk->next)
-    invoke_data_free ((InvokeData *) walk->data, FALSE);
-  g_slist_free (pending_invoke_data);
-  pending_invoke_data = NULL;
-  g_static_mutex_unlock (&pending_invoke_data_lock);
+  g_static_mutex_lock (&invoke_data_pool_lock);
+  while ((invoke_data = g_trash_stack_pop (&invoke_data_pool)) != NULL)
+    g_free (invoke_data);
+  g_static_mutex_unlock (&invoke_data_pool_lock);
+
+  g_static_mutex_lock (&live_instances_lock);
+  if (live_instances != NULL)
+    g_hash_table_destroy (live_instances);
+  live_instances = NULL;
+  g_static_mutex_unlock (&live_instances_lock);
 
   return NPERR_NO_ERROR;
 }
@@ -586,70 +774,359 @@ NPError NP_SetValue (NPP instance, NPNVariable variable, void *ret_value)
   return NPERR_GENERIC_ERROR;
 }
 
+static void
+invoke_data_link (InvokeData **list, InvokeData *invoke_data)
+{
+  invoke_data->prev = NULL;
+  invoke_data->next = *list;
+  if (*list != NULL)
+    (*list)->prev = invoke_data;
+  *list = invoke_data;
+}
+
+static void
+invoke_data_unlink (InvokeData **list, InvokeData *invoke_data)
+{
+  if (invoke_data->prev != NULL)
+    invoke_data->prev->next = invoke_data->next;
+  else
+    *list = invoke_data->next;
+  if (invoke_data->next != NULL)
+    invoke_data->next->prev = invoke_data->prev;
+  invoke_data->prev = invoke_data->next = NULL;
+}
+
+/* called on the browser thread */
 InvokeData *
 invoke_data_new (NPP instance, NPObject *object, int n_args)
 {
-  InvokeData *invoke_data = (InvokeData *) NPN_MemAlloc (sizeof (InvokeData));
+  NPPGbpData *data = (NPPGbpData *) instance->pdata;
+  InvokeData *invoke_data;
+  int i;
+
+  g_return_val_if_fail (n_args <= INVOKE_DATA_MAX_ARGS, NULL);
+
+  g_static_mutex_lock (&invoke_data_pool_lock);
+  invoke_data = (InvokeData *) g_trash_stack_pop (&invoke_data_pool);
+  g_static_mutex_unlock (&invoke_data_pool_lock);
+  if (invoke_data == NULL)
+    invoke_data = g_new (InvokeData, 1);
 
   invoke_data->instance = instance;
   invoke_data->object = NPN_RetainObject (object);
-  invoke_data->args = NPN_MemAlloc (sizeof (NPVariant) * n_args);
   invoke_data->n_args = n_args;
+  for (i = 0; i < n_args; ++i)
+    VOID_TO_NPVARIANT (invoke_data->args[i]);
+  invoke_data->ready_next = NULL;
 
-  g_static_mutex_lock (&pending_invoke_data_lock);
-  pending_invoke_data = g_slist_append (pending_invoke_data, invoke_data);
-  g_static_mutex_unlock (&pending_invoke_data_lock);
+  invoke_data_link (&data->pending_invoke_data, invoke_data);
 
   return invoke_data;
 }
 
+/* called on the browser thread, once invoke_data is off the ready list */
 void
-invoke_data_free (InvokeData *invoke_data, gboolean remove_from_pending_slist)
+invoke_data_free (InvokeData *invoke_data)
 {
-  int i;
+  NPPGbpData *data = (NPPGbpData *) invoke_data->instance->pdata;
+
+  invoke_data_unlink (&data->pending_invoke_data, invoke_data);
+  NPN_ReleaseObject (invoke_data->object);
+  invoke_data->object = NULL;
+
+  g_static_mutex_lock (&invoke_data_pool_lock);
+  g_trash_stack_push (&invoke_data_pool, invoke_data);
+  g_static_mutex_unlock (&invoke_data_pool_lock);
+}
+
+/* called by NPP_Destroy with live_lock held. Frees every call, posted or not.
+ * The lane forgets the ones it still holds once it finds the instance gone,
+ * and a flush that's still scheduled finds nothing to run. */
+void
+invoke_data_cancel_all (NPPGbpData *data)
+{
+  data->ready_invoke_data = NULL;
+  data->ready_invoke_data_tail = NULL;
+
+  while (data->pending_invoke_data != NULL)
+    invoke_data_free (data->pending_invoke_data);
+}
+
+/* only for callbacks running on the browser thread, where instances are
+ * destroyed */
+gboolean
+npp_instance_is_live (NPP instance)
+{
+  gboolean live;
+
+  g_static_mutex_lock (&live_instances_lock);
+  live = live_instances != NULL &&
+      g_hash_table_lookup (live_instances, instance) != NULL;
+  g_static_mutex_unlock (&live_instances_lock);
 
-  /* FIXME: This calls PR_Free (jemalloc) and segfaults. Odd since
-   * NPN_MemAlloc does call PR_Malloc. Weird. */
+  return live;
+}
 
-  for (i = 0; i < invoke_data->n_args; ++i ) {
-    NPN_ReleaseVariantValue (&invoke_data->args[i]);
+/* for the threads other than the browser's. Returns TRUE with the instance
+ * kept alive until npp_gbp_data_unlock (), or FALSE if it's been destroyed.
+ * The caller must hold a ref to data. */
+gboolean
+npp_gbp_data_lock (NPPGbpData *data)
+{
+  g_mutex_lock (data->live_lock);
+  if (!data->live) {
+    g_mutex_unlock (data->live_lock);
+    return FALSE;
   }
 
-  NPN_ReleaseObject (invoke_data->object);
+  return TRUE;
+}
 
-  NPN_MemFree (invoke_data->args);
+void
+npp_gbp_data_unlock (NPPGbpData *data)
+{
+  g_mutex_unlock (data->live_lock);
+}
+
+static StateClosure *
+state_closure_new (NPPGbpData *data, const char *state)
+{
+  StateClosure *state_closure = g_new (StateClosure, 1);
+
+  state_closure->data = npp_gbp_data_ref (data);
+  state_closure->state = state;
+
+  return state_closure;
+}
+
+static void
+state_closure_free (gpointer user_data, GClosure *closure)
+{
+  StateClosure *state_closure = (StateClosure *) user_data;
+
+  npp_gbp_data_unref (state_closure->data);
+  g_free (state_closure);
+}
 
-  if (remove_from_pending_slist) {
-    g_static_mutex_lock (&pending_invoke_data_lock);
-    pending_invoke_data = g_slist_remove (pending_invoke_data, invoke_data);
-    g_static_mutex_unlock (&pending_invoke_data_lock);
+static void
+flush_invoke_data_cb (void *user_data)
+{
+  NPP instance = (NPP) user_data;
+  NPPGbpData *data;
+  InvokeData *invoke_data;
+  NPVariant result;
+
+  if (!npp_instance_is_live (instance))
+    return;
+
+  data = (NPPGbpData *) instance->pdata;
+
+  g_mutex_lock (data->live_lock);
+  data->invoke_data_scheduled = FALSE;
+  g_mutex_unlock (data->live_lock);
+
+  /* a function may remove the plugin, which frees the rest */
+  while (npp_instance_is_live (instance)) {
+    g_mutex_lock (data->live_lock);
+    invoke_data = data->ready_invoke_data;
+    if (invoke_data != NULL) {
+      data->ready_invoke_data = invoke_data->ready_next;
+      if (data->ready_invoke_data == NULL)
+        data->ready_invoke_data_tail = NULL;
+      invoke_data->ready_next = NULL;
+      /* taken off the pending list so that NPP_Destroy won't free it under
+       * the call */
+      invoke_data_unlink (&data->pending_invoke_data, invoke_data);
+    }
+    g_mutex_unlock (data->live_lock);
+
+    if (invoke_data == NULL)
+      break;
+
+    /* just ignore the return value for now */
+    if (NPN_InvokeDefault (instance, invoke_data->object,
+          invoke_data->args, invoke_data->n_args, &result))
+      NPN_ReleaseVariantValue (&result);
+
+    NPN_ReleaseObject (invoke_data->object);
+    invoke_data->object = NULL;
+
+    g_static_mutex_lock (&invoke_data_pool_lock);
+    g_trash_stack_push (&invoke_data_pool, invoke_data);
+    g_static_mutex_unlock (&invoke_data_pool_lock);
   }
+}
 
-  NPN_MemFree (invoke_data);
+/* called with the instance locked, see npp_gbp_data_lock (). invoke_data
+ * belongs to the instance from here on. */
+void
+invoke_data_post (NPPGbpData *data, InvokeData *invoke_data)
+{
+  if (data->ready_invoke_data_tail != NULL)
+    data->ready_invoke_data_tail->ready_next = invoke_data;
+  else
+    data->ready_invoke_data = invoke_data;
+  data->ready_invoke_data_tail = invoke_data;
+
+  if (data->invoke_data_scheduled)
+    return;
+
+  data->invoke_data_scheduled = TRUE;
+  NPN_PluginThreadAsyncCall (data->instance, flush_invoke_data_cb,
+      data->instance);
 }
 
-void invoke_data_cb (void *user_data)
+static void
+event_clear (GbpEvent *event)
 {
+  g_free (event->message);
+  event->message = NULL;
+  g_free (event->debug);
+  event->debug = NULL;
+}
+
+#define EVENT_AT(data, i) \
+  (&(data)->events[((data)->events_head + (i)) % GBP_EVENT_RING_SIZE])
+
+/* removes the i-th pending event, keeping the others in order */
+static void
+events_remove (NPPGbpData *data, guint i)
+{
+  event_clear (EVENT_AT (data, i));
+  for (; i + 1 < data->events_length; ++i)
+    *EVENT_AT (data, i) = *EVENT_AT (data, i + 1);
+  data->events_length -= 1;
+}
+
+/* returns the index of the oldest pending event that isn't an error and, if
+ * type isn't GBP_EVENT_LAST, is of that type. -1 if there's none. */
+static gint
+events_find (NPPGbpData *data, GbpEventType type)
+{
+  GbpEvent *event;
+  guint i;
+
+  for (i = 0; i < data->events_length; ++i) {
+    event = EVENT_AT (data, i);
+    if (event->type != GBP_EVENT_ERROR &&
+        (type == GBP_EVENT_LAST || event->type == type))
+      return i;
+  }
+
+  return -1;
+}
+
+/* returns the slot for a new event or NULL if it has to be dropped, called
+ * with events_lock. A state or time update replaces the one of the same kind
+ * that hasn't been delivered yet. Errors are never dropped to make room. */
+static GbpEvent *
+events_push (NPPGbpData *data, GbpEventType type)
+{
+  GbpEvent *event;
+  gint i;
+
+  if (type != GBP_EVENT_ERROR && (i = events_find (data, type)) != -1) {
+    gbp_stats_inc (GBP_STAT_EVENTS_COLLAPSED);
+    /* moved to the end so that it's still delivered after older errors */
+    events_remove (data, i);
+  }
+
+  if (data->events_length == GBP_EVENT_RING_SIZE) {
+    i = events_find (data, GBP_EVENT_LAST);
+    if (i == -1) {
+      GST_WARNING_OBJECT (data->player, "too many pending errors, "
+          "dropping the new event");
+      return NULL;
+    }
+
+    GST_WARNING_OBJECT (data->player, "too many pending events, "
+        "dropping the oldest update");
+    events_remove (data, i);
+  }
+
+  event = EVENT_AT (data, data->events_length);
+  data->events_length += 1;
+  event->type = type;
+  event->state = NULL;
+  event->message = NULL;
+  event->debug = NULL;
+
+  return event;
+}
+
+static void
+flush_events_cb (void *user_data)
+{
+  NPP instance = (NPP) user_data;
+  NPPGbpData *data;
+  GbpEvent events[GBP_EVENT_RING_SIZE];
+  NPObject *handler;
+  NPVariant args[2];
   NPVariant result;
-  InvokeData *invoke_data = (InvokeData *) user_data;
+  guint i, n_args, n_events;
+  gboolean live = TRUE;
+
+  if (!npp_instance_is_live (instance))
+    return;
+
+  data = (NPPGbpData *) instance->pdata;
+
+  g_mutex_lock (data->events_lock);
+  n_events = data->events_length;
+  for (i = 0; i < n_events; ++i)
+    events[i] = data->events[(data->events_head + i) % GBP_EVENT_RING_SIZE];
+  data->events_head = 0;
+  data->events_length = 0;
+  data->events_scheduled = FALSE;
+  g_mutex_unlock (data->events_lock);
+
+  for (i = 0; i < n_events; ++i) {
+    /* a handler may have removed the plugin */
+    if (live && (live = npp_instance_is_live (instance))) {
+      switch (events[i].type) {
+        case GBP_EVENT_STATE:
+          handler = data->stateHandler;
+          STRINGZ_TO_NPVARIANT (events[i].state, args[0]);
+          n_args = 1;
+          break;
+        case GBP_EVENT_TIME_UPDATE:
+          handler = data->timeUpdateHandler;
+          DOUBLE_TO_NPVARIANT ((double) (events[i].position / GST_MSECOND),
+              args[0]);
+          n_args = 1;
+          break;
+        default:
+          handler = data->errorHandler;
+          STRINGZ_TO_NPVARIANT (events[i].message, args[0]);
+          STRINGZ_TO_NPVARIANT (events[i].debug, args[1]);
+          n_args = 2;
+      }
+
+      if (handler != NULL && NPN_InvokeDefault (instance, handler, args,
+            n_args, &result))
+        NPN_ReleaseVariantValue (&result);
+    }
 
-  NPN_InvokeDefault (invoke_data->instance, invoke_data->object,
-      invoke_data->args, invoke_data->n_args, &result);
+    event_clear (&events[i]);
+  }
+}
 
-  /* just ignore the return value for now */
-  NPN_ReleaseVariantValue (&result);
+/* called with events_lock, with the instance locked */
+static void
+events_schedule (NPPGbpData *data)
+{
+  if (data->events_scheduled)
+    return;
 
-  invoke_data_free (invoke_data, TRUE);
+  data->events_scheduled = TRUE;
+  NPN_PluginThreadAsyncCall (data->instance, flush_events_cb, data->instance);
 }
 
 void on_error_cb (GbpPlayer *player, GError *error, const char *debug,
     gpointer user_data)
 {
-  NPP instance = (NPP) user_data;
-  NPPGbpData *data = (NPPGbpData *) instance->pdata;
-  char *debug_copy;
-  char *message_copy;
-  InvokeData *invoke_data;
+  NPPGbpData *data = (NPPGbpData *) user_data;
+  GbpEvent *event;
 
   g_return_if_fail (player != NULL);
   g_return_if_fail (error != NULL);
@@ -657,35 +1134,43 @@ void on_error_cb (GbpPlayer *player, GError *error, const char *debug,
   GST_ERROR_OBJECT (player, "error: %s -- debug: %s",
       error->message, debug);
 
-  if (data->errorHandler == NULL)
+  if (!npp_gbp_data_lock (data))
     return;
 
-  invoke_data = invoke_data_new (instance, data->errorHandler, 2);
-
-  /* copy message and debug as they will be freed once we return */
-  message_copy = (char *) NPN_MemAlloc (strlen (error->message) + 1);
-  strcpy (message_copy, error->message);
-  debug_copy = (char *) NPN_MemAlloc (strlen (debug) + 1);
-  strcpy (debug_copy, debug);
-
-  STRINGZ_TO_NPVARIANT (message_copy, invoke_data->args[0]);
-  STRINGZ_TO_NPVARIANT (debug_copy, invoke_data->args[1]);
+  if (data->errorHandler == NULL) {
+    npp_gbp_data_unlock (data);
+    return;
+  }
 
-  NPN_PluginThreadAsyncCall (instance, invoke_data_cb, invoke_data);
+  g_mutex_lock (data->events_lock);
+  event = events_push (data, GBP_EVENT_ERROR);
+  if (event != NULL) {
+    /* copy message and debug as they will be freed once we return */
+    event->message = g_strdup (error->message);
+    event->debug = g_strdup (debug ? debug : "");
+    events_schedule (data);
+  }
+  g_mutex_unlock (data->events_lock);
+  npp_gbp_data_unlock (data);
 }
 
 void on_state_cb (GbpPlayer *player, gpointer user_data)
 {
   StateClosure *state_closure = (StateClosure *) user_data;
-  NPP instance = state_closure->instance;
-  NPPGbpData *data = (NPPGbpData *) instance->pdata;
-  InvokeData *invoke_data;
-  char *state_copy;
+  NPPGbpData *data = state_closure->data;
+  GbpEvent *event;
 
   g_return_if_fail (player != NULL);
 
   GST_INFO_OBJECT (player, "new state %s", state_closure->state);
 
+  /* takes the locks of the completion callbacks, which check the instance
+   * themselves */
+  gbp_np_class_object_state_changed (data, state_closure->state);
+
+  if (!npp_gbp_data_lock (data))
+    return;
+
 #ifdef XP_MACOSX
   if (data->drawing_model == CORE_ANIMATION)
     [data->layer setNeedsDisplay];
@@ -696,38 +1181,218 @@ void on_state_cb (GbpPlayer *player, gpointer user_data)
 
   data->state = g_strdup (state_closure->state);
 
-  if (data->stateHandler == NULL)
+  if (data->stateHandler == NULL) {
+    npp_gbp_data_unlock (data);
     return;
+  }
 
-  GST_DEBUG_OBJECT (player, "invoking state handler %p", data->stateHandler);
+  GST_DEBUG_OBJECT (player, "queueing state %s", state_closure->state);
 
-  invoke_data = invoke_data_new (instance, data->stateHandler, 1);
+  g_mutex_lock (data->events_lock);
+  event = events_push (data, GBP_EVENT_STATE);
+  if (event != NULL) {
+    event->state = state_closure->state;
+    events_schedule (data);
+  }
+  g_mutex_unlock (data->events_lock);
+  npp_gbp_data_unlock (data);
+}
+
+void on_time_update_cb (GbpPlayer *player, GstClockTime position,
+    gpointer user_data)
+{
+  NPPGbpData *data = (NPPGbpData *) user_data;
+  GbpEvent *event;
+
+  if (!npp_gbp_data_lock (data))
+    return;
+
+  if (data->timeUpdateHandler != NULL) {
+    g_mutex_lock (data->events_lock);
+    event = events_push (data, GBP_EVENT_TIME_UPDATE);
+    if (event != NULL) {
+      event->position = position;
+      events_schedule (data);
+    }
+    g_mutex_unlock (data->events_lock);
+  }
+  npp_gbp_data_unlock (data);
+}
+
+/* queues the track selection on the instance's lane */
+void on_tracks_changed_cb (GbpPlayer *player, gpointer user_data)
+{
+  NPPGbpData *data = (NPPGbpData *) user_data;
 
-  state_copy = (char *) NPN_MemAlloc (strlen (state_closure->state) + 1);
-  strcpy (state_copy, state_closure->state);
-  STRINGZ_TO_NPVARIANT (state_copy, invoke_data->args[0]);
+  if (!npp_gbp_data_lock (data))
+    return;
 
-  NPN_PluginThreadAsyncCall (instance, invoke_data_cb, invoke_data);
+  gbp_np_class_apply_object_tracks (data);
+  npp_gbp_data_unlock (data);
 }
 
+void on_preloaded_cb (GbpPlayer *player, gpointer user_data)
+{
+  NPPGbpData *data = (NPPGbpData *) user_data;
+
+  if (!npp_gbp_data_lock (data))
+    return;
+
+  gbp_np_class_finish_object_preload (data);
+  npp_gbp_data_unlock (data);
+}
+
+static void
+request_stream_cb (void *user_data)
+{
+  NPP instance = (NPP) user_data;
+  NPPGbpData *data;
+  char *uri;
+
+  if (!npp_instance_is_live (instance))
+    return;
+
+  data = (NPPGbpData *) instance->pdata;
+
+  /* seekable streams can serve the new source through NPN_RequestRead, and a
+   * sequential one is fine as long as nothing has been read from it yet */
+  if (data->stream != NULL &&
+      (data->stream_seekable || !data->stream_started))
+    return;
+
+  /* the player's uri belongs to the lane, this is the one it's catching up
+   * to */
+  uri = g_strdup (data->uri);
+
+  GST_INFO_OBJECT (data->player, "requesting stream %s", uri);
+  if (NPN_GetURL (instance, uri, NULL) != NPERR_NO_ERROR)
+    GST_WARNING_OBJECT (data->player, "couldn't request stream %s", uri);
+
+  g_free (uri);
+}
+
+void on_need_stream_cb (GbpPlayer *player, gpointer user_data)
+{
+  NPPGbpData *data = (NPPGbpData *) user_data;
+
+  g_return_if_fail (player != NULL);
+
+  if (!npp_gbp_data_lock (data))
+    return;
+
+  /* streams can only be requested from the browser thread */
+  NPN_PluginThreadAsyncCall (data->instance, request_stream_cb,
+      data->instance);
+  npp_gbp_data_unlock (data);
+}
+
+static void
+request_range_cb (void *user_data)
+{
+  RangeRequest *request = (RangeRequest *) user_data;
+  NPPGbpData *data;
+  NPByteRange range;
+
+  if (!npp_instance_is_live (request->instance)) {
+    g_free (request);
+    return;
+  }
+
+  data = (NPPGbpData *) request->instance->pdata;
+  if (data->stream == NULL || !data->stream_seekable) {
+    g_free (request);
+    return;
+  }
+
+  range.offset = request->offset;
+  range.length = request->length;
+  range.next = NULL;
+
+  if (NPN_RequestRead (data->stream, &range) != NPERR_NO_ERROR)
+    GST_WARNING_OBJECT (data->player, "couldn't request range %"
+        G_GUINT64_FORMAT "+%u", request->offset, request->length);
+
+  g_free (request);
+}
+
+void on_need_range_cb (GbpPlayer *player, guint64 offset, guint length,
+    gpointer user_data)
+{
+  NPPGbpData *data = (NPPGbpData *) user_data;
+  RangeRequest *request;
+
+  g_return_if_fail (player != NULL);
+
+  if (!npp_gbp_data_lock (data))
+    return;
+
+  request = g_new (RangeRequest, 1);
+  request->instance = data->instance;
+  request->offset = offset;
+  request->length = length;
+
+  NPN_PluginThreadAsyncCall (request->instance, request_range_cb, request);
+  npp_gbp_data_unlock (data);
+}
+
+NPPGbpData *
+npp_gbp_data_ref (NPPGbpData *data)
+{
+  g_atomic_int_inc (&data->refcount);
+
+  return data;
+}
+
+/* the NPObjects are released by NPP_Destroy, the last unref may happen on
+ * any thread */
 void
-npp_gbp_data_free (NPPGbpData *data)
+npp_gbp_data_unref (NPPGbpData *data)
 {
-  if (data->errorHandler != NULL)
-    NPN_ReleaseObject (data->errorHandler);
-  data->errorHandler = NULL;
+  if (!g_atomic_int_dec_and_test (&data->refcount))
+    return;
 
-  if (data->stateHandler != NULL)
-    NPN_ReleaseObject (data->stateHandler);
-  data->stateHandler = NULL;
+  /* NPN_ReleaseObject can't be called from here */
+  g_warn_if_fail (data->errorHandler == NULL);
+  g_warn_if_fail (data->stateHandler == NULL);
+  g_warn_if_fail (data->timeUpdateHandler == NULL);
 
   if (data->state)
     g_free (data->state);
   data->state = NULL;
 
+  g_free (data->uri);
+  data->uri = NULL;
+
+  if (data->playback_task)
+    gbp_executor_task_unref (data->playback_task);
+  data->playback_task = NULL;
+
   if (data->playback_queue)
-    g_async_queue_unref (data->playback_queue);
+    gbp_playback_queue_unref (data->playback_queue);
   data->playback_queue = NULL;
 
-  NPN_MemFree (data);
+  g_free (data->latencies);
+  data->latencies = NULL;
+
+  gbp_np_class_cancel_object_state_waiters (data);
+  g_mutex_free (data->state_waiters_lock);
+  data->state_waiters_lock = NULL;
+
+  /* never delivered */
+  while (data->events_length > 0) {
+    event_clear (&data->events[data->events_head]);
+    data->events_head = (data->events_head + 1) % GBP_EVENT_RING_SIZE;
+    data->events_length -= 1;
+  }
+  g_mutex_free (data->events_lock);
+  data->events_lock = NULL;
+
+  if (data->player)
+    g_object_unref (data->player);
+  data->player = NULL;
+
+  g_mutex_free (data->live_lock);
+  data->live_lock = NULL;
+
+  g_free (data);
 }
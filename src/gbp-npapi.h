@@ -26,6 +26,9 @@
 #include "npruntime.h"
 #include "npfunctions.h"
 #include "gbp-player.h"
+#include "gbp-playback-queue.h"
+#include "gbp-histogram.h"
+#include "gbp-executor.h"
 
 #ifdef XP_MACOSX
 #import <Cocoa/Cocoa.h>
@@ -45,20 +48,83 @@ typedef enum {
 } OSXDrawinModel;
 #endif
 
+/* events for the js handlers waiting for the browser thread */
+#define GBP_EVENT_RING_SIZE 16
+
+typedef enum {
+  GBP_EVENT_STATE,
+  GBP_EVENT_ERROR,
+  GBP_EVENT_TIME_UPDATE,
+  GBP_EVENT_LAST
+} GbpEventType;
+
+typedef struct _GbpEvent
+{
+  GbpEventType type;
+  /* static, for state events */
+  const char *state;
+  /* owned, for error events */
+  char *message;
+  char *debug;
+  GstClockTime position;
+} GbpEvent;
+
+typedef struct _InvokeData InvokeData;
+
 typedef struct _NPPGbpData
 {
+  /* owned by the instance until NPP_Destroy hands it to the lane, and by
+   * each player signal handler */
+  volatile gint refcount;
+  NPP instance;
+  /* live is cleared by NPP_Destroy. Threads other than the browser's hold
+   * live_lock while they schedule calls on the instance, see
+   * npp_gbp_data_lock (). */
+  GMutex *live_lock;
+  gboolean live;
   const char *user_agent;
   GbpPlayer *player;
   NPObject *errorHandler;
   NPObject *stateHandler;
-#ifndef PLAYBACK_THREAD_POOL
-  GThread *playback_thread;
-#else
-  gint pending_commands;
-#endif
-  GAsyncQueue *playback_queue;
+  NPObject *timeUpdateHandler;
+  GbpPlaybackQueue *playback_queue;
+  GbpExecutorTask *playback_task;
+  /* commands queued on the ring that haven't completed. While any are
+   * pending, nothing goes into a slot so that the order is kept. */
+  volatile gint playback_barriers;
+  /* the watchdog id of the state change in progress, only touched on the
+   * instance's lane */
+  guint state_watch;
+  /* bumped each time the lane starts a state change, tells a recovery
+   * whether the change it was queued for is still the current one */
+  guint state_changes;
+  /* command latencies, see gbp_np_class_new_latency_histograms () */
+  GbpHistogram *latencies;
+  NPStream *stream;
+  gboolean stream_seekable;
+  gboolean stream_started;
+  GSList *probe_batches;
+  /* InvokeData not freed yet, only touched on the browser thread */
+  InvokeData *pending_invoke_data;
+  /* posted by the lane with live_lock held, run in order by a single async
+   * call, see invoke_data_post () */
+  InvokeData *ready_invoke_data;
+  InvokeData *ready_invoke_data_tail;
+  gboolean invoke_data_scheduled;
+  /* completion callbacks of state changes in progress */
+  GMutex *state_waiters_lock;
+  GSList *state_waiters;
   char *state;
-  gboolean exiting;
+  /* delivered in order by a single async call, see on_state_cb () */
+  GMutex *events_lock;
+  GbpEvent events[GBP_EVENT_RING_SIZE];
+  guint events_head;
+  guint events_length;
+  gboolean events_scheduled;
+  /* what javascript last set, the player catches up on its lane */
+  char *uri;
+  gdouble volume;
+  gboolean have_audio;
   gboolean quit;
 #ifdef XP_MACOSX
   NSView *clippingView;
@@ -67,6 +133,22 @@ typedef struct _NPPGbpData
 #endif
 } NPPGbpData;
 
+#define INVOKE_DATA_MAX_ARGS 2
+
+/* a call to a js function scheduled with NPN_PluginThreadAsyncCall. The args
+ * don't own what they point to. */
+struct _InvokeData {
+  NPP instance;
+  NPObject *object;
+  NPVariant args[INVOKE_DATA_MAX_ARGS];
+  int n_args;
+  /* on the instance's pending list until freed */
+  InvokeData *prev;
+  InvokeData *next;
+  /* on the instance's ready list once posted */
+  InvokeData *ready_next;
+};
+
 char *NP_GetMIMEDescription();
 #ifndef XP_WIN
 NPError OSCALL NP_Initialize (NPNetscapeFuncs *mozilla_vtable, NPPluginFuncs *plugin_vtable);
@@ -77,7 +159,15 @@ NPError OSCALL NP_GetEntryPoints (NPPluginFuncs *plugin_vtable);
 NPError OSCALL NP_Shutdown ();
 NPError NP_GetValue (NPP instance, NPPVariable variable, void *value);
 NPError NP_SetValue (NPP instance, NPNVariable variable, void *ret_value);
-void npp_gbp_data_free (NPPGbpData *data);
+NPPGbpData *npp_gbp_data_ref (NPPGbpData *data);
+void npp_gbp_data_unref (NPPGbpData *data);
+gboolean npp_gbp_data_lock (NPPGbpData *data);
+void npp_gbp_data_unlock (NPPGbpData *data);
+gboolean npp_instance_is_live (NPP instance);
+InvokeData *invoke_data_new (NPP instance, NPObject *object, int n_args);
+void invoke_data_free (InvokeData *invoke_data);
+void invoke_data_cancel_all (NPPGbpData *data);
+void invoke_data_post (NPPGbpData *data, InvokeData *invoke_data);
 
 G_END_DECLS
 
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include "gbp-playback-queue.h"
+
+enum {
+  QUEUE_IDLE,
+  QUEUE_SCHEDULED
+};
+
+typedef struct
+{
+  volatile gint sequence;
+  gpointer item;
+} RingCell;
+
+struct _GbpPlaybackQueue
+{
+  volatile gint refcount;
+  guint n_slots;
+  volatile gpointer *slots;
+  /* bounded MPMC ring as described by Dmitry Vyukov, each cell's sequence
+   * tells whether it's ready to be written or read at a given position */
+  RingCell *ring;
+  guint ring_mask;
+  volatile gint enqueue_pos;
+  gint dequeue_pos;
+  /* queued items, approximate while producers race with the consumer */
+  volatile gint length;
+  volatile gint closed;
+  volatile gint state;
+};
+
+GbpPlaybackQueue *
+gbp_playback_queue_new (guint n_slots, guint ring_size)
+{
+  GbpPlaybackQueue *queue;
+  guint size = 1;
+  guint i;
+
+  while (size < ring_size)
+    size <<= 1;
+
+  queue = g_new0 (GbpPlaybackQueue, 1);
+  queue->refcount = 1;
+  queue->n_slots = n_slots;
+  queue->slots = g_new0 (gpointer, n_slots);
+  queue->ring = g_new0 (RingCell, size);
+  queue->ring_mask = size - 1;
+  for (i = 0; i < size; ++i)
+    queue->ring[i].sequence = i;
+
+  return queue;
+}
+
+GbpPlaybackQueue *
+gbp_playback_queue_ref (GbpPlaybackQueue *queue)
+{
+  g_return_val_if_fail (queue != NULL, NULL);
+
+  g_atomic_int_inc (&queue->refcount);
+
+  return queue;
+}
+
+/* items still queued aren't freed, pop them first */
+void
+gbp_playback_queue_unref (GbpPlaybackQueue *queue)
+{
+  g_return_if_fail (queue != NULL);
+
+  if (!g_atomic_int_dec_and_test (&queue->refcount))
+    return;
+
+  g_warn_if_fail (gbp_playback_queue_is_empty (queue));
+
+  g_free (queue->ring);
+  g_free ((gpointer) queue->slots);
+  g_free (queue);
+}
+
+/* stores item in slot. The item it supersedes, if the consumer didn't get
+ * to it first, is stored in *superseded before item becomes visible so that
+ * the consumer can complete both. Returns TRUE if an item was superseded. */
+gboolean
+gbp_playback_queue_replace (GbpPlaybackQueue *queue, guint slot,
+    gpointer item, gpointer *superseded)
+{
+  gpointer old;
+
+  g_return_val_if_fail (queue != NULL, FALSE);
+  g_return_val_if_fail (slot < queue->n_slots, FALSE);
+  g_return_val_if_fail (superseded != NULL, FALSE);
+
+  do {
+    old = g_atomic_pointer_get (&queue->slots[slot]);
+    *superseded = old;
+  } while (!g_atomic_pointer_compare_and_exchange (&queue->slots[slot],
+        old, item));
+
+  if (old == NULL)
+    g_atomic_int_inc (&queue->length);
+
+  return old != NULL;
+}
+
+/* stores item in slot only if the slot is empty. Returns FALSE if an item
+ * is already pending there. */
+gboolean
+gbp_playback_queue_offer (GbpPlaybackQueue *queue, guint slot, gpointer item)
+{
+  g_return_val_if_fail (queue != NULL, FALSE);
+  g_return_val_if_fail (slot < queue->n_slots, FALSE);
+
+  if (!g_atomic_pointer_compare_and_exchange (&queue->slots[slot],
+        NULL, item))
+    return FALSE;
+
+  g_atomic_int_inc (&queue->length);
+
+  return TRUE;
+}
+
+/* returns FALSE if the ring is full */
+gboolean
+gbp_playback_queue_push (GbpPlaybackQueue *queue, gpointer item)
+{
+  RingCell *cell;
+  gint pos;
+  gint diff;
+
+  g_return_val_if_fail (queue != NULL, FALSE);
+
+  pos = g_atomic_int_get (&queue->enqueue_pos);
+  while (TRUE) {
+    cell = &queue->ring[pos & queue->ring_mask];
+    diff = g_atomic_int_get (&cell->sequence) - pos;
+    if (diff == 0) {
+      if (g_atomic_int_compare_and_exchange (&queue->enqueue_pos, pos, pos + 1))
+        break;
+    } else if (diff < 0) {
+      return FALSE;
+    }
+
+    pos = g_atomic_int_get (&queue->enqueue_pos);
+  }
+
+  g_atomic_int_inc (&queue->length);
+  cell->item = item;
+  /* publish the item */
+  g_atomic_int_set (&cell->sequence, pos + 1);
+
+  return TRUE;
+}
+
+/* consumer only */
+gpointer
+gbp_playback_queue_pop (GbpPlaybackQueue *queue)
+{
+  RingCell *cell;
+  gpointer item;
+  guint i;
+
+  g_return_val_if_fail (queue != NULL, NULL);
+
+  for (i = 0; i < queue->n_slots; ++i) {
+    do {
+      item = g_atomic_pointer_get (&queue->slots[i]);
+    } while (item != NULL &&
+        !g_atomic_pointer_compare_and_exchange (&queue->slots[i], item, NULL));
+
+    if (item != NULL) {
+      g_atomic_int_add (&queue->length, -1);
+      return item;
+    }
+  }
+
+  cell = &queue->ring[queue->dequeue_pos & queue->ring_mask];
+  if (g_atomic_int_get (&cell->sequence) - (queue->dequeue_pos + 1) < 0)
+    return NULL;
+
+  item = cell->item;
+  cell->item = NULL;
+  /* make the cell writable again one lap later */
+  g_atomic_int_set (&cell->sequence, queue->dequeue_pos + queue->ring_mask + 1);
+  queue->dequeue_pos++;
+  g_atomic_int_add (&queue->length, -1);
+
+  return item;
+}
+
+/* number of items waiting, meant for statistics */
+guint
+gbp_playback_queue_get_length (GbpPlaybackQueue *queue)
+{
+  g_return_val_if_fail (queue != NULL, 0);
+
+  return MAX (g_atomic_int_get (&queue->length), 0);
+}
+
+gboolean
+gbp_playback_queue_is_empty (GbpPlaybackQueue *queue)
+{
+  RingCell *cell;
+  guint i;
+
+  g_return_val_if_fail (queue != NULL, TRUE);
+
+  for (i = 0; i < queue->n_slots; ++i) {
+    if (g_atomic_pointer_get (&queue->slots[i]) != NULL)
+      return FALSE;
+  }
+
+  cell = &queue->ring[queue->dequeue_pos & queue->ring_mask];
+  return g_atomic_int_get (&cell->sequence) - (queue->dequeue_pos + 1) < 0;
+}
+
+/* once closed, the queue only accepts what's already being pushed. Callers
+ * check gbp_playback_queue_is_closed () before pushing. */
+void
+gbp_playback_queue_close (GbpPlaybackQueue *queue)
+{
+  g_return_if_fail (queue != NULL);
+
+  g_atomic_int_set (&queue->closed, TRUE);
+}
+
+gboolean
+gbp_playback_queue_is_closed (GbpPlaybackQueue *queue)
+{
+  g_return_val_if_fail (queue != NULL, TRUE);
+
+  return g_atomic_int_get (&queue->closed);
+}
+
+/* called after pushing, returns TRUE if the caller must hand the queue to a
+ * consumer */
+gboolean
+gbp_playback_queue_schedule (GbpPlaybackQueue *queue)
+{
+  g_return_val_if_fail (queue != NULL, FALSE);
+
+  return g_atomic_int_compare_and_exchange (&queue->state,
+      QUEUE_IDLE, QUEUE_SCHEDULED);
+}
+
+/* called by a consumer that found the queue empty. Returns TRUE if items
+ * were pushed in the meantime and the consumer must keep going. */
+gboolean
+gbp_playback_queue_unschedule (GbpPlaybackQueue *queue)
+{
+  g_return_val_if_fail (queue != NULL, FALSE);
+
+  g_atomic_int_set (&queue->state, QUEUE_IDLE);
+
+  /* a producer may have seen the queue scheduled before we went idle */
+  if (gbp_playback_queue_is_empty (queue))
+    return FALSE;
+
+  return gbp_playback_queue_schedule (queue);
+}
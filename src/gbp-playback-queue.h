@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GBP_PLAYBACK_QUEUE_H
+#define GBP_PLAYBACK_QUEUE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Per instance command queue. Items are either stored in a slot, where a
+ * new item supersedes the pending one, or appended to a bounded ring. Any
+ * thread can push, a single consumer pops slots in index order and then the
+ * ring. */
+typedef struct _GbpPlaybackQueue GbpPlaybackQueue;
+
+GbpPlaybackQueue *gbp_playback_queue_new (guint n_slots, guint ring_size);
+GbpPlaybackQueue *gbp_playback_queue_ref (GbpPlaybackQueue *queue);
+void gbp_playback_queue_unref (GbpPlaybackQueue *queue);
+
+gboolean gbp_playback_queue_replace (GbpPlaybackQueue *queue, guint slot,
+    gpointer item, gpointer *superseded);
+gboolean gbp_playback_queue_offer (GbpPlaybackQueue *queue, guint slot,
+    gpointer item);
+gboolean gbp_playback_queue_push (GbpPlaybackQueue *queue, gpointer item);
+gpointer gbp_playback_queue_pop (GbpPlaybackQueue *queue);
+gboolean gbp_playback_queue_is_empty (GbpPlaybackQueue *queue);
+guint gbp_playback_queue_get_length (GbpPlaybackQueue *queue);
+
+void gbp_playback_queue_close (GbpPlaybackQueue *queue);
+gboolean gbp_playback_queue_is_closed (GbpPlaybackQueue *queue);
+
+gboolean gbp_playback_queue_schedule (GbpPlaybackQueue *queue);
+gboolean gbp_playback_queue_unschedule (GbpPlaybackQueue *queue);
+
+G_END_DECLS
+
+#endif /* GBP_PLAYBACK_QUEUE_H */
@@ -23,7 +23,13 @@
 
 #include <string.h>
 #include <gst/interfaces/xoverlay.h>
+#include <gst/app/gstappsrc.h>
 #include "gbp-player.h"
+#include "gbp-abr.h"
+#include "gbp-cache.h"
+#include "gbp-frame-cache.h"
+#include "gbp-metadata.h"
+#include "gbp-stats.h"
 #include "gbp-marshal.h"
 
 GST_DEBUG_CATEGORY (gbp_player_debug);
@@ -32,6 +38,25 @@ G_DEFINE_TYPE (GbpPlayer, gbp_player, GST_TYPE_OBJECT);
 
 #define DEFAULT_VIDEO_SINK "autovideosink"
 
+/* browser fed streams are pushed to appsrc in blocks of STREAM_BLOCK_SIZE
+ * bytes. Blocks are recycled through stream_block_pool so that steady state
+ * streaming doesn't hit malloc for every NPP_Write. */
+#define STREAM_URI "appsrc://"
+#define STREAM_BLOCK_SIZE (32 * 1024)
+#define STREAM_POOL_MAX_BLOCKS 64
+#define STREAM_MAX_BYTES (STREAM_BLOCK_SIZE * STREAM_POOL_MAX_BLOCKS)
+/* random access streams request ranges of at least this size */
+#define STREAM_READ_AHEAD (256 * 1024)
+
+/* how long a preload lets the pipeline preroll before giving up */
+#define PRELOAD_TIMEOUT (10 * GST_SECOND)
+
+/* used to seek back by frames when the stream doesn't tell the framerate */
+#define DEFAULT_FRAME_DURATION (GST_SECOND / 25)
+
+/* GstPlayFlags isn't public in 0.10 */
+#define PLAY_FLAG_TEXT (1 << 2)
+
 enum {
   PROP_0,
   PROP_URI,
@@ -40,7 +65,17 @@ enum {
   PROP_HEIGHT,
   PROP_VOLUME,
   PROP_HAVE_AUDIO,
-  PROP_VIDEO_SINK
+  PROP_VIDEO_SINK,
+  PROP_STREAM_MODE,
+  PROP_STREAM_SIZE,
+  PROP_STREAM_SEEKABLE,
+  PROP_CACHE,
+  PROP_CACHE_VALIDATOR,
+  PROP_PRELOAD,
+  PROP_ABR,
+  PROP_STATE_TIMEOUT,
+  PROP_TIME_UPDATE_INTERVAL,
+  PROP_VISIBLE
 };
 
 enum {
@@ -49,6 +84,11 @@ enum {
   SIGNAL_STOPPED,
   SIGNAL_EOS,
   SIGNAL_ERROR,
+  SIGNAL_NEED_STREAM,
+  SIGNAL_NEED_RANGE,
+  SIGNAL_TIME_UPDATE,
+  SIGNAL_TRACKS_CHANGED,
+  SIGNAL_PRELOADED,
   LAST_SIGNAL
 };
 
@@ -69,14 +109,83 @@ struct _GbpPlayerPrivate
   gdouble volume;
   gboolean have_audio;
   char *video_sink;
+  gboolean stream_mode;
+  gint64 stream_size;
+  GMutex *stream_lock;
+  gboolean stream_seekable;
+  GstElement *appsrc;
+  gboolean stream_random_access;
+  guint64 stream_offset;
+  guint64 stream_requested;
+  volatile gint stream_blocked;
+  gboolean cache;
+  char *cache_validator;
+  GbpCacheEntry *cache_entry;
+  char *pipeline_uri;
+  GbpPlayerPreload preload;
+  gboolean preloading;
+  GstClockTime duration;
+  /* tags and caps are protected by the object lock */
+  GstTagList *tags;
+  GstCaps *video_caps;
+  GstCaps *audio_caps;
+  /* owned by the pipeline */
+  GstElement *video_bin;
+  GstElement *frame_cache;
+  gboolean stepped;
+  /* the selected track of each GbpPlayerTrackType, -1 turns text off */
+  gint current_track[2];
+  /* NULL when adaptive bitrate selection is off, protected by the object
+   * lock since samples come from streaming threads */
+  GbpAbr *abr;
+  gboolean adaptive;
+  /* how long gbp_player_stop () waits for the pipeline to reach NULL */
+  GstClockTime state_timeout;
+  /* ::timeupdate is emitted from a periodic id on the system clock while
+   * playing and visible. Protected by the object lock. */
+  GstClock *clock;
+  GstClockID time_update_id;
+  GstClockTime time_update_interval;
+  gboolean visible;
+  gboolean playing;
+  /* a preload waiting for the preroll, see gbp_player_preload (). Protected
+   * by the object lock. */
+  gboolean preload_pending;
+  GstClockID preload_timeout_id;
+};
+
+static const char *preload_names[] = {
+  "none",
+  "metadata",
+  "auto",
+  NULL
+};
+
+/* how each GbpPlayerTrackType maps to playbin2 */
+static const struct {
+  const char *n_property;
+  const char *current_property;
+  const char *tags_signal;
+  const char *codec_tag;
+} track_types[] = {
+  {"n-audio", "current-audio", "get-audio-tags", GST_TAG_AUDIO_CODEC},
+  {"n-text", "current-text", "get-text-tags", GST_TAG_SUBTITLE_CODEC}
 };
 
 static guint player_signals[LAST_SIGNAL];
 
+static GStaticMutex stream_block_pool_lock = G_STATIC_MUTEX_INIT;
+static GTrashStack *stream_block_pool;
+static guint stream_block_pool_size;
+
 static void gbp_player_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
 static void gbp_player_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
+static void set_pipeline (GbpPlayer *player, GstElement *pipeline);
+static gboolean end_preload (GbpPlayer *player);
+static void apply_current_track (GbpPlayer *player, GbpPlayerTrackType type);
+static void update_time_updates (GbpPlayer *player, gboolean playing);
 static void playbin_source_cb (GstElement *playbin,
     GParamSpec *pspec, GbpPlayer *player);
 static void autovideosink_element_added_cb (GstElement *autovideosink,
@@ -89,6 +198,21 @@ static void on_bus_error_cb (GstBus *bus, GstMessage *message,
     GbpPlayer *player);
 static void on_bus_element_cb (GstBus *bus, GstMessage *message,
     GbpPlayer *player);
+static void on_bus_buffering_cb (GstBus *bus, GstMessage *message,
+    GbpPlayer *player);
+static void on_bus_tag_cb (GstBus *bus, GstMessage *message,
+    GbpPlayer *player);
+static void appsrc_need_data_cb (GstAppSrc *appsrc, guint length,
+    gpointer user_data);
+static void appsrc_enough_data_cb (GstAppSrc *appsrc, gpointer user_data);
+static gboolean appsrc_seek_data_cb (GstAppSrc *appsrc, guint64 offset,
+    gpointer user_data);
+
+static GstAppSrcCallbacks appsrc_callbacks = {
+  appsrc_need_data_cb,
+  appsrc_enough_data_cb,
+  appsrc_seek_data_cb
+};
 
 static void
 gbp_player_dispose (GObject *object)
@@ -98,12 +222,28 @@ gbp_player_dispose (GObject *object)
   if (!player->priv->disposed) {
     player->priv->disposed = TRUE;
     if (player->priv->pipeline != NULL) {
-      g_object_unref (player->priv->pipeline);
+      set_pipeline (player, NULL);
       g_object_unref (player->priv->bus);
-
-      player->priv->pipeline = NULL;
       player->priv->bus = NULL;
     }
+
+    if (player->priv->appsrc != NULL) {
+      g_object_unref (player->priv->appsrc);
+      player->priv->appsrc = NULL;
+    }
+
+    if (player->priv->cache_entry != NULL) {
+      gbp_cache_entry_unref (player->priv->cache_entry);
+      player->priv->cache_entry = NULL;
+    }
+
+    gst_caps_replace (&player->priv->video_caps, NULL);
+    gst_caps_replace (&player->priv->audio_caps, NULL);
+
+    if (player->priv->tags != NULL) {
+      gst_tag_list_free (player->priv->tags);
+      player->priv->tags = NULL;
+    }
   }
 
   G_OBJECT_CLASS (gbp_player_parent_class)->dispose (object);
@@ -115,6 +255,12 @@ gbp_player_finalize (GObject *object)
   GbpPlayer *player = GBP_PLAYER (object);
 
   g_free (player->priv->uri);
+  g_free (player->priv->cache_validator);
+  g_free (player->priv->pipeline_uri);
+  g_mutex_free (player->priv->stream_lock);
+  if (player->priv->abr != NULL)
+    gbp_abr_free (player->priv->abr);
+  gst_object_unref (player->priv->clock);
 
   G_OBJECT_CLASS (gbp_player_parent_class)->finalize (object);
 }
@@ -158,6 +304,56 @@ gbp_player_class_init (GbpPlayerClass *klass)
       g_param_spec_string ("video-sink", "Video-Sink",
         "Preferred videosink element name", DEFAULT_VIDEO_SINK, flags));
 
+  g_object_class_install_property (gobject_class, PROP_STREAM_MODE,
+      g_param_spec_boolean ("stream-mode", "Stream Mode",
+          "Read media from data pushed with gbp_player_stream_write ()",
+          FALSE, flags));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_SIZE,
+      g_param_spec_int64 ("stream-size", "Stream Size",
+          "Size in bytes of the pushed stream, -1 if unknown",
+          -1, G_MAXINT64, -1, flags));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_SEEKABLE,
+      g_param_spec_boolean ("stream-seekable", "Stream Seekable",
+          "Whether ranges of the pushed stream can be requested with "
+          "GbpPlayer::need-range", FALSE, flags));
+
+  g_object_class_install_property (gobject_class, PROP_CACHE,
+      g_param_spec_boolean ("cache", "Cache",
+          "Keep http media in the on-disk cache", FALSE, flags));
+
+  g_object_class_install_property (gobject_class, PROP_CACHE_VALIDATOR,
+      g_param_spec_string ("cache-validator", "Cache Validator",
+          "Identifies the version of the media in the cache, "
+          "eg: an ETag or a modification date", NULL, flags));
+
+  g_object_class_install_property (gobject_class, PROP_PRELOAD,
+      g_param_spec_string ("preload", "Preload",
+          "What gbp_player_preload () prepares: "
+          "none, metadata or auto", "none", flags));
+
+  g_object_class_install_property (gobject_class, PROP_ABR,
+      g_param_spec_string ("abr", "ABR",
+          "Bitrate selection policy for adaptive streams: "
+          "off, conservative, default or aggressive", "default", flags));
+
+  g_object_class_install_property (gobject_class, PROP_STATE_TIMEOUT,
+      g_param_spec_uint64 ("state-timeout", "State Timeout",
+          "How long to wait for the pipeline to stop, "
+          "GST_CLOCK_TIME_NONE to wait forever",
+          0, G_MAXUINT64, GST_CLOCK_TIME_NONE, flags));
+
+  g_object_class_install_property (gobject_class, PROP_TIME_UPDATE_INTERVAL,
+      g_param_spec_uint64 ("time-update-interval", "Time Update Interval",
+          "How often to emit timeupdate while playing, 0 to never emit it",
+          0, G_MAXUINT64, 0, flags));
+
+  g_object_class_install_property (gobject_class, PROP_VISIBLE,
+      g_param_spec_boolean ("visible", "Visible",
+          "Whether the video is on screen, timeupdate is only emitted "
+          "while it is", TRUE, flags));
+
   player_signals[SIGNAL_PLAYING] = g_signal_new ("playing",
       G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
       G_STRUCT_OFFSET (GbpPlayerClass, playing), NULL, NULL,
@@ -183,6 +379,37 @@ gbp_player_class_init (GbpPlayerClass *klass)
       G_STRUCT_OFFSET (GbpPlayerClass, error), NULL, NULL,
       gbp_marshal_VOID__POINTER_STRING, G_TYPE_NONE, 2, G_TYPE_POINTER, G_TYPE_STRING);
 
+  player_signals[SIGNAL_NEED_STREAM] = g_signal_new ("need-stream",
+      G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (GbpPlayerClass, need_stream), NULL, NULL,
+      gbp_marshal_VOID__VOID, G_TYPE_NONE, 0);
+
+  player_signals[SIGNAL_NEED_RANGE] = g_signal_new ("need-range",
+      G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (GbpPlayerClass, need_range), NULL, NULL,
+      gbp_marshal_VOID__UINT64_UINT, G_TYPE_NONE, 2,
+      G_TYPE_UINT64, G_TYPE_UINT);
+
+  player_signals[SIGNAL_TIME_UPDATE] = g_signal_new ("timeupdate",
+      G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (GbpPlayerClass, time_update), NULL, NULL,
+      gbp_marshal_VOID__UINT64, G_TYPE_NONE, 1, G_TYPE_UINT64);
+
+  /* emitted from a streaming thread once the pipeline has prerolled, the
+   * listener should call gbp_player_apply_tracks () from its own thread */
+  player_signals[SIGNAL_TRACKS_CHANGED] = g_signal_new ("tracks-changed",
+      G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (GbpPlayerClass, tracks_changed), NULL, NULL,
+      gbp_marshal_VOID__VOID, G_TYPE_NONE, 0);
+
+  /* emitted from a streaming or clock thread once a preload has prerolled,
+   * failed or timed out, the listener should call
+   * gbp_player_finish_preload () from its own thread */
+  player_signals[SIGNAL_PRELOADED] = g_signal_new ("preloaded",
+      G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (GbpPlayerClass, preloaded), NULL, NULL,
+      gbp_marshal_VOID__VOID, G_TYPE_NONE, 0);
+
   g_type_class_add_private (klass, sizeof (GbpPlayerPrivate));
 }
 
@@ -196,6 +423,12 @@ gbp_player_init (GbpPlayer *player)
   player->priv->latency = 300 * GST_MSECOND;
   player->priv->tcp_timeout = 5 * GST_SECOND;
   player->priv->have_audio = TRUE;
+  player->priv->stream_size = -1;
+  player->priv->stream_lock = g_mutex_new ();
+  player->priv->duration = GST_CLOCK_TIME_NONE;
+  player->priv->state_timeout = GST_CLOCK_TIME_NONE;
+  player->priv->clock = gst_system_clock_obtain ();
+  player->priv->visible = TRUE;
 }
 
 static void
@@ -207,7 +440,9 @@ gbp_player_get_property (GObject * object, guint prop_id,
   switch (prop_id)
   {
     case PROP_URI:
+      GST_OBJECT_LOCK (player);
       g_value_set_string (value, player->priv->uri);
+      GST_OBJECT_UNLOCK (player);
       break;
     case PROP_XID:
       g_value_set_ulong (value, player->priv->xid);
@@ -227,6 +462,43 @@ gbp_player_get_property (GObject * object, guint prop_id,
     case PROP_VIDEO_SINK:
       g_value_set_string (value, player->priv->video_sink);
       break;
+    case PROP_STREAM_MODE:
+      g_value_set_boolean (value, player->priv->stream_mode);
+      break;
+    case PROP_STREAM_SIZE:
+      g_value_set_int64 (value, player->priv->stream_size);
+      break;
+    case PROP_STREAM_SEEKABLE:
+      g_value_set_boolean (value, player->priv->stream_seekable);
+      break;
+    case PROP_CACHE:
+      g_value_set_boolean (value, player->priv->cache);
+      break;
+    case PROP_CACHE_VALIDATOR:
+      g_value_set_string (value, player->priv->cache_validator);
+      break;
+    case PROP_PRELOAD:
+      g_value_set_string (value, preload_names[player->priv->preload]);
+      break;
+    case PROP_ABR:
+      GST_OBJECT_LOCK (player);
+      g_value_set_string (value, player->priv->abr != NULL ?
+          gbp_abr_get_policy (player->priv->abr)->name : "off");
+      GST_OBJECT_UNLOCK (player);
+      break;
+    case PROP_STATE_TIMEOUT:
+      g_value_set_uint64 (value, player->priv->state_timeout);
+      break;
+    case PROP_TIME_UPDATE_INTERVAL:
+      GST_OBJECT_LOCK (player);
+      g_value_set_uint64 (value, player->priv->time_update_interval);
+      GST_OBJECT_UNLOCK (player);
+      break;
+    case PROP_VISIBLE:
+      GST_OBJECT_LOCK (player);
+      g_value_set_boolean (value, player->priv->visible);
+      GST_OBJECT_UNLOCK (player);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -241,9 +513,19 @@ gbp_player_set_property (GObject * object, guint prop_id,
   switch (prop_id)
   {
     case PROP_URI:
+    {
+      char *old_uri;
+
+      /* set on the lane, the object lock is for the readers on other
+       * threads */
+      GST_OBJECT_LOCK (player);
+      old_uri = player->priv->uri;
       player->priv->uri = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (player);
+      g_free (old_uri);
       player->priv->uri_changed = TRUE;
       break;
+    }
     case PROP_XID:
       player->priv->xid = g_value_get_ulong (value);
       break;
@@ -276,13 +558,155 @@ gbp_player_set_property (GObject * object, guint prop_id,
       player->priv->video_sink = g_value_dup_string (value);
       break;
     }
+    case PROP_STREAM_MODE:
+    {
+      gboolean stream_mode;
+
+      stream_mode = g_value_get_boolean (value);
+      if (stream_mode != player->priv->stream_mode) {
+        player->priv->stream_mode = stream_mode;
+        player->priv->uri_changed = TRUE;
+      }
+
+      break;
+    }
+    case PROP_STREAM_SIZE:
+      g_mutex_lock (player->priv->stream_lock);
+      player->priv->stream_size = g_value_get_int64 (value);
+      if (player->priv->appsrc != NULL)
+        gst_app_src_set_size (GST_APP_SRC (player->priv->appsrc),
+            player->priv->stream_size);
+      g_mutex_unlock (player->priv->stream_lock);
+      break;
+    case PROP_STREAM_SEEKABLE:
+      g_mutex_lock (player->priv->stream_lock);
+      /* a running sequential source can't switch to random access, the new
+       * value is picked up with the next source */
+      if (player->priv->appsrc == NULL || player->priv->stream_random_access)
+        player->priv->stream_seekable = g_value_get_boolean (value);
+      g_mutex_unlock (player->priv->stream_lock);
+      break;
+    case PROP_CACHE:
+      player->priv->cache = g_value_get_boolean (value);
+      break;
+    case PROP_CACHE_VALIDATOR:
+      g_free (player->priv->cache_validator);
+      player->priv->cache_validator = g_value_dup_string (value);
+      break;
+    case PROP_PRELOAD:
+    {
+      const char *preload = g_value_get_string (value);
+      int i;
+
+      for (i = 0; preload_names[i] != NULL; ++i) {
+        if (preload != NULL && !strcmp (preload, preload_names[i])) {
+          player->priv->preload = (GbpPlayerPreload) i;
+          break;
+        }
+      }
+
+      if (preload_names[i] == NULL)
+        GST_WARNING_OBJECT (player, "invalid preload value %s", preload);
+
+      break;
+    }
+    case PROP_ABR:
+    {
+      const char *name = g_value_get_string (value);
+      const GbpAbrPolicy *policy = NULL;
+
+      if (name != NULL && strcmp (name, "off")) {
+        policy = gbp_abr_policy_lookup (name);
+        if (policy == NULL) {
+          GST_WARNING_OBJECT (player, "invalid abr value %s", name);
+          break;
+        }
+      }
+
+      GST_OBJECT_LOCK (player);
+      if (player->priv->abr != NULL)
+        gbp_abr_free (player->priv->abr);
+      player->priv->abr = NULL;
+      if (policy != NULL) {
+        player->priv->abr = gbp_abr_new (policy);
+        gbp_abr_set_window (player->priv->abr,
+            player->priv->width, player->priv->height);
+      }
+      GST_OBJECT_UNLOCK (player);
+      break;
+    }
+    case PROP_STATE_TIMEOUT:
+      player->priv->state_timeout = g_value_get_uint64 (value);
+      break;
+    case PROP_TIME_UPDATE_INTERVAL:
+    {
+      gboolean playing;
+
+      GST_OBJECT_LOCK (player);
+      player->priv->time_update_interval = g_value_get_uint64 (value);
+      playing = player->priv->playing;
+      GST_OBJECT_UNLOCK (player);
+
+      /* restarts the id with the new interval */
+      update_time_updates (player, FALSE);
+      update_time_updates (player, playing);
+      break;
+    }
+    case PROP_VISIBLE:
+    {
+      gboolean playing;
+
+      GST_OBJECT_LOCK (player);
+      player->priv->visible = g_value_get_boolean (value);
+      playing = player->priv->playing;
+      GST_OBJECT_UNLOCK (player);
+
+      update_time_updates (player, playing);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
 
-  if (prop_id == PROP_WIDTH || prop_id == PROP_HEIGHT)
-    /* FIXME */
-    ;
+  if (prop_id == PROP_WIDTH || prop_id == PROP_HEIGHT) {
+    /* bigger variants than the window can show are a waste of bandwidth */
+    GST_OBJECT_LOCK (player);
+    if (player->priv->abr != NULL)
+      gbp_abr_set_window (player->priv->abr,
+          player->priv->width, player->priv->height);
+    GST_OBJECT_UNLOCK (player);
+  }
+}
+
+/* the pipeline is only replaced on the lane, the object lock is for
+ * get_pipeline () on the other threads */
+static void
+set_pipeline (GbpPlayer *player, GstElement *pipeline)
+{
+  GstPipeline *old;
+
+  GST_OBJECT_LOCK (player);
+  old = player->priv->pipeline;
+  player->priv->pipeline = (GstPipeline *) pipeline;
+  GST_OBJECT_UNLOCK (player);
+
+  if (old != NULL)
+    g_object_unref (old);
+}
+
+/* returns a ref to the current pipeline or NULL, for threads other than the
+ * lane */
+static GstElement *
+get_pipeline (GbpPlayer *player)
+{
+  GstElement *pipeline = NULL;
+
+  GST_OBJECT_LOCK (player);
+  if (player->priv->pipeline != NULL)
+    pipeline = gst_object_ref (player->priv->pipeline);
+  GST_OBJECT_UNLOCK (player);
+
+  return pipeline;
 }
 
 static gboolean
@@ -290,13 +714,17 @@ build_pipeline (GbpPlayer *player)
 {
   GstElement *autovideosink;
   GstElement *audiosink;
+  GstPad *pad;
 
-  if (player->priv->pipeline != NULL) {
+  if (player->priv->pipeline != NULL)
     gst_element_set_state (GST_ELEMENT (player->priv->pipeline), GST_STATE_NULL);
-    g_object_unref (player->priv->pipeline);
-  }
 
-  player->priv->pipeline = GST_PIPELINE (gst_element_factory_make ("playbin2", NULL));
+  set_pipeline (player, gst_element_factory_make ("playbin2", NULL));
+  g_free (player->priv->pipeline_uri);
+  player->priv->pipeline_uri = NULL;
+  player->priv->video_bin = NULL;
+  player->priv->frame_cache = NULL;
+  player->priv->stepped = FALSE;
   if (player->priv->pipeline == NULL) {
     /* FIXME: create our domain */
     GError *error = g_error_new (GST_LIBRARY_ERROR,
@@ -320,8 +748,7 @@ build_pipeline (GbpPlayer *player)
 
     g_error_free (error);
 
-    g_object_unref (player->priv->pipeline);
-    player->priv->pipeline = NULL;
+    set_pipeline (player, NULL);
 
     return FALSE;
   }
@@ -343,13 +770,23 @@ build_pipeline (GbpPlayer *player)
 
     g_error_free (error);
 
-    g_object_unref (player->priv->pipeline);
-    player->priv->pipeline = NULL;
+    set_pipeline (player, NULL);
 
     return FALSE;
   }
 
-  g_object_set (G_OBJECT (player->priv->pipeline), "video-sink", autovideosink, NULL);
+  /* keep the last frames in front of the sink for stepping back */
+  player->priv->video_bin = gst_bin_new ("gbpvideobin");
+  player->priv->frame_cache = gbp_frame_cache_new ();
+  gst_bin_add_many (GST_BIN (player->priv->video_bin),
+      player->priv->frame_cache, autovideosink, NULL);
+  gst_element_link (player->priv->frame_cache, autovideosink);
+  pad = gst_element_get_static_pad (player->priv->frame_cache, "sink");
+  gst_element_add_pad (player->priv->video_bin, gst_ghost_pad_new ("sink", pad));
+  gst_object_unref (pad);
+
+  g_object_set (G_OBJECT (player->priv->pipeline), "video-sink",
+      player->priv->video_bin, NULL);
   g_object_set (G_OBJECT (player->priv->pipeline), "audio-sink", audiosink, NULL);
 
   player->priv->bus = gst_pipeline_get_bus (player->priv->pipeline);
@@ -359,6 +796,8 @@ build_pipeline (GbpPlayer *player)
       "signal::sync-message::eos", G_CALLBACK (on_bus_eos_cb), player,
       "signal::sync-message::error", G_CALLBACK (on_bus_error_cb), player,
       "signal::sync-message::element", G_CALLBACK (on_bus_element_cb), player,
+      "signal::sync-message::tag", G_CALLBACK (on_bus_tag_cb), player,
+      "signal::sync-message::buffering", G_CALLBACK (on_bus_buffering_cb), player,
       NULL);
 
   g_object_connect (player->priv->pipeline,
@@ -372,98 +811,228 @@ build_pipeline (GbpPlayer *player)
   g_object_set (player->priv->pipeline,
       "volume", player->priv->volume, NULL);
 
+  /* turns text off if needed, the tracks are selected once prerolled */
+  apply_current_track (player, GBP_PLAYER_TRACK_TEXT);
+
   player->priv->have_pipeline = TRUE;
   return TRUE;
 }
 
-void
-gbp_player_start (GbpPlayer *player)
+static gboolean
+is_adaptive_uri (const char *uri)
 {
-  g_return_if_fail (player != NULL);
+  const char *end;
+
+  if (uri == NULL)
+    return FALSE;
+
+  end = strpbrk (uri, "?#");
+  if (end == NULL)
+    end = uri + strlen (uri);
+
+  return end - uri >= 5 && !g_ascii_strncasecmp (end - 5, ".m3u8", 5);
+}
+
+static void
+update_pipeline_uri (GbpPlayer *player)
+{
+  GbpCacheEntry *cache_entry = NULL;
+  const char *uri;
+
+  if (player->priv->stream_mode)
+    uri = STREAM_URI;
+  else if (player->priv->cache && player->priv->uri != NULL &&
+      (cache_entry = gbp_cache_lookup (gbp_cache_get_default (),
+          player->priv->uri, player->priv->cache_validator)) != NULL)
+    uri = gbp_cache_entry_get_uri (cache_entry);
+  else
+    uri = player->priv->uri;
+
+  if (!player->priv->uri_changed &&
+      !g_strcmp0 (uri, player->priv->pipeline_uri)) {
+    if (cache_entry != NULL)
+      gbp_cache_entry_unref (cache_entry);
+    return;
+  }
+
+  gbp_player_stop (player);
+
+  GST_INFO_OBJECT (player, "playing %s", uri);
+  g_object_set (player->priv->pipeline, "uri", uri, NULL);
+  g_free (player->priv->pipeline_uri);
+  player->priv->pipeline_uri = g_strdup (uri);
+  player->priv->uri_changed = FALSE;
+  player->priv->duration = GST_CLOCK_TIME_NONE;
+  player->priv->stepped = FALSE;
+  player->priv->adaptive = is_adaptive_uri (player->priv->uri);
+
+  GST_OBJECT_LOCK (player);
+  if (player->priv->abr != NULL)
+    gbp_abr_reset (player->priv->abr);
+  gst_caps_replace (&player->priv->video_caps, NULL);
+  gst_caps_replace (&player->priv->audio_caps, NULL);
+  if (player->priv->tags != NULL) {
+    gst_tag_list_free (player->priv->tags);
+    player->priv->tags = NULL;
+  }
+  GST_OBJECT_UNLOCK (player);
+
+  /* keep the entry referenced while we read from it */
+  if (player->priv->cache_entry != NULL)
+    gbp_cache_entry_unref (player->priv->cache_entry);
+  player->priv->cache_entry = cache_entry;
+}
 
+static gboolean
+prepare_pipeline (GbpPlayer *player)
+{
   if (player->priv->have_pipeline == FALSE) {
     if (!build_pipeline (player))
       /* player::error has been emitted, return */
-      return;
+      return FALSE;
   }
 
-  if (player->priv->uri_changed) {
-    gbp_player_stop (player);
-
-    g_object_set (player->priv->pipeline, "uri", player->priv->uri, NULL);
-    player->priv->uri_changed = FALSE;
-  }
+  update_pipeline_uri (player);
 
   if (player->priv->reset_state) {
     gbp_player_stop (player);
     player->priv->reset_state = FALSE;
   }
 
-  gst_element_set_state (GST_ELEMENT (player->priv->pipeline),
-      GST_STATE_PLAYING);
+  return TRUE;
+}
+
+static gboolean
+seek_accurate (GbpPlayer *player, GstClockTime position)
+{
+  return gst_element_seek (GST_ELEMENT (player->priv->pipeline), 1.0,
+      GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+      GST_SEEK_TYPE_SET, position, GST_SEEK_TYPE_NONE, -1);
 }
 
 void
-gbp_player_pause (GbpPlayer *player)
+gbp_player_start (GbpPlayer *player)
 {
+  GstClockTime position;
+
   g_return_if_fail (player != NULL);
 
-  if (player->priv->have_pipeline == FALSE) {
-    if (!build_pipeline (player))
-      /* player::error has been emitted, return */
-      return;
-  }
+  end_preload (player);
 
-  if (player->priv->uri_changed) {
-    gbp_player_stop (player);
+  if (!prepare_pipeline (player))
+    return;
 
-    g_object_set (player->priv->pipeline, "uri", player->priv->uri, NULL);
-    player->priv->uri_changed = FALSE;
+  if (player->priv->stepped) {
+    /* replayed frames and step events leave the sinks out of sync, start
+     * again from the frame on screen */
+    player->priv->stepped = FALSE;
+    position = gbp_player_get_position (player);
+    if (GST_CLOCK_TIME_IS_VALID (position))
+      seek_accurate (player, position);
   }
 
-  if (player->priv->reset_state) {
-    gbp_player_stop (player);
-    player->priv->reset_state = FALSE;
-  }
+  gst_element_set_state (GST_ELEMENT (player->priv->pipeline),
+      GST_STATE_PLAYING);
+}
+
+void
+gbp_player_pause (GbpPlayer *player)
+{
+  g_return_if_fail (player != NULL);
+
+  update_time_updates (player, FALSE);
+  end_preload (player);
+
+  if (!prepare_pipeline (player))
+    return;
 
   gst_element_set_state (GST_ELEMENT (player->priv->pipeline),
       GST_STATE_PAUSED);
 }
 
+/* called from the browser thread and the clock thread, the lane may replace
+ * the pipeline meanwhile */
 GstClockTime
 gbp_player_get_duration (GbpPlayer *player)
 {
+  GstElement *pipeline;
   gint64 duration;
   GstFormat format = GST_FORMAT_TIME;
+  gboolean res;
 
   g_return_val_if_fail (player != NULL, GST_CLOCK_TIME_NONE);
 
   if (!player->priv->have_pipeline)
     return GST_CLOCK_TIME_NONE;
 
-  if (!gst_element_query_duration (GST_ELEMENT (player->priv->pipeline), &format, &duration))
+  pipeline = get_pipeline (player);
+  if (pipeline == NULL)
     return GST_CLOCK_TIME_NONE;
 
+  res = gst_element_query_duration (pipeline, &format, &duration);
+  gst_object_unref (pipeline);
+
+  /* fall back to the duration found by the last preroll, which is all we
+   * have after a metadata preload */
+  if (!res)
+    return player->priv->duration;
+
+  player->priv->duration = duration;
   return (GstClockTime) duration;
 }
 
 GstClockTime
 gbp_player_get_position (GbpPlayer *player)
 {
+  GstElement *pipeline;
   gint64 position;
   GstFormat format = GST_FORMAT_TIME;
+  gboolean res;
 
   g_return_val_if_fail (player != NULL, GST_CLOCK_TIME_NONE);
 
   if (!player->priv->have_pipeline)
     return GST_CLOCK_TIME_NONE;
 
-  if (!gst_element_query_position (GST_ELEMENT (player->priv->pipeline), &format, &position))
+  pipeline = get_pipeline (player);
+  if (pipeline == NULL)
+    return GST_CLOCK_TIME_NONE;
+
+  res = gst_element_query_position (pipeline, &format, &position);
+  gst_object_unref (pipeline);
+
+  if (!res)
     return GST_CLOCK_TIME_NONE;
 
   return (GstClockTime) position;
 }
 
+/* returns FALSE while a state change is in progress. Can be called from any
+ * thread. */
+gboolean
+gbp_player_get_settled_state (GbpPlayer *player, GstState *state)
+{
+  GstElement *pipeline;
+  GstState pending;
+  GstStateChangeReturn ret;
+
+  g_return_val_if_fail (player != NULL, FALSE);
+  g_return_val_if_fail (state != NULL, FALSE);
+
+  pipeline = get_pipeline (player);
+  if (pipeline == NULL || !player->priv->have_pipeline) {
+    if (pipeline != NULL)
+      gst_object_unref (pipeline);
+    *state = GST_STATE_NULL;
+    return TRUE;
+  }
+
+  ret = gst_element_get_state (pipeline, state, &pending, 0);
+  gst_object_unref (pipeline);
+
+  return ret == GST_STATE_CHANGE_SUCCESS && pending == GST_STATE_VOID_PENDING;
+}
+
 gboolean
 gbp_player_seek (GbpPlayer *player, GstClockTime position, gdouble rate)
 {
@@ -478,6 +1047,7 @@ gbp_player_seek (GbpPlayer *player, GstClockTime position, gdouble rate)
 
   format = GST_FORMAT_TIME;
   seek_flags = GST_SEEK_FLAG_FLUSH;
+  player->priv->stepped = FALSE;
 
   if (rate > 0) {
     start = position;
@@ -491,106 +1061,1138 @@ gbp_player_seek (GbpPlayer *player, GstClockTime position, gdouble rate)
       format, seek_flags, GST_SEEK_TYPE_SET, start, GST_SEEK_TYPE_SET, stop);
 }
 
-void
-gbp_player_stop (GbpPlayer *player)
+static GstClockTime
+get_frame_duration (GbpPlayer *player)
 {
-  g_return_if_fail (player != NULL);
+  GstClockTime duration;
+  GstCaps *caps;
+  gint num = 0, denom = 1;
+
+  duration = gbp_frame_cache_get_frame_duration (
+      GBP_FRAME_CACHE (player->priv->frame_cache));
+  if (GST_CLOCK_TIME_IS_VALID (duration))
+    return duration;
+
+  caps = gbp_player_get_video_caps (player);
+  if (caps != NULL) {
+    gst_structure_get_fraction (gst_caps_get_structure (caps, 0),
+        "framerate", &num, &denom);
+    gst_caps_unref (caps);
+  }
 
-  if (player->priv->pipeline == NULL)
-    return;
+  if (num <= 0 || denom <= 0)
+    return DEFAULT_FRAME_DURATION;
 
-  gst_element_set_state (GST_ELEMENT (player->priv->pipeline),
-      GST_STATE_NULL);
-  gst_element_get_state (GST_ELEMENT (player->priv->pipeline),
-      NULL, NULL, GST_CLOCK_TIME_NONE);
+  return gst_util_uint64_scale_int (GST_SECOND, denom, num);
 }
 
-static void
-playbin_source_cb (GstElement *playbin,
-    GParamSpec *pspec, GbpPlayer *player)
+/* steps forward or back (frames < 0) while paused. Backward steps are served
+ * from the frame cache and only seek when it doesn't go back far enough. */
+gboolean
+gbp_player_step_frames (GbpPlayer *player, gint frames)
 {
-  GstElement *element;
-  GObjectClass *klass;
+  GbpFrameCache *cache;
+  GstClockTime position, offset;
+  guint remaining;
 
-  g_object_get (G_OBJECT (playbin), "source", &element, NULL);
-  klass = G_OBJECT_GET_CLASS (element);
+  g_return_val_if_fail (player != NULL, FALSE);
 
-  if (g_object_class_find_property (klass, "latency")) {
-    g_object_set (element, "latency",
-        GST_TIME_AS_MSECONDS (player->priv->latency), NULL);
+  if (!player->priv->have_pipeline)
+    return FALSE;
+
+  if (frames == 0)
+    return TRUE;
+
+  cache = GBP_FRAME_CACHE (player->priv->frame_cache);
+  player->priv->stepped = TRUE;
+
+  if (frames > 0) {
+    remaining = gbp_frame_cache_step_forward (cache, frames);
+    gbp_stats_add (GBP_STAT_FRAME_CACHE_HITS, frames - remaining);
+    if (remaining == 0)
+      return TRUE;
+
+    return gst_element_send_event (player->priv->video_bin,
+        gst_event_new_step (GST_FORMAT_BUFFERS, remaining, 1.0, TRUE, FALSE));
   }
 
-  if (g_object_class_find_property (klass, "tcp-timeout")) {
-    g_object_set (element, "tcp-timeout",
-        GST_TIME_AS_USECONDS (player->priv->tcp_timeout), NULL);
+  if (gbp_frame_cache_step_back (cache, -frames)) {
+    gbp_stats_add (GBP_STAT_FRAME_CACHE_HITS, -frames);
+    return TRUE;
   }
+
+  gbp_stats_add (GBP_STAT_FRAME_CACHE_MISSES, -frames);
+
+  position = gbp_player_get_position (player);
+  if (!GST_CLOCK_TIME_IS_VALID (position))
+    return FALSE;
+
+  offset = get_frame_duration (player) * -frames;
+  position = position > offset ? position - offset : 0;
+  GST_DEBUG_OBJECT (player, "stepping back %d frames to %" GST_TIME_FORMAT,
+      -frames, GST_TIME_ARGS (position));
+
+  return seek_accurate (player, position);
 }
 
 static void
-autovideosink_element_added_cb (GstElement *autovideosink,
-    GstElement *element, GbpPlayer *player)
+apply_current_track (GbpPlayer *player, GbpPlayerTrackType type)
 {
-  GObjectClass *klass;
+  gint track = player->priv->current_track[type];
+  gint n_tracks = 0;
+  guint flags, new_flags;
 
-  GST_INFO_OBJECT (player, "using sink %s", gst_element_get_name (element));
+  if (type == GBP_PLAYER_TRACK_TEXT) {
+    g_object_get (player->priv->pipeline, "flags", &flags, NULL);
+    if (track < 0)
+      new_flags = flags & ~PLAY_FLAG_TEXT;
+    else
+      new_flags = flags | PLAY_FLAG_TEXT;
 
-  klass = G_OBJECT_GET_CLASS (element);
-  if (!g_object_class_find_property (klass, "double-buffer"))
+    if (new_flags != flags)
+      g_object_set (player->priv->pipeline, "flags", new_flags, NULL);
+
+    if (track < 0)
+      return;
+  }
+
+  /* until the pipeline prerolls there are no tracks to select */
+  g_object_get (player->priv->pipeline,
+      track_types[type].n_property, &n_tracks, NULL);
+  if (track >= n_tracks)
     return;
 
-  g_object_set (G_OBJECT (element), "double-buffer", FALSE, NULL);
+  GST_INFO_OBJECT (player, "selecting %s %d",
+      track_types[type].current_property, track);
+
+  /* playbin2 switches its input-selector on the fly, so this doesn't need a
+   * new preroll */
+  g_object_set (player->priv->pipeline,
+      track_types[type].current_property, track, NULL);
 }
 
-static void
-on_bus_state_changed_cb (GstBus *bus, GstMessage *message,
-    GbpPlayer *player)
+/* returns a list of "track" structures with the index, language, codec and
+ * title of each track of the given type */
+GList *
+gbp_player_get_tracks (GbpPlayer *player, GbpPlayerTrackType type)
 {
-  GstState old_state, new_state, pending_state;
+  GList *tracks = NULL;
+  GstTagList *tags;
+  GstStructure *track;
+  const char *tag_names[][2] = {
+    {GST_TAG_LANGUAGE_CODE, "language"},
+    {track_types[type].codec_tag, "codec"},
+    {GST_TAG_TITLE, "title"}
+  };
+  GstElement *pipeline;
+  char *value;
+  guint bitrate;
+  gint n_tracks = 0;
+  gint i;
+  guint j;
+
+  g_return_val_if_fail (player != NULL, NULL);
 
-  if (message->src != GST_OBJECT (player->priv->pipeline))
-    return;
+  if (!player->priv->have_pipeline)
+    return NULL;
+
+  /* called from the browser thread while the lane may rebuild the
+   * pipeline */
+  pipeline = get_pipeline (player);
+  if (pipeline == NULL)
+    return NULL;
+
+  g_object_get (pipeline, track_types[type].n_property, &n_tracks, NULL);
+
+  for (i = n_tracks - 1; i >= 0; --i) {
+    track = gst_structure_new ("track", "index", G_TYPE_INT, i, NULL);
+
+    tags = NULL;
+    g_signal_emit_by_name (pipeline, track_types[type].tags_signal, i, &tags);
+    if (tags != NULL) {
+      for (j = 0; j < G_N_ELEMENTS (tag_names); ++j) {
+        if (gst_tag_list_get_string (tags, tag_names[j][0], &value)) {
+          gst_structure_set (track, tag_names[j][1], G_TYPE_STRING, value, NULL);
+          g_free (value);
+        }
+      }
 
-  gst_message_parse_state_changed (message,
-      &old_state, &new_state, &pending_state);
+      if (gst_tag_list_get_uint (tags, GST_TAG_BITRATE, &bitrate))
+        gst_structure_set (track, "bitrate", G_TYPE_INT, bitrate, NULL);
 
-  if (new_state == GST_STATE_READY && old_state > GST_STATE_READY &&
-      pending_state <= GST_STATE_READY) {
-    g_signal_emit (player, player_signals[SIGNAL_STOPPED], 0);
-  } else if (new_state == GST_STATE_PAUSED &&
-        pending_state == GST_STATE_VOID_PENDING) {
-    g_signal_emit (player, player_signals[SIGNAL_PAUSED], 0);
-  } else if (new_state == GST_STATE_PLAYING &&
-      pending_state == GST_STATE_VOID_PENDING) {
-    g_signal_emit (player, player_signals[SIGNAL_PLAYING], 0);
+      gst_tag_list_free (tags);
+    }
+
+    tracks = g_list_prepend (tracks, track);
   }
-}
 
-static void
-on_bus_eos_cb (GstBus *bus, GstMessage *message,
-    GbpPlayer *player)
-{
-  player->priv->reset_state = TRUE;
-  g_signal_emit (player, player_signals[SIGNAL_EOS], 0);
+  gst_object_unref (pipeline);
+
+  return tracks;
 }
 
-static void
-on_bus_error_cb (GstBus *bus, GstMessage *message,
-    GbpPlayer *player)
+gint
+gbp_player_get_current_track (GbpPlayer *player, GbpPlayerTrackType type)
 {
-  GError *error;
-  char *debug;
+  GstElement *pipeline;
+  gint track;
 
-  gst_message_parse_error (message, &error, &debug);
+  g_return_val_if_fail (player != NULL, -1);
 
-  player->priv->reset_state = TRUE;
-  g_signal_emit (player, player_signals[SIGNAL_ERROR], 0, error, debug);
+  track = player->priv->current_track[type];
+  if (!player->priv->have_pipeline || track < 0)
+    return track;
+
+  pipeline = get_pipeline (player);
+  if (pipeline == NULL)
+    return track;
+
+  g_object_get (pipeline, track_types[type].current_property, &track, NULL);
+  gst_object_unref (pipeline);
+
+  return track;
 }
 
-static void
-on_bus_element_cb (GstBus *bus, GstMessage *message,
-    GbpPlayer *player)
+/* Note that in 0.10 decodebin2 still decodes the tracks that aren't
+ * selected, input-selector just drops them. */
+gboolean
+gbp_player_set_current_track (GbpPlayer *player, GbpPlayerTrackType type,
+    gint track)
 {
-  const GstStructure *structure;
+  g_return_val_if_fail (player != NULL, FALSE);
+
+  /* audio can only be turned off with have-audio */
+  if (track < (type == GBP_PLAYER_TRACK_TEXT ? -1 : 0))
+    return FALSE;
+
+  player->priv->current_track[type] = track;
+  if (player->priv->have_pipeline)
+    apply_current_track (player, type);
+
+  return TRUE;
+}
+
+/* selects the tracks asked for on a pipeline that has prerolled since */
+void
+gbp_player_apply_tracks (GbpPlayer *player)
+{
+  g_return_if_fail (player != NULL);
+
+  if (!player->priv->have_pipeline)
+    return;
+
+  apply_current_track (player, GBP_PLAYER_TRACK_AUDIO);
+  apply_current_track (player, GBP_PLAYER_TRACK_TEXT);
+}
+
+/* can be called from any thread */
+static GstCaps *
+get_stream_caps (GbpPlayer *player, const char *pad_signal)
+{
+  GstElement *pipeline;
+  GstPad *pad = NULL;
+  GstCaps *caps = NULL;
+
+  pipeline = get_pipeline (player);
+  if (pipeline == NULL)
+    return NULL;
+
+  /* stream 0 is the one playbin2 selects by default */
+  g_signal_emit_by_name (pipeline, pad_signal, 0, &pad);
+  if (pad != NULL) {
+    caps = gst_pad_get_negotiated_caps (pad);
+    gst_object_unref (pad);
+  }
+  gst_object_unref (pipeline);
+
+  return caps;
+}
+
+GbpPlayerPreload
+gbp_player_get_preload (GbpPlayer *player)
+{
+  g_return_val_if_fail (player != NULL, GBP_PLAYER_PRELOAD_NONE);
+
+  return player->priv->preload;
+}
+
+static gboolean
+preload_timeout_cb (GstClock *clock, GstClockTime time, GstClockID id,
+    gpointer user_data)
+{
+  GbpPlayer *player = (GbpPlayer *) user_data;
+
+  /* unscheduled while the clock was calling us */
+  GST_OBJECT_LOCK (player);
+  if (player->priv->preload_timeout_id != id) {
+    GST_OBJECT_UNLOCK (player);
+    return TRUE;
+  }
+  gst_object_ref (player);
+  GST_OBJECT_UNLOCK (player);
+
+  GST_INFO_OBJECT (player, "preroll timed out");
+  g_signal_emit (player, player_signals[SIGNAL_PRELOADED], 0);
+  gst_object_unref (player);
+
+  return TRUE;
+}
+
+/* called on the lane when the preload is finished or the page asks for a
+ * state. Returns whether a preload was in progress. */
+static gboolean
+end_preload (GbpPlayer *player)
+{
+  GstClockID id;
+  gboolean pending;
+
+  GST_OBJECT_LOCK (player);
+  pending = player->priv->preload_pending;
+  player->priv->preload_pending = FALSE;
+  id = player->priv->preload_timeout_id;
+  player->priv->preload_timeout_id = NULL;
+  if (id != NULL)
+    gst_clock_id_unschedule (id);
+  GST_OBJECT_UNLOCK (player);
+
+  /* the id holds a ref to the player */
+  if (id != NULL) {
+    gst_clock_id_unref (id);
+    gst_object_unref (player);
+  }
+
+  if (pending)
+    player->priv->preloading = FALSE;
+
+  return pending;
+}
+
+/* starts prerolling without waiting for it, so that a stuck preroll doesn't
+ * hold a worker. ::preloaded tells when to call gbp_player_finish_preload (). */
+void
+gbp_player_preload (GbpPlayer *player)
+{
+  GstElement *pipeline;
+  GstState state, pending;
+  GstStateChangeReturn ret;
+  gboolean metadata;
+
+  g_return_if_fail (player != NULL);
+
+  if (player->priv->preload == GBP_PLAYER_PRELOAD_NONE ||
+      player->priv->preload_pending)
+    return;
+
+  metadata = player->priv->preload == GBP_PLAYER_PRELOAD_METADATA;
+
+  if (player->priv->have_pipeline) {
+    /* don't get in the way of playback that started before we got to run */
+    gst_element_get_state (GST_ELEMENT (player->priv->pipeline),
+        &state, &pending, 0);
+    if (state >= GST_STATE_PAUSED || pending >= GST_STATE_PAUSED)
+      return;
+
+    if (metadata && !player->priv->uri_changed &&
+        player->priv->duration != GST_CLOCK_TIME_NONE)
+      return;
+  }
+
+  if (!prepare_pipeline (player))
+    return;
+
+  GST_INFO_OBJECT (player, "preloading %s",
+      preload_names[player->priv->preload]);
+
+  pipeline = GST_ELEMENT (player->priv->pipeline);
+
+  /* a metadata preload isn't a state change as far as our users are
+   * concerned */
+  player->priv->preloading = metadata;
+
+  GST_OBJECT_LOCK (player);
+  player->priv->preload_pending = TRUE;
+  player->priv->preload_timeout_id =
+      gst_clock_new_single_shot_id (player->priv->clock,
+          gst_clock_get_time (player->priv->clock) + PRELOAD_TIMEOUT);
+  gst_clock_id_wait_async (player->priv->preload_timeout_id,
+      preload_timeout_cb, gst_object_ref (player));
+  GST_OBJECT_UNLOCK (player);
+
+  ret = gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (ret != GST_STATE_CHANGE_ASYNC)
+    gbp_player_finish_preload (player);
+}
+
+/* collects the duration and caps once the preload has prerolled, and
+ * releases the pipeline after a metadata preload. Does nothing if the page
+ * asked for a state since. Called on the lane. */
+void
+gbp_player_finish_preload (GbpPlayer *player)
+{
+  GstElement *pipeline;
+  GstState state = GST_STATE_VOID_PENDING;
+  gint64 duration;
+  GstFormat format = GST_FORMAT_TIME;
+  GstCaps *video_caps, *audio_caps;
+  GstStructure *structure;
+  gboolean metadata;
+
+  g_return_if_fail (player != NULL);
+
+  metadata = player->priv->preloading;
+  if (!end_preload (player))
+    return;
+
+  pipeline = GST_ELEMENT (player->priv->pipeline);
+  gst_element_get_state (pipeline, &state, NULL, 0);
+
+  if (state >= GST_STATE_PAUSED) {
+    if (gst_element_query_duration (pipeline, &format, &duration))
+      player->priv->duration = duration;
+
+    video_caps = get_stream_caps (player, "get-video-pad");
+    audio_caps = get_stream_caps (player, "get-audio-pad");
+
+    GST_OBJECT_LOCK (player);
+    gst_caps_replace (&player->priv->video_caps, video_caps);
+    gst_caps_replace (&player->priv->audio_caps, audio_caps);
+    GST_OBJECT_UNLOCK (player);
+
+    if (video_caps != NULL)
+      gst_caps_unref (video_caps);
+    if (audio_caps != NULL)
+      gst_caps_unref (audio_caps);
+
+    GST_INFO_OBJECT (player, "preloaded, duration %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (player->priv->duration));
+
+    /* fills the metadata cache for the other instances */
+    structure = gbp_player_get_metadata (player);
+    if (structure != NULL) {
+      gbp_metadata_cache_insert (player->priv->uri, structure);
+      gst_structure_free (structure);
+    }
+  } else {
+    GST_INFO_OBJECT (player, "preroll didn't complete");
+  }
+
+  if (metadata) {
+    /* we have what we came for, release decoders and sinks without telling
+     * our users */
+    player->priv->preloading = TRUE;
+    gbp_player_stop (player);
+    player->priv->preloading = FALSE;
+  }
+}
+
+GstCaps *
+gbp_player_get_video_caps (GbpPlayer *player)
+{
+  GstCaps *caps = NULL;
+
+  g_return_val_if_fail (player != NULL, NULL);
+
+  GST_OBJECT_LOCK (player);
+  if (player->priv->video_caps != NULL)
+    caps = gst_caps_ref (player->priv->video_caps);
+  GST_OBJECT_UNLOCK (player);
+
+  if (caps == NULL && player->priv->have_pipeline)
+    caps = get_stream_caps (player, "get-video-pad");
+
+  return caps;
+}
+
+GstCaps *
+gbp_player_get_audio_caps (GbpPlayer *player)
+{
+  GstCaps *caps = NULL;
+
+  g_return_val_if_fail (player != NULL, NULL);
+
+  GST_OBJECT_LOCK (player);
+  if (player->priv->audio_caps != NULL)
+    caps = gst_caps_ref (player->priv->audio_caps);
+  GST_OBJECT_UNLOCK (player);
+
+  if (caps == NULL && player->priv->have_pipeline)
+    caps = get_stream_caps (player, "get-audio-pad");
+
+  return caps;
+}
+
+/* returns the tags, caps and duration known for the current uri. Instances
+ * that haven't found out anything yet get what others found for the same uri
+ * from the metadata cache. Returns NULL if nothing is known. Doesn't update
+ * the cache, preload and probe do that once they have all of it. */
+GstStructure *
+gbp_player_get_metadata (GbpPlayer *player)
+{
+  GstStructure *metadata;
+  GstTagList *tags = NULL;
+  GstCaps *video_caps, *audio_caps;
+  GstClockTime duration;
+  char *uri;
+
+  g_return_val_if_fail (player != NULL, NULL);
+
+  GST_OBJECT_LOCK (player);
+  uri = g_strdup (player->priv->uri);
+  if (player->priv->tags != NULL)
+    tags = gst_tag_list_copy (player->priv->tags);
+  GST_OBJECT_UNLOCK (player);
+
+  if (uri == NULL) {
+    if (tags != NULL)
+      gst_tag_list_free (tags);
+    return NULL;
+  }
+
+  duration = gbp_player_get_duration (player);
+  video_caps = gbp_player_get_video_caps (player);
+  audio_caps = gbp_player_get_audio_caps (player);
+
+  if (tags == NULL && duration == GST_CLOCK_TIME_NONE &&
+      video_caps == NULL && audio_caps == NULL) {
+    metadata = gbp_metadata_cache_lookup (uri);
+    g_free (uri);
+    return metadata;
+  }
+
+  g_free (uri);
+  metadata = gbp_metadata_new (tags, video_caps, audio_caps, duration);
+
+  if (tags != NULL)
+    gst_tag_list_free (tags);
+  if (video_caps != NULL)
+    gst_caps_unref (video_caps);
+  if (audio_caps != NULL)
+    gst_caps_unref (audio_caps);
+
+  return metadata;
+}
+
+void
+gbp_player_stop (GbpPlayer *player)
+{
+  g_return_if_fail (player != NULL);
+
+  /* the ids hold a ref to the player, drop them before the player goes */
+  update_time_updates (player, FALSE);
+  end_preload (player);
+
+  if (player->priv->pipeline == NULL)
+    return;
+
+  gst_element_set_state (GST_ELEMENT (player->priv->pipeline),
+      GST_STATE_NULL);
+  if (gst_element_get_state (GST_ELEMENT (player->priv->pipeline),
+        NULL, NULL, player->priv->state_timeout) != GST_STATE_CHANGE_SUCCESS)
+    GST_WARNING_OBJECT (player, "pipeline didn't stop in time");
+}
+
+/* one line per element with its current and pending state */
+static char *
+describe_pipeline (GstElement *pipeline)
+{
+  GString *description;
+  GstIterator *it;
+  GstElement *element;
+  GstState state, pending;
+  gpointer item;
+  gsize header_len;
+  gboolean done = FALSE;
+
+  description = g_string_new (NULL);
+  gst_element_get_state (pipeline, &state, &pending, 0);
+  g_string_append_printf (description, "%s: %s pending %s\n",
+      GST_OBJECT_NAME (pipeline),
+      gst_element_state_get_name (state),
+      gst_element_state_get_name (pending));
+  header_len = description->len;
+
+  it = gst_bin_iterate_recurse (GST_BIN (pipeline));
+  while (!done) {
+    switch (gst_iterator_next (it, &item)) {
+      case GST_ITERATOR_OK:
+        element = GST_ELEMENT (item);
+        gst_element_get_state (element, &state, &pending, 0);
+        g_string_append_printf (description, "  %s: %s pending %s\n",
+            GST_OBJECT_NAME (element), gst_element_state_get_name (state),
+            gst_element_state_get_name (pending));
+        gst_object_unref (element);
+        break;
+      case GST_ITERATOR_RESYNC:
+        gst_iterator_resync (it);
+        g_string_truncate (description, header_len);
+        break;
+      default:
+        done = TRUE;
+        break;
+    }
+  }
+  gst_iterator_free (it);
+
+  return g_string_free (description, FALSE);
+}
+
+/* emits GbpPlayer::error with the state of each element as debug. Called
+ * from the watchdog thread. */
+void
+gbp_player_report_state_timeout (GbpPlayer *player, const char *target)
+{
+  GstElement *pipeline;
+  GError *error;
+  char *description;
+
+  g_return_if_fail (player != NULL);
+
+  if (!player->priv->have_pipeline)
+    return;
+
+  pipeline = get_pipeline (player);
+  if (pipeline == NULL)
+    return;
+
+  description = describe_pipeline (pipeline);
+  gst_object_unref (pipeline);
+  GST_WARNING_OBJECT (player, "timed out going to %s\n%s",
+      target, description);
+
+  error = g_error_new (GST_CORE_ERROR, GST_CORE_ERROR_STATE_CHANGE,
+      "timed out going to %s", target);
+  g_signal_emit (player, player_signals[SIGNAL_ERROR], 0,
+      error, description);
+  g_error_free (error);
+  g_free (description);
+}
+
+/* drops the pipeline, the next start or pause builds a new one */
+void
+gbp_player_rebuild (GbpPlayer *player)
+{
+  g_return_if_fail (player != NULL);
+
+  GST_INFO_OBJECT (player, "rebuilding pipeline");
+
+  player->priv->have_pipeline = FALSE;
+}
+
+static gpointer
+stream_block_alloc ()
+{
+  gpointer block;
+
+  g_static_mutex_lock (&stream_block_pool_lock);
+  block = g_trash_stack_pop (&stream_block_pool);
+  if (block != NULL)
+    stream_block_pool_size -= 1;
+  g_static_mutex_unlock (&stream_block_pool_lock);
+
+  if (block == NULL)
+    block = g_malloc (STREAM_BLOCK_SIZE);
+
+  return block;
+}
+
+static void
+stream_block_free (gpointer block)
+{
+  g_static_mutex_lock (&stream_block_pool_lock);
+  if (stream_block_pool_size < STREAM_POOL_MAX_BLOCKS) {
+    g_trash_stack_push (&stream_block_pool, block);
+    stream_block_pool_size += 1;
+    block = NULL;
+  }
+  g_static_mutex_unlock (&stream_block_pool_lock);
+
+  if (block != NULL)
+    g_free (block);
+}
+
+gint32
+gbp_player_stream_write_ready (GbpPlayer *player)
+{
+  gint32 ready;
+
+  g_return_val_if_fail (player != NULL, 0);
+
+  g_mutex_lock (player->priv->stream_lock);
+  if (player->priv->appsrc == NULL ||
+      g_atomic_int_get (&player->priv->stream_blocked))
+    /* returning 0 makes the browser hold the data and retry later */
+    ready = 0;
+  else
+    ready = STREAM_MAX_BYTES;
+  g_mutex_unlock (player->priv->stream_lock);
+
+  return ready;
+}
+
+/* returns how many bytes to request at *offset to have length bytes plus
+ * about a read ahead window in flight, called with stream_lock */
+static guint64
+stream_next_request_unlocked (GbpPlayer *player, guint length,
+    guint64 *offset)
+{
+  guint64 start = player->priv->stream_offset;
+  guint64 request;
+
+  /* keep about a read ahead window in flight past the current read so that
+   * sequential reads don't stall on a browser round trip */
+  if (player->priv->stream_requested >= start + length +
+      STREAM_READ_AHEAD / 2)
+    return 0;
+
+  start = MAX (start, player->priv->stream_requested);
+  request = MAX (length, STREAM_READ_AHEAD);
+  if (start + request > player->priv->stream_size)
+    request = player->priv->stream_size - start;
+
+  player->priv->stream_requested = start + request;
+  *offset = start;
+
+  return request;
+}
+
+static void
+emit_need_range (GbpPlayer *player, guint64 offset, guint64 request)
+{
+  GST_DEBUG_OBJECT (player, "requesting range %" G_GUINT64_FORMAT
+      "-%" G_GUINT64_FORMAT, offset, offset + request);
+
+  g_signal_emit (player, player_signals[SIGNAL_NEED_RANGE], 0,
+      offset, (guint) request);
+}
+
+gint32
+gbp_player_stream_write (GbpPlayer *player, guint64 offset,
+    const guint8 *data, gint32 len)
+{
+  GstBuffer *buffer;
+  GstFlowReturn flow = GST_FLOW_OK;
+  gint32 written = 0;
+  guint size;
+  guint64 request_offset = 0;
+  guint64 request = 0;
+
+  g_return_val_if_fail (player != NULL, -1);
+  g_return_val_if_fail (data != NULL, -1);
+
+  /* stream_lock is held while pushing so that a concurrent seek-data can't
+   * interleave stale data with the new range. appsrc emits enough-data from
+   * push_buffer, which is why stream_blocked is only accessed atomically. */
+  g_mutex_lock (player->priv->stream_lock);
+  if (player->priv->appsrc == NULL) {
+    g_mutex_unlock (player->priv->stream_lock);
+    return 0;
+  }
+
+  if (player->priv->stream_random_access) {
+    /* only keep what is contiguous with the offset appsrc expects next,
+     * anything else belongs to a range requested before a seek */
+    if (offset > player->priv->stream_offset ||
+        offset + len <= player->priv->stream_offset) {
+      GST_LOG_OBJECT (player, "dropping %d bytes at offset %" G_GUINT64_FORMAT
+          ", expected %" G_GUINT64_FORMAT, len, offset,
+          player->priv->stream_offset);
+
+      if (offset > player->priv->stream_offset &&
+          offset < player->priv->stream_requested) {
+        /* the range in front of this one went missing, need-data won't ask
+         * for it again since it counts it as in flight */
+        player->priv->stream_requested = player->priv->stream_offset;
+        if (!g_atomic_int_get (&player->priv->stream_blocked))
+          request = stream_next_request_unlocked (player, 0, &request_offset);
+      }
+      g_mutex_unlock (player->priv->stream_lock);
+
+      if (request > 0)
+        emit_need_range (player, request_offset, request);
+
+      return len;
+    }
+
+    written = player->priv->stream_offset - offset;
+  }
+
+  while (written < len && flow == GST_FLOW_OK) {
+    size = MIN (len - written, STREAM_BLOCK_SIZE);
+
+    buffer = gst_buffer_new ();
+    GST_BUFFER_MALLOCDATA (buffer) = stream_block_alloc ();
+    GST_BUFFER_FREE_FUNC (buffer) = stream_block_free;
+    GST_BUFFER_DATA (buffer) = GST_BUFFER_MALLOCDATA (buffer);
+    GST_BUFFER_SIZE (buffer) = size;
+    GST_BUFFER_OFFSET (buffer) = player->priv->stream_offset;
+    memcpy (GST_BUFFER_DATA (buffer), data + written, size);
+
+    /* takes ownership of buffer */
+    flow = gst_app_src_push_buffer (GST_APP_SRC (player->priv->appsrc),
+        buffer);
+    player->priv->stream_offset += size;
+    written += size;
+  }
+  g_mutex_unlock (player->priv->stream_lock);
+
+  if (flow != GST_FLOW_OK)
+    GST_INFO_OBJECT (player, "appsrc refused data: %s",
+        gst_flow_get_name (flow));
+
+  return written;
+}
+
+void
+gbp_player_stream_end (GbpPlayer *player)
+{
+  g_return_if_fail (player != NULL);
+
+  g_mutex_lock (player->priv->stream_lock);
+  if (player->priv->appsrc != NULL)
+    gst_app_src_end_of_stream (GST_APP_SRC (player->priv->appsrc));
+  g_mutex_unlock (player->priv->stream_lock);
+}
+
+static void
+setup_appsrc (GbpPlayer *player, GstElement *appsrc)
+{
+  gboolean random_access;
+
+  g_mutex_lock (player->priv->stream_lock);
+  /* random access needs the size to know where the stream ends */
+  random_access = player->priv->stream_seekable &&
+      player->priv->stream_size > 0;
+
+  g_object_set (appsrc, "max-bytes", (guint64) STREAM_MAX_BYTES,
+      "format", GST_FORMAT_BYTES, NULL);
+  gst_app_src_set_stream_type (GST_APP_SRC (appsrc),
+      random_access ? GST_APP_STREAM_TYPE_RANDOM_ACCESS :
+      GST_APP_STREAM_TYPE_STREAM);
+  gst_app_src_set_callbacks (GST_APP_SRC (appsrc),
+      &appsrc_callbacks, player, NULL);
+  gst_app_src_set_size (GST_APP_SRC (appsrc), player->priv->stream_size);
+
+  if (player->priv->appsrc != NULL)
+    g_object_unref (player->priv->appsrc);
+  player->priv->appsrc = g_object_ref (appsrc);
+  player->priv->stream_random_access = random_access;
+  player->priv->stream_offset = 0;
+  player->priv->stream_requested = 0;
+  g_atomic_int_set (&player->priv->stream_blocked, FALSE);
+  g_mutex_unlock (player->priv->stream_lock);
+
+  GST_INFO_OBJECT (player, "reading %s stream",
+      random_access ? "random access" : "sequential");
+
+  /* a new source needs the stream from the start, ask for it. Random access
+   * sources can reuse an open stream, the listener decides. */
+  g_signal_emit (player, player_signals[SIGNAL_NEED_STREAM], 0);
+}
+
+static void
+appsrc_need_data_cb (GstAppSrc *appsrc, guint length, gpointer user_data)
+{
+  GbpPlayer *player = GBP_PLAYER (user_data);
+  guint64 offset = 0;
+  guint64 request = 0;
+
+  g_atomic_int_set (&player->priv->stream_blocked, FALSE);
+
+  g_mutex_lock (player->priv->stream_lock);
+  if (player->priv->stream_random_access)
+    request = stream_next_request_unlocked (player, length, &offset);
+  g_mutex_unlock (player->priv->stream_lock);
+
+  if (request > 0)
+    emit_need_range (player, offset, request);
+}
+
+static void
+appsrc_enough_data_cb (GstAppSrc *appsrc, gpointer user_data)
+{
+  GbpPlayer *player = GBP_PLAYER (user_data);
+
+  g_atomic_int_set (&player->priv->stream_blocked, TRUE);
+}
+
+static gboolean
+appsrc_seek_data_cb (GstAppSrc *appsrc, guint64 offset, gpointer user_data)
+{
+  GbpPlayer *player = GBP_PLAYER (user_data);
+
+  GST_DEBUG_OBJECT (player, "seeking stream to %" G_GUINT64_FORMAT, offset);
+
+  /* whatever is still in flight is for the old position, need-data will
+   * request the new range */
+  g_mutex_lock (player->priv->stream_lock);
+  player->priv->stream_offset = offset;
+  player->priv->stream_requested = offset;
+  g_mutex_unlock (player->priv->stream_lock);
+
+  return TRUE;
+}
+
+static gboolean
+cache_data_probe_cb (GstPad *pad, GstMiniObject *object, gpointer user_data)
+{
+  GbpCacheEntry *entry = (GbpCacheEntry *) user_data;
+  GstBuffer *buffer;
+  GstEvent *event;
+
+  if (GST_IS_BUFFER (object)) {
+    buffer = GST_BUFFER (object);
+    gbp_cache_entry_write (entry, GST_BUFFER_OFFSET (buffer),
+        GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer));
+  } else if (GST_IS_EVENT (object)) {
+    event = GST_EVENT (object);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_NEWSEGMENT) {
+      GstFormat format;
+      gint64 start;
+
+      gst_event_parse_new_segment (event, NULL, NULL, &format,
+          &start, NULL, NULL);
+      if (format == GST_FORMAT_BYTES)
+        gbp_cache_entry_seek (entry, start);
+    } else if (GST_EVENT_TYPE (event) == GST_EVENT_EOS) {
+      GstFormat format = GST_FORMAT_BYTES;
+      gint64 size;
+
+      /* don't keep a truncated download around */
+      if (!gst_pad_query_duration (pad, &format, &size) ||
+          format != GST_FORMAT_BYTES || size <= 0)
+        size = -1;
+      gbp_cache_entry_commit (entry, (guint64) size);
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+setup_cache_writer (GbpPlayer *player, GstElement *source, const char *uri)
+{
+  GbpCacheEntry *entry;
+  GstPad *pad;
+
+  entry = gbp_cache_create_entry (gbp_cache_get_default (),
+      uri, player->priv->cache_validator);
+  if (entry == NULL)
+    /* already cached or being written by another instance */
+    return;
+
+  pad = gst_element_get_static_pad (source, "src");
+  if (pad == NULL) {
+    gbp_cache_entry_unref (entry);
+    return;
+  }
+
+  /* the probe owns entry, the write is aborted when the source goes away
+   * without committing it */
+  gst_pad_add_data_probe_full (pad, G_CALLBACK (cache_data_probe_cb),
+      entry, (GDestroyNotify) gbp_cache_entry_unref);
+  gst_object_unref (pad);
+}
+
+static void
+playbin_source_cb (GstElement *playbin,
+    GParamSpec *pspec, GbpPlayer *player)
+{
+  GstElement *element;
+  GObjectClass *klass;
+  char *uri;
+
+  g_object_get (G_OBJECT (playbin), "source", &element, NULL);
+  if (element == NULL)
+    return;
+
+  klass = G_OBJECT_GET_CLASS (element);
+
+  GST_OBJECT_LOCK (player);
+  uri = g_strdup (player->priv->uri);
+  GST_OBJECT_UNLOCK (player);
+
+  if (GST_IS_APP_SRC (element)) {
+    setup_appsrc (player, element);
+  } else if (player->priv->cache_entry != NULL) {
+    /* playing from the cache */
+    if (g_object_class_find_property (klass, "use-mmap"))
+      g_object_set (element, "use-mmap", TRUE, NULL);
+  } else if (player->priv->cache && uri != NULL &&
+      (g_str_has_prefix (uri, "http://") ||
+       g_str_has_prefix (uri, "https://"))) {
+    setup_cache_writer (player, element, uri);
+  }
+  g_free (uri);
+
+  if (g_object_class_find_property (klass, "latency")) {
+    g_object_set (element, "latency",
+        GST_TIME_AS_MSECONDS (player->priv->latency), NULL);
+  }
+
+  if (g_object_class_find_property (klass, "tcp-timeout")) {
+    g_object_set (element, "tcp-timeout",
+        GST_TIME_AS_USECONDS (player->priv->tcp_timeout), NULL);
+  }
+
+  gst_object_unref (element);
+}
+
+static void
+autovideosink_element_added_cb (GstElement *autovideosink,
+    GstElement *element, GbpPlayer *player)
+{
+  GObjectClass *klass;
+
+  GST_INFO_OBJECT (player, "using sink %s", gst_element_get_name (element));
+
+  klass = G_OBJECT_GET_CLASS (element);
+  if (!g_object_class_find_property (klass, "double-buffer"))
+    return;
+
+  g_object_set (G_OBJECT (element), "double-buffer", FALSE, NULL);
+}
+
+/* called from streaming threads */
+static void
+emit_preloaded (GbpPlayer *player)
+{
+  gboolean pending;
+
+  GST_OBJECT_LOCK (player);
+  pending = player->priv->preload_pending;
+  GST_OBJECT_UNLOCK (player);
+
+  if (pending)
+    g_signal_emit (player, player_signals[SIGNAL_PRELOADED], 0);
+}
+
+static void
+on_bus_state_changed_cb (GstBus *bus, GstMessage *message,
+    GbpPlayer *player)
+{
+  GstState old_state, new_state, pending_state;
+
+  if (message->src != GST_OBJECT (player->priv->pipeline))
+    return;
+
+  gst_message_parse_state_changed (message,
+      &old_state, &new_state, &pending_state);
+
+  if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED) {
+    /* the tracks are known now. Selecting them sets playbin2 properties,
+     * which can't be done from here in the middle of a state change. */
+    g_signal_emit (player, player_signals[SIGNAL_TRACKS_CHANGED], 0);
+    emit_preloaded (player);
+  }
+
+  if (player->priv->preloading)
+    return;
+
+  if (new_state == GST_STATE_READY && old_state > GST_STATE_READY &&
+      pending_state <= GST_STATE_READY) {
+    update_time_updates (player, FALSE);
+    g_signal_emit (player, player_signals[SIGNAL_STOPPED], 0);
+  } else if (new_state == GST_STATE_PAUSED &&
+        pending_state == GST_STATE_VOID_PENDING) {
+    update_time_updates (player, FALSE);
+    g_signal_emit (player, player_signals[SIGNAL_PAUSED], 0);
+  } else if (new_state == GST_STATE_PLAYING &&
+      pending_state == GST_STATE_VOID_PENDING) {
+    g_signal_emit (player, player_signals[SIGNAL_PLAYING], 0);
+    update_time_updates (player, TRUE);
+  }
+}
+
+static gboolean
+time_update_cb (GstClock *clock, GstClockTime time, GstClockID id,
+    gpointer user_data)
+{
+  GbpPlayer *player = (GbpPlayer *) user_data;
+  GstClockTime position;
+
+  /* unscheduled while the clock was calling us. Otherwise keep the player
+   * alive, the ref of the id may be dropped by an unschedule racing with
+   * the emission. */
+  GST_OBJECT_LOCK (player);
+  if (player->priv->time_update_id != id) {
+    GST_OBJECT_UNLOCK (player);
+    return TRUE;
+  }
+  gst_object_ref (player);
+  GST_OBJECT_UNLOCK (player);
+
+  position = gbp_player_get_position (player);
+  if (GST_CLOCK_TIME_IS_VALID (position))
+    g_signal_emit (player, player_signals[SIGNAL_TIME_UPDATE], 0, position);
+
+  gst_object_unref (player);
+
+  return TRUE;
+}
+
+/* schedules or unschedules the ::timeupdate id. playing is whether the
+ * pipeline is PLAYING. The id holds a ref to the player. */
+static void
+update_time_updates (GbpPlayer *player, gboolean playing)
+{
+  GbpPlayerPrivate *priv = player->priv;
+  GstClockID id = NULL;
+  gboolean run;
+
+  GST_OBJECT_LOCK (player);
+  priv->playing = playing;
+  run = playing && priv->visible && priv->time_update_interval > 0 &&
+      !priv->disposed;
+
+  if (!run && priv->time_update_id != NULL) {
+    id = priv->time_update_id;
+    priv->time_update_id = NULL;
+    gst_clock_id_unschedule (id);
+  } else if (run && priv->time_update_id == NULL) {
+    priv->time_update_id = gst_clock_new_periodic_id (priv->clock,
+        gst_clock_get_time (priv->clock) + priv->time_update_interval,
+        priv->time_update_interval);
+    gst_clock_id_wait_async (priv->time_update_id, time_update_cb,
+        gst_object_ref (player));
+  }
+  GST_OBJECT_UNLOCK (player);
+
+  if (id != NULL) {
+    gst_clock_id_unref (id);
+    gst_object_unref (player);
+  }
+}
+
+static void
+on_bus_eos_cb (GstBus *bus, GstMessage *message,
+    GbpPlayer *player)
+{
+  player->priv->reset_state = TRUE;
+  update_time_updates (player, FALSE);
+  g_signal_emit (player, player_signals[SIGNAL_EOS], 0);
+}
+
+static void
+on_bus_error_cb (GstBus *bus, GstMessage *message,
+    GbpPlayer *player)
+{
+  GError *error;
+  char *debug;
+
+  gst_message_parse_error (message, &error, &debug);
+
+  player->priv->reset_state = TRUE;
+  g_signal_emit (player, player_signals[SIGNAL_ERROR], 0, error, debug);
+  /* the preroll won't complete */
+  emit_preloaded (player);
+}
+
+static void
+on_bus_element_cb (GstBus *bus, GstMessage *message,
+    GbpPlayer *player)
+{
+  const GstStructure *structure;
   const gchar *structure_name;
   GstElement *sink;
   structure = gst_message_get_structure (message);
@@ -615,3 +2217,91 @@ on_bus_element_cb (GstBus *bus, GstMessage *message,
     gst_x_overlay_set_xwindow_id (GST_X_OVERLAY (sink), player->priv->xid);
   }
 }
+
+static gint
+compare_hlsdemux (GstElement *element, gpointer user_data)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (factory != NULL &&
+      !strcmp (GST_PLUGIN_FEATURE_NAME (factory), "hlsdemux"))
+    return 0;
+
+  gst_object_unref (element);
+  return 1;
+}
+
+/* called from streaming threads */
+static void
+set_connection_speed (GbpPlayer *player, guint speed)
+{
+  GstIterator *iterator;
+  GstElement *pipeline;
+  GstElement *hlsdemux;
+
+  pipeline = get_pipeline (player);
+  if (pipeline == NULL)
+    return;
+
+  GST_INFO_OBJECT (player, "connection speed %u kbps", speed);
+
+  /* used when playbin2 plugs the next demuxer */
+  g_object_set (pipeline, "connection-speed", speed, NULL);
+
+  iterator = gst_bin_iterate_recurse (GST_BIN (pipeline));
+  hlsdemux = (GstElement *) gst_iterator_find_custom (iterator,
+      (GCompareFunc) compare_hlsdemux, NULL);
+  gst_iterator_free (iterator);
+  gst_object_unref (pipeline);
+
+  if (hlsdemux == NULL)
+    return;
+
+  /* picks the variant of the next fragment */
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (hlsdemux),
+        "connection-speed"))
+    g_object_set (hlsdemux, "connection-speed", speed, NULL);
+  gst_object_unref (hlsdemux);
+}
+
+static void
+on_bus_buffering_cb (GstBus *bus, GstMessage *message,
+    GbpPlayer *player)
+{
+  gint percent = -1;
+  gint avg_in = -1;
+  guint speed = 0;
+
+  if (!player->priv->adaptive)
+    return;
+
+  gst_message_parse_buffering (message, &percent);
+  gst_message_parse_buffering_stats (message, NULL, &avg_in, NULL, NULL);
+
+  GST_OBJECT_LOCK (player);
+  if (player->priv->abr != NULL &&
+      gbp_abr_add_sample (player->priv->abr, avg_in, percent))
+    speed = gbp_abr_get_connection_speed (player->priv->abr);
+  GST_OBJECT_UNLOCK (player);
+
+  if (speed != 0)
+    set_connection_speed (player, speed);
+}
+
+static void
+on_bus_tag_cb (GstBus *bus, GstMessage *message,
+    GbpPlayer *player)
+{
+  GstTagList *tags;
+
+  gst_message_parse_tag (message, &tags);
+
+  GST_OBJECT_LOCK (player);
+  if (player->priv->tags == NULL) {
+    player->priv->tags = tags;
+  } else {
+    gst_tag_list_insert (player->priv->tags, tags, GST_TAG_MERGE_REPLACE);
+    gst_tag_list_free (tags);
+  }
+  GST_OBJECT_UNLOCK (player);
+}
@@ -45,6 +45,17 @@ typedef struct _GbpPlayer GbpPlayer;
 typedef struct _GbpPlayerPrivate GbpPlayerPrivate;
 typedef struct _GbpPlayerClass GbpPlayerClass;
 
+typedef enum {
+  GBP_PLAYER_PRELOAD_NONE,
+  GBP_PLAYER_PRELOAD_METADATA,
+  GBP_PLAYER_PRELOAD_AUTO
+} GbpPlayerPreload;
+
+typedef enum {
+  GBP_PLAYER_TRACK_AUDIO,
+  GBP_PLAYER_TRACK_TEXT
+} GbpPlayerTrackType;
+
 struct _GbpPlayer {
   GstObject object;
 
@@ -60,16 +71,41 @@ struct _GbpPlayerClass {
   void (*stopped)(GbpPlayer *player);
   void (*eos)(GbpPlayer *player);
   void (*error)(GbpPlayer *player, GError *error, const char *debug);
+  void (*need_stream)(GbpPlayer *player);
+  void (*need_range)(GbpPlayer *player, guint64 offset, guint length);
+  void (*time_update)(GbpPlayer *player, GstClockTime position);
+  void (*tracks_changed)(GbpPlayer *player);
+  void (*preloaded)(GbpPlayer *player);
 };
 
 GType gbp_player_get_type(void);
 void gbp_player_start (GbpPlayer *player);
 void gbp_player_pause (GbpPlayer *player);
 void gbp_player_stop (GbpPlayer *player);
+void gbp_player_preload (GbpPlayer *player);
+void gbp_player_finish_preload (GbpPlayer *player);
+GbpPlayerPreload gbp_player_get_preload (GbpPlayer *player);
 GstClockTime gbp_player_get_duration (GbpPlayer *player);
 GstClockTime gbp_player_get_position (GbpPlayer *player);
+gboolean gbp_player_get_settled_state (GbpPlayer *player, GstState *state);
+void gbp_player_report_state_timeout (GbpPlayer *player, const char *target);
+void gbp_player_rebuild (GbpPlayer *player);
+GstCaps *gbp_player_get_video_caps (GbpPlayer *player);
+GstCaps *gbp_player_get_audio_caps (GbpPlayer *player);
+GstStructure *gbp_player_get_metadata (GbpPlayer *player);
 gboolean gbp_player_seek (GbpPlayer *player,
     GstClockTime position, gdouble rate);
+gboolean gbp_player_step_frames (GbpPlayer *player, gint frames);
+GList *gbp_player_get_tracks (GbpPlayer *player, GbpPlayerTrackType type);
+gint gbp_player_get_current_track (GbpPlayer *player,
+    GbpPlayerTrackType type);
+gboolean gbp_player_set_current_track (GbpPlayer *player,
+    GbpPlayerTrackType type, gint track);
+void gbp_player_apply_tracks (GbpPlayer *player);
+gint32 gbp_player_stream_write_ready (GbpPlayer *player);
+gint32 gbp_player_stream_write (GbpPlayer *player, guint64 offset,
+    const guint8 *data, gint32 len);
+void gbp_player_stream_end (GbpPlayer *player);
 
 G_END_DECLS
 
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <gst/pbutils/pbutils.h>
+#include "gbp-probe.h"
+#include "gbp-metadata.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gbp_player_debug);
+#define GST_CAT_DEFAULT gbp_player_debug
+
+/* probing runs on its own pool so that it never takes workers away from
+ * playback */
+#define PROBE_THREAD_POOL_MAX_SIZE 4
+#define PROBE_TIMEOUT (10 * GST_SECOND)
+
+typedef struct
+{
+  char *uri;
+  GbpProbeFunc func;
+  gpointer user_data;
+} ProbeTask;
+
+static GThreadPool *probe_thread_pool;
+static volatile gint probe_shutting_down;
+
+static void probe_thread_pool_func (gpointer push_data, gpointer pool_data);
+
+void
+gbp_probe_init ()
+{
+  g_return_if_fail (probe_thread_pool == NULL);
+
+  gst_pb_utils_init ();
+
+  probe_shutting_down = FALSE;
+  probe_thread_pool = g_thread_pool_new (probe_thread_pool_func, NULL,
+      PROBE_THREAD_POOL_MAX_SIZE, FALSE, NULL);
+}
+
+void
+gbp_probe_shutdown ()
+{
+  g_return_if_fail (probe_thread_pool != NULL);
+
+  /* queued tasks are completed with a NULL result, running ones are bounded
+   * by PROBE_TIMEOUT */
+  g_atomic_int_set (&probe_shutting_down, TRUE);
+  g_thread_pool_free (probe_thread_pool, FALSE, TRUE);
+  probe_thread_pool = NULL;
+}
+
+void
+gbp_probe_uri (const char *uri, GbpProbeFunc func, gpointer user_data)
+{
+  ProbeTask *task;
+
+  g_return_if_fail (probe_thread_pool != NULL);
+  g_return_if_fail (uri != NULL);
+  g_return_if_fail (func != NULL);
+
+  task = g_new (ProbeTask, 1);
+  task->uri = g_strdup (uri);
+  task->func = func;
+  task->user_data = user_data;
+
+  g_thread_pool_push (probe_thread_pool, task, NULL);
+}
+
+static GstCaps *
+get_first_stream_caps (GList *streams)
+{
+  if (streams == NULL)
+    return NULL;
+
+  return gst_discoverer_stream_info_get_caps (
+      (GstDiscovererStreamInfo *) streams->data);
+}
+
+static void
+set_codec_description (GstStructure *result, const char *field,
+    const GstCaps *caps)
+{
+  char *description;
+
+  /* only fill in what the tags didn't tell us */
+  if (caps == NULL || gst_structure_has_field (result, field))
+    return;
+
+  description = gst_pb_utils_get_codec_description (caps);
+  if (description != NULL)
+    gst_structure_set (result, field, G_TYPE_STRING, description, NULL);
+  g_free (description);
+}
+
+static GstStructure *
+info_to_structure (const char *uri, GstDiscovererInfo *info)
+{
+  GstStructure *result;
+  GList *video_streams, *audio_streams, *subtitle_streams;
+  GstCaps *video_caps, *audio_caps;
+
+  video_streams = gst_discoverer_info_get_video_streams (info);
+  audio_streams = gst_discoverer_info_get_audio_streams (info);
+  subtitle_streams = gst_discoverer_info_get_subtitle_streams (info);
+  video_caps = get_first_stream_caps (video_streams);
+  audio_caps = get_first_stream_caps (audio_streams);
+
+  result = gbp_metadata_new (gst_discoverer_info_get_tags (info),
+      video_caps, audio_caps, gst_discoverer_info_get_duration (info));
+  /* share what we found with the instances playing uri */
+  gbp_metadata_cache_insert (uri, result);
+
+  set_codec_description (result, "videoCodec", video_caps);
+  set_codec_description (result, "audioCodec", audio_caps);
+  gst_structure_set (result,
+      "seekable", G_TYPE_BOOLEAN, gst_discoverer_info_get_seekable (info),
+      "videoStreams", G_TYPE_INT, g_list_length (video_streams),
+      "audioStreams", G_TYPE_INT, g_list_length (audio_streams),
+      "subtitleStreams", G_TYPE_INT, g_list_length (subtitle_streams),
+      NULL);
+
+  if (video_caps != NULL)
+    gst_caps_unref (video_caps);
+  if (audio_caps != NULL)
+    gst_caps_unref (audio_caps);
+  gst_discoverer_stream_info_list_free (video_streams);
+  gst_discoverer_stream_info_list_free (audio_streams);
+  gst_discoverer_stream_info_list_free (subtitle_streams);
+
+  return result;
+}
+
+static GstStructure *
+probe_uri (const char *uri)
+{
+  GstDiscoverer *discoverer;
+  GstDiscovererInfo *info = NULL;
+  GstStructure *result = NULL;
+  GError *error = NULL;
+  const char *message = NULL;
+
+  discoverer = gst_discoverer_new (PROBE_TIMEOUT, &error);
+  if (discoverer != NULL)
+    info = gst_discoverer_discover_uri (discoverer, uri, &error);
+
+  if (info != NULL) {
+    switch (gst_discoverer_info_get_result (info)) {
+      case GST_DISCOVERER_OK:
+        result = info_to_structure (uri, info);
+        break;
+      case GST_DISCOVERER_URI_INVALID:
+        message = "invalid uri";
+        break;
+      case GST_DISCOVERER_TIMEOUT:
+        message = "timeout";
+        break;
+      case GST_DISCOVERER_MISSING_PLUGINS:
+        message = "missing plugins";
+        break;
+      default:
+        break;
+    }
+  }
+
+  if (result == NULL) {
+    if (message == NULL)
+      message = error != NULL ? error->message : "unknown error";
+
+    GST_INFO ("couldn't probe %s: %s", uri, message);
+    result = gst_structure_empty_new ("metadata");
+    gst_structure_set (result, "error", G_TYPE_STRING, message, NULL);
+  }
+
+  gst_structure_set (result, "uri", G_TYPE_STRING, uri, NULL);
+
+  if (error != NULL)
+    g_error_free (error);
+  if (info != NULL)
+    gst_discoverer_info_unref (info);
+  if (discoverer != NULL)
+    g_object_unref (discoverer);
+
+  return result;
+}
+
+static void
+probe_thread_pool_func (gpointer push_data, gpointer pool_data)
+{
+  ProbeTask *task = (ProbeTask *) push_data;
+  GstStructure *result = NULL;
+
+  if (!g_atomic_int_get (&probe_shutting_down)) {
+    GST_DEBUG ("probe worker %p probing %s", g_thread_self (), task->uri);
+    result = probe_uri (task->uri);
+  }
+
+  task->func (task->uri, result, task->user_data);
+
+  g_free (task->uri);
+  g_free (task);
+}
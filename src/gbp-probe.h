@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GBP_PROBE_H
+#define GBP_PROBE_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* called from a probe worker with the result of probing a uri, or NULL if
+ * probing was cancelled by gbp_probe_shutdown (). Takes ownership of result. */
+typedef void (*GbpProbeFunc) (const char *uri, GstStructure *result,
+    gpointer user_data);
+
+void gbp_probe_init ();
+void gbp_probe_shutdown ();
+void gbp_probe_uri (const char *uri, GbpProbeFunc func, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* GBP_PROBE_H */
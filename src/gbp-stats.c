@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include "gbp-stats.h"
+
+static volatile gint stats[GBP_STAT_LAST];
+
+static const char *stat_names[GBP_STAT_LAST] = {
+  "mediaCacheHits",
+  "mediaCacheMisses",
+  "metadataCacheHits",
+  "metadataCacheMisses",
+  "frameCacheHits",
+  "frameCacheMisses",
+  "playbackCommands",
+  "playbackCommandsMerged",
+  "playbackCommandAllocations",
+  "playbackWakeups",
+  "playbackIdleWakeups",
+  "playbackStuckStateChanges",
+  "eventsCollapsed",
+  "playbackWorkers",
+  "playbackActiveWorkers",
+  "playbackIdleWorkers",
+  "playbackMaxQueueDepth",
+  "playbackMaxWait",
+};
+
+void
+gbp_stats_add (GbpStat stat, gint value)
+{
+  g_return_if_fail (stat < GBP_STAT_LAST);
+
+  g_atomic_int_add (&stats[stat], value);
+}
+
+void
+gbp_stats_set (GbpStat stat, gint value)
+{
+  g_return_if_fail (stat < GBP_STAT_LAST);
+
+  g_atomic_int_set (&stats[stat], value);
+}
+
+void
+gbp_stats_update_max (GbpStat stat, gint value)
+{
+  gint current;
+
+  g_return_if_fail (stat < GBP_STAT_LAST);
+
+  do {
+    current = g_atomic_int_get (&stats[stat]);
+    if (value <= current)
+      return;
+  } while (!g_atomic_int_compare_and_exchange (&stats[stat], current, value));
+}
+
+gint
+gbp_stats_get (GbpStat stat)
+{
+  g_return_val_if_fail (stat < GBP_STAT_LAST, 0);
+
+  return g_atomic_int_get (&stats[stat]);
+}
+
+const char *
+gbp_stats_get_name (GbpStat stat)
+{
+  g_return_val_if_fail (stat < GBP_STAT_LAST, NULL);
+
+  return stat_names[stat];
+}
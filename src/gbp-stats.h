@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GBP_STATS_H
+#define GBP_STATS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* process wide counters, exposed to javascript with getStats () */
+typedef enum {
+  GBP_STAT_MEDIA_CACHE_HITS,
+  GBP_STAT_MEDIA_CACHE_MISSES,
+  GBP_STAT_METADATA_CACHE_HITS,
+  GBP_STAT_METADATA_CACHE_MISSES,
+  GBP_STAT_FRAME_CACHE_HITS,
+  GBP_STAT_FRAME_CACHE_MISSES,
+  GBP_STAT_PLAYBACK_COMMANDS,
+  GBP_STAT_PLAYBACK_COMMANDS_MERGED,
+  GBP_STAT_PLAYBACK_COMMAND_ALLOCATIONS,
+  GBP_STAT_PLAYBACK_WAKEUPS,
+  GBP_STAT_PLAYBACK_IDLE_WAKEUPS,
+  GBP_STAT_PLAYBACK_STUCK_STATE_CHANGES,
+  GBP_STAT_EVENTS_COLLAPSED,
+  /* gauges, not counters */
+  GBP_STAT_PLAYBACK_WORKERS,
+  GBP_STAT_PLAYBACK_ACTIVE_WORKERS,
+  GBP_STAT_PLAYBACK_IDLE_WORKERS,
+  /* high water marks, wait in microseconds */
+  GBP_STAT_PLAYBACK_MAX_QUEUE_DEPTH,
+  GBP_STAT_PLAYBACK_MAX_WAIT,
+  GBP_STAT_LAST
+} GbpStat;
+
+void gbp_stats_add (GbpStat stat, gint value);
+void gbp_stats_set (GbpStat stat, gint value);
+void gbp_stats_update_max (GbpStat stat, gint value);
+gint gbp_stats_get (GbpStat stat);
+const char *gbp_stats_get_name (GbpStat stat);
+
+#define gbp_stats_inc(stat) gbp_stats_add ((stat), 1)
+
+G_END_DECLS
+
+#endif /* GBP_STATS_H */
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "config.h"
+
+#include "gbp-watchdog.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gbp_player_debug);
+#define GST_CAT_DEFAULT gbp_player_debug
+
+typedef struct
+{
+  guint id;
+  GstClockTime deadline;
+  GbpWatchdogFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+} Watch;
+
+static GThread *watchdog_thread;
+static GMutex *lock;
+static GCond *cond;
+/* sorted by deadline */
+static GList *watches;
+static guint next_id;
+/* the watch whose callback is running, 0 if none */
+static guint running_id;
+static gboolean quit;
+
+static void
+watch_free (Watch *watch)
+{
+  if (watch->notify)
+    watch->notify (watch->user_data);
+  g_free (watch);
+}
+
+static gint
+compare_watches (gconstpointer a, gconstpointer b)
+{
+  const Watch *watch1 = (const Watch *) a;
+  const Watch *watch2 = (const Watch *) b;
+
+  if (watch1->deadline < watch2->deadline)
+    return -1;
+
+  return watch1->deadline > watch2->deadline;
+}
+
+static gpointer
+watchdog_func (gpointer data)
+{
+  Watch *watch;
+  GstClockTime now;
+  GTimeVal timeout;
+
+  g_mutex_lock (lock);
+  while (!quit) {
+    if (watches == NULL) {
+      g_cond_wait (cond, lock);
+      continue;
+    }
+
+    watch = (Watch *) watches->data;
+    now = gst_util_get_timestamp ();
+    if (watch->deadline > now) {
+      /* GCond only takes wall clock deadlines */
+      g_get_current_time (&timeout);
+      g_time_val_add (&timeout, (watch->deadline - now) / GST_USECOND);
+      g_cond_timed_wait (cond, lock, &timeout);
+      continue;
+    }
+
+    watches = g_list_delete_link (watches, watches);
+    running_id = watch->id;
+    g_mutex_unlock (lock);
+
+    GST_DEBUG ("watch %d expired", watch->id);
+    watch->func (watch->user_data);
+    watch_free (watch);
+
+    g_mutex_lock (lock);
+    running_id = 0;
+    g_cond_broadcast (cond);
+  }
+  g_mutex_unlock (lock);
+
+  return NULL;
+}
+
+void
+gbp_watchdog_init ()
+{
+  g_return_if_fail (watchdog_thread == NULL);
+
+  lock = g_mutex_new ();
+  cond = g_cond_new ();
+  quit = FALSE;
+  next_id = 1;
+  running_id = 0;
+
+  watchdog_thread = g_thread_create (watchdog_func, NULL, TRUE, NULL);
+}
+
+/* pending watches are dropped without being called */
+void
+gbp_watchdog_shutdown ()
+{
+  GList *walk;
+
+  g_return_if_fail (watchdog_thread != NULL);
+
+  g_mutex_lock (lock);
+  quit = TRUE;
+  g_cond_broadcast (cond);
+  g_mutex_unlock (lock);
+
+  g_thread_join (watchdog_thread);
+  watchdog_thread = NULL;
+
+  for (walk = watches; walk != NULL; walk = walk->next)
+    watch_free ((Watch *) walk->data);
+  g_list_free (watches);
+  watches = NULL;
+
+  g_cond_free (cond);
+  g_mutex_free (lock);
+}
+
+guint
+gbp_watchdog_add (GstClockTime timeout, GbpWatchdogFunc func,
+    gpointer user_data, GDestroyNotify notify)
+{
+  Watch *watch;
+  guint id;
+
+  g_return_val_if_fail (watchdog_thread != NULL, 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  watch = g_new (Watch, 1);
+  watch->deadline = gst_util_get_timestamp () + timeout;
+  watch->func = func;
+  watch->user_data = user_data;
+  watch->notify = notify;
+
+  g_mutex_lock (lock);
+  id = watch->id = next_id++;
+  if (next_id == 0)
+    next_id = 1;
+  watches = g_list_insert_sorted (watches, watch, compare_watches);
+  /* the new watch may expire before the one being waited for */
+  g_cond_signal (cond);
+  g_mutex_unlock (lock);
+
+  return id;
+}
+
+/* once this returns the callback isn't running and won't run */
+void
+gbp_watchdog_remove (guint id)
+{
+  Watch *watch = NULL;
+  GList *walk;
+
+  g_return_if_fail (watchdog_thread != NULL);
+
+  if (id == 0)
+    return;
+
+  g_mutex_lock (lock);
+  for (walk = watches; walk != NULL; walk = walk->next) {
+    if (((Watch *) walk->data)->id == id) {
+      watch = (Watch *) walk->data;
+      watches = g_list_delete_link (watches, walk);
+      break;
+    }
+  }
+
+  /* callbacks may remove their own watch */
+  while (watch == NULL && running_id == id &&
+      g_thread_self () != watchdog_thread)
+    g_cond_wait (cond, lock);
+  g_mutex_unlock (lock);
+
+  if (watch != NULL)
+    watch_free (watch);
+}
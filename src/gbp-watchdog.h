@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2009 Alessandro Decina
+ *
+ * Authors:
+ *   Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GBP_WATCHDOG_H
+#define GBP_WATCHDOG_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef void (*GbpWatchdogFunc) (gpointer user_data);
+
+/* a thread that calls func once timeout expires unless the watch is removed
+ * first. Callbacks run on the watchdog thread. */
+void gbp_watchdog_init ();
+void gbp_watchdog_shutdown ();
+guint gbp_watchdog_add (GstClockTime timeout, GbpWatchdogFunc func,
+    gpointer user_data, GDestroyNotify notify);
+void gbp_watchdog_remove (guint id);
+
+G_END_DECLS
+
+#endif /* GBP_WATCHDOG_H */